@@ -0,0 +1,156 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  Compare the throughput of the private arena (arena.cpp) with glibc
+//  malloc() on a trace-like pattern: each thread keeps a working set
+//  of live blocks and repeatedly frees a random one and allocates a
+//  replacement, mostly small (list nodes, short strings) with the
+//  occasional larger block.
+//
+//  Usage: ./arena-bench [-n ops] [-w working-set] [-t threads]
+//
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#define DEFAULT_OPS   4000000
+#define DEFAULT_WSET  1000
+
+typedef void * alloc_fcn_t(size_t);
+typedef void free_fcn_t(void *);
+
+struct Allocator {
+    const char * name;
+    alloc_fcn_t * alloc;
+    free_fcn_t * free;
+};
+
+static Allocator allocators[] = {
+    { "malloc", malloc, free },
+    { "arena",  arena_alloc, arena_free },
+};
+
+static long num_ops = DEFAULT_OPS;
+static long wset = DEFAULT_WSET;
+static Allocator * cur;
+
+//----------------------------------------------------------------------
+
+static double
+get_time(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+static inline unsigned long
+next_random(unsigned long *seed)
+{
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return *seed >> 33;
+}
+
+// 7/8 of requests are 16 to 256 bytes, 1/8 are up to 8K.
+//
+static inline size_t
+next_size(unsigned long *seed)
+{
+    unsigned long r = next_random(seed);
+
+    if ((r & 7) != 0) {
+	return 16 + (r >> 3) % 241;
+    }
+    return 256 + (r >> 3) % 8192;
+}
+
+static void *
+run_thread(void *arg)
+{
+    unsigned long seed = 12345 + 7919 * (long) arg;
+    void **live = (void **) calloc(wset, sizeof(void *));
+    long i;
+
+    for (i = 0; i < wset; i++) {
+	live[i] = cur->alloc(next_size(&seed));
+    }
+
+    for (i = 0; i < num_ops; i++) {
+	long k = next_random(&seed) % wset;
+	cur->free(live[k]);
+	live[k] = cur->alloc(next_size(&seed));
+	*(char *) live[k] = 1;
+    }
+
+    for (i = 0; i < wset; i++) {
+	cur->free(live[i]);
+    }
+    free(live);
+
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int num_threads = 1;
+    int ch, i;
+
+    while ((ch = getopt(argc, argv, "n:w:t:")) != -1) {
+	switch (ch) {
+	case 'n':
+	    num_ops = atol(optarg);
+	    break;
+	case 'w':
+	    wset = atol(optarg);
+	    break;
+	case 't':
+	    num_threads = atoi(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "usage: %s [-n ops] [-w working-set] [-t threads]\n",
+		    argv[0]);
+	    exit(1);
+	}
+    }
+    if (num_ops < 1 || wset < 1 || num_threads < 1) {
+	fprintf(stderr, "bad arguments\n");
+	exit(1);
+    }
+
+    pthread_t *tid = (pthread_t *) calloc(num_threads, sizeof(pthread_t));
+    double rate[2];
+
+    for (int a = 0; a < 2; a++) {
+	cur = &allocators[a];
+
+	double start = get_time();
+	for (i = 0; i < num_threads; i++) {
+	    pthread_create(&tid[i], NULL, run_thread, (void *) (long) i);
+	}
+	for (i = 0; i < num_threads; i++) {
+	    pthread_join(tid[i], NULL);
+	}
+	double secs = get_time() - start;
+
+	rate[a] = num_threads * num_ops / secs;
+	printf("%-8s threads: %d  ops: %ld  time: %.3f sec  ops/sec: %.0f\n",
+	       cur->name, num_threads, num_threads * num_ops, secs, rate[a]);
+    }
+
+    printf("arena/malloc: %.2f  arena mapped: %ld KB\n",
+	   rate[1] / rate[0], (long) arena_mapped_bytes() / 1024);
+    free(tid);
+
+    return 0;
+}
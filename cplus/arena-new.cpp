@@ -0,0 +1,124 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  operator new and delete for the libtrace-arena build: all of the
+//  library's C++ allocations go to the private arena.  Built with
+//  -fvisibility=hidden so that these do not replace the application's
+//  operator new.  The align_val_t forms exist only from C++17.
+//
+
+#include <cstddef>
+#include <new>
+
+#include "arena.h"
+
+void *
+operator new(std::size_t size)
+{
+    void *ptr = arena_alloc(size);
+    if (ptr == NULL) {
+	throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *
+operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *
+operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return arena_alloc(size);
+}
+
+void *
+operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return arena_alloc(size);
+}
+
+void
+operator delete(void *ptr) noexcept
+{
+    arena_free(ptr);
+}
+
+void
+operator delete[](void *ptr) noexcept
+{
+    arena_free(ptr);
+}
+
+void
+operator delete(void *ptr, std::size_t) noexcept
+{
+    arena_free(ptr);
+}
+
+void
+operator delete[](void *ptr, std::size_t) noexcept
+{
+    arena_free(ptr);
+}
+
+#ifdef __cpp_aligned_new
+
+void *
+operator new(std::size_t size, std::align_val_t align)
+{
+    void *ptr = arena_memalign((std::size_t) align, size);
+    if (ptr == NULL) {
+	throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void *
+operator new[](std::size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void *
+operator new(std::size_t size, std::align_val_t align,
+	     const std::nothrow_t &) noexcept
+{
+    return arena_memalign((std::size_t) align, size);
+}
+
+void *
+operator new[](std::size_t size, std::align_val_t align,
+	       const std::nothrow_t &) noexcept
+{
+    return arena_memalign((std::size_t) align, size);
+}
+
+void
+operator delete(void *ptr, std::align_val_t) noexcept
+{
+    arena_free(ptr);
+}
+
+void
+operator delete[](void *ptr, std::align_val_t) noexcept
+{
+    arena_free(ptr);
+}
+
+void
+operator delete(void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    arena_free(ptr);
+}
+
+void
+operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept
+{
+    arena_free(ptr);
+}
+
+#endif
@@ -0,0 +1,332 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  mmap-backed size-class allocator.  See arena.h.
+//
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#define ARENA_CHUNK  (1024 * 1024)
+#define ARENA_ALIGN  16
+
+// 16-byte steps up to 256, then powers of two up to 64K
+#define SMALL_MAX    256
+#define LARGE_MIN    (64 * 1024)
+#define NUM_SMALL    (SMALL_MAX / ARENA_ALIGN)
+#define NUM_CLASSES  (NUM_SMALL + 8)
+#define LARGE_CLASS  NUM_CLASSES
+
+// Each block is preceded by a header that gives its class, or its
+// mapping length for large blocks.  16 bytes keeps the payload
+// 16-byte aligned.  A large block's mapping starts at the page that
+// holds its header: at the header itself for arena_alloc(), part way
+// into the page for arena_memalign().
+//
+struct Header {
+    size_t  cls;
+    size_t  len;
+};
+
+struct FreeBlock {
+    FreeBlock * next;
+};
+
+static FreeBlock * free_list[NUM_CLASSES];
+
+static char * chunk_cur = NULL;
+static char * chunk_end = NULL;
+static size_t mapped_bytes = 0;
+static size_t page_size = 0;
+
+static volatile int arena_lock = 0;
+
+//----------------------------------------------------------------------
+
+static inline void
+lock(void)
+{
+    while (__sync_lock_test_and_set(&arena_lock, 1)) {
+	while (arena_lock) {
+	}
+    }
+}
+
+static inline void
+unlock(void)
+{
+    __sync_lock_release(&arena_lock);
+}
+
+static inline size_t
+class_size(size_t cls)
+{
+    if (cls < NUM_SMALL) {
+	return (cls + 1) * ARENA_ALIGN;
+    }
+    return (size_t) SMALL_MAX << (cls - NUM_SMALL + 1);
+}
+
+static inline size_t
+size_class(size_t size)
+{
+    if (size <= SMALL_MAX) {
+	return (size == 0) ? 0 : (size - 1) / ARENA_ALIGN;
+    }
+
+    size_t cls = NUM_SMALL;
+    size_t len = 2 * SMALL_MAX;
+    while (len < size) {
+	len *= 2;
+	cls++;
+    }
+    return cls;
+}
+
+static void *
+map_bytes(size_t len)
+{
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+	return NULL;
+    }
+    __sync_fetch_and_add(&mapped_bytes, len);
+
+    return mem;
+}
+
+static inline size_t
+get_page_size(void)
+{
+    if (page_size == 0) {
+	page_size = sysconf(_SC_PAGESIZE);
+    }
+    return page_size;
+}
+
+// Returns: the start of the mapping for a large block.
+//
+static inline char *
+large_base(Header *hdr)
+{
+    return (char *) ((uintptr_t) hdr & ~(uintptr_t) (get_page_size() - 1));
+}
+
+// Returns: a new block of class cls from the current chunk, with the
+// lock held.
+//
+static Header *
+carve(size_t cls)
+{
+    size_t len = sizeof(Header) + class_size(cls);
+
+    if (chunk_cur == NULL || chunk_cur + len > chunk_end) {
+	char *mem = (char *) map_bytes(ARENA_CHUNK);
+	if (mem == NULL) {
+	    return NULL;
+	}
+	chunk_cur = mem;
+	chunk_end = mem + ARENA_CHUNK;
+    }
+
+    Header *hdr = (Header *) chunk_cur;
+    chunk_cur += len;
+    hdr->cls = cls;
+    hdr->len = len;
+
+    return hdr;
+}
+
+//----------------------------------------------------------------------
+
+void *
+arena_alloc(size_t size)
+{
+    if (size > LARGE_MIN) {
+	size_t len = sizeof(Header) + size;
+	Header *hdr = (Header *) map_bytes(len);
+	if (hdr == NULL) {
+	    return NULL;
+	}
+	hdr->cls = LARGE_CLASS;
+	hdr->len = len;
+	return hdr + 1;
+    }
+
+    size_t cls = size_class(size);
+    void *ptr;
+
+    lock();
+    FreeBlock *blk = free_list[cls];
+    if (blk != NULL) {
+	free_list[cls] = blk->next;
+	ptr = blk;
+    }
+    else {
+	Header *hdr = carve(cls);
+	ptr = (hdr == NULL) ? NULL : hdr + 1;
+    }
+    unlock();
+
+    return ptr;
+}
+
+void
+arena_free(void *ptr)
+{
+    if (ptr == NULL) {
+	return;
+    }
+
+    Header *hdr = (Header *) ptr - 1;
+
+    if (hdr->cls == LARGE_CLASS) {
+	__sync_fetch_and_sub(&mapped_bytes, hdr->len);
+	munmap(large_base(hdr), hdr->len);
+	return;
+    }
+
+    FreeBlock *blk = (FreeBlock *) ptr;
+
+    lock();
+    blk->next = free_list[hdr->cls];
+    free_list[hdr->cls] = blk;
+    unlock();
+}
+
+void *
+arena_calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > (size_t) -1 / size) {
+	return NULL;
+    }
+
+    void *ptr = arena_alloc(nmemb * size);
+    if (ptr != NULL) {
+	memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
+}
+
+void *
+arena_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+	return arena_alloc(size);
+    }
+    if (size == 0) {
+	arena_free(ptr);
+	return NULL;
+    }
+
+    Header *hdr = (Header *) ptr - 1;
+    size_t old = (hdr->cls == LARGE_CLASS)
+	? large_base(hdr) + hdr->len - (char *) ptr
+	: class_size(hdr->cls);
+
+    if (size <= old) {
+	return ptr;
+    }
+
+    void *new_ptr = arena_alloc(size);
+    if (new_ptr != NULL) {
+	memcpy(new_ptr, ptr, old);
+	arena_free(ptr);
+    }
+    return new_ptr;
+}
+
+// Alignments up to ARENA_ALIGN come from the size classes.  Larger
+// ones get their own mapping, over-sized by align and then trimmed to
+// the pages around the header and payload.
+//
+void *
+arena_memalign(size_t align, size_t size)
+{
+    if ((align & (align - 1)) != 0) {
+	return NULL;
+    }
+    if (align <= ARENA_ALIGN) {
+	return arena_alloc(size);
+    }
+
+    size_t page = get_page_size();
+    if (size > (size_t) -1 - align - 2 * page) {
+	return NULL;
+    }
+
+    size_t len = align + size + 2 * page;
+    char *mem = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE,
+			      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+	return NULL;
+    }
+
+    uintptr_t addr = ((uintptr_t) mem + sizeof(Header) + align - 1)
+	& ~(uintptr_t) (align - 1);
+    char *ptr = (char *) addr;
+    Header *hdr = (Header *) ptr - 1;
+    char *base = large_base(hdr);
+    char *end = (char *) (((uintptr_t) ptr + size + page - 1)
+			  & ~(uintptr_t) (page - 1));
+
+    if (base > mem) {
+	munmap(mem, base - mem);
+    }
+    if (end < mem + len) {
+	munmap(end, mem + len - end);
+    }
+    __sync_fetch_and_add(&mapped_bytes, end - base);
+
+    hdr->cls = LARGE_CLASS;
+    hdr->len = end - base;
+
+    return ptr;
+}
+
+size_t
+arena_mapped_bytes(void)
+{
+    return mapped_bytes;
+}
+
+//----------------------------------------------------------------------
+
+// Targets of -Wl,--wrap=malloc etc.  Only the objects linked into the
+// library with those flags call these; the application's malloc() is
+// untouched.
+//
+extern "C" {
+
+void * __wrap_malloc(size_t size) { return arena_alloc(size); }
+void * __wrap_calloc(size_t n, size_t size) { return arena_calloc(n, size); }
+void * __wrap_realloc(void *ptr, size_t size) { return arena_realloc(ptr, size); }
+void   __wrap_free(void *ptr) { arena_free(ptr); }
+
+void * __wrap_aligned_alloc(size_t align, size_t size) { return arena_memalign(align, size); }
+void * __wrap_memalign(size_t align, size_t size) { return arena_memalign(align, size); }
+
+int
+__wrap_posix_memalign(void **ptr, size_t align, size_t size)
+{
+    if (align % sizeof(void *) != 0 || (align & (align - 1)) != 0) {
+	return EINVAL;
+    }
+    void *mem = arena_memalign(align, size);
+    if (mem == NULL) {
+	return ENOMEM;
+    }
+    *ptr = mem;
+    return 0;
+}
+
+}
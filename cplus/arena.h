@@ -0,0 +1,44 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A private heap for the profiler, separate from the application's
+//  malloc().  Memory comes from mmap() in 1 MB chunks and is carved
+//  into size classes with one free list per class; large blocks get
+//  their own mapping.  A spinlock makes it thread-safe.  The lock is
+//  not reentrant, so the arena must not be entered from a signal
+//  handler that interrupted the arena itself.  That never happens while
+//  only the profiler uses it.
+//
+//  In the libtrace-arena build, arena-new.cpp sends operator new and
+//  delete here, and the link flags redirect the library's own calls
+//  to malloc(), calloc(), realloc(), free(), posix_memalign(),
+//  aligned_alloc() and memalign() (including those from the static
+//  libstdc++) to the __wrap_ functions in arena.cpp.  The aligned
+//  forms of operator new are defined when the compiler has them
+//  (C++17), otherwise the static libstdc++ ones reach the arena
+//  through aligned_alloc() and free().  valloc() and pvalloc() are
+//  not wrapped.
+//
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void * arena_alloc(size_t size);
+void * arena_calloc(size_t nmemb, size_t size);
+void * arena_realloc(void *ptr, size_t size);
+void * arena_memalign(size_t align, size_t size);
+void   arena_free(void *ptr);
+size_t arena_mapped_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+#!/bin/sh
+#
+#  Copyright (c) 2017, Rice University.
+#  See the file LICENSE for details.
+#
+#  Benchmark the sampled malloc tracking (libtrace-malloc.so) against
+#  stress/memstress.  For each thread count, runs memstress plain and
+#  then with the preload at each MALLOC_RATE, and writes one CSV line
+#  per configuration: the mean malloc rate from memstress over the
+#  runs, the overhead against the plain run, and the samples, lost
+#  samples and sampling cost from the preload.
+#
+#  A run that doesn't finish within twice its time plus 30 seconds is
+#  killed and reported as a timeout, and a run that crashes (or finds
+#  memory corruption) as failed.
+#
+#  Usage: ./malloc-bench.sh [options] [file.so ...]
+#
+#    -m memstress   path to memstress (default ./memstress)
+#    -t "threads"   thread counts (default "1 4 64 256")
+#    -r "rates"     MALLOC_RATE values in bytes (default 524288)
+#    -s secs        memstress time per run (default 10)
+#    -n runs        runs per configuration (default 3)
+#    -o file.csv    output file (default stdout)
+#
+#  The default .so file is libtrace-malloc.so in the current
+#  directory.  Progress goes to stderr.
+#
+
+memstress=./memstress
+threads="1 4 64 256"
+rates=524288
+secs=10
+num_runs=3
+outfile=
+
+die() {
+    echo "error: $@" 1>&2
+    exit 1
+}
+
+usage() {
+    cat <<EOF
+usage: ./malloc-bench.sh [-m memstress] [-t threads] [-r rates] [-s secs]
+		  [-n runs] [-o file.csv] [file.so ...]
+EOF
+    exit 1
+}
+
+while getopts m:t:r:s:n:o:h opt
+do
+    case "$opt" in
+	m ) memstress="$OPTARG" ;;
+	t ) threads="$OPTARG" ;;
+	r ) rates="$OPTARG" ;;
+	s ) secs="$OPTARG" ;;
+	n ) num_runs="$OPTARG" ;;
+	o ) outfile="$OPTARG" ;;
+	* ) usage ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+
+libs="$*"
+if test "x$libs" = x ; then
+    libs=libtrace-malloc.so
+fi
+test -x "$memstress" || die "unable to run: $memstress (build it in stress/memstress)"
+
+tmpdir=`mktemp -d` || die "mktemp failed"
+trap 'rm -rf "$tmpdir"' EXIT
+
+if test "x$outfile" != x ; then
+    exec >"$outfile" || die "unable to write: $outfile"
+fi
+
+#
+#  Run one configuration num_runs times, append "rate samples lost
+#  cost" per run to $runs.  Args: preload malloc-rate threads.
+#
+run_config() {
+    runs="$tmpdir/runs"
+    out="$tmpdir/out"
+    limit=`expr 2 \* $secs + 30`
+    : >"$runs"
+    status=ok
+    n=0
+
+    while test $n -lt "$num_runs"
+    do
+	if test "x$1" = xnone ; then
+	    timeout "$limit" "$memstress" "$secs" "$3" >"$out" 2>&1
+	else
+	    # preload only memstress, not timeout
+	    timeout "$limit" env MALLOC_RATE="$2" LD_PRELOAD="$1" \
+		"$memstress" "$secs" "$3" >"$out" 2>&1
+	fi
+	ret=$?
+
+	if test $ret -eq 124 ; then
+	    status=timeout
+	    break
+	elif test $ret -ne 0 ; then
+	    status=failed
+	    break
+	fi
+
+	rate=`sed -n -e 's/.*rate: *\([0-9.e+]*\) *\/ *sec.*/\1/p' "$out" | tail -1`
+	samples=`sed -n -e 's/.*total samples = *\([0-9]*\).*/\1/p' "$out" | tail -1`
+	lost=`sed -n -e 's/.*lost: *\([0-9]*\).*/\1/p' "$out" | tail -1`
+	cost=`sed -n -e 's/.*sample cost:.*(\([0-9.e+-]*\)% of wall time).*/\1/p' "$out" | tail -1`
+
+	echo "${rate:-0} ${samples:-0} ${lost:-0} ${cost:-0}" >>"$runs"
+	n=`expr $n + 1`
+    done
+
+    set -- "$1" "$2" "$3" $n `awk '
+{ for (i = 1; i <= 4; i++) sum[i] += $i; n++ }
+END { if (n > 0) printf("%.6g %.6g %.6g %.4g\n", sum[1] / n, sum[2] / n, sum[3] / n, sum[4] / n) }' "$runs"`
+
+    if test "x$1" = xnone ; then
+	eval "base_$3=${5:-0}"
+    fi
+    eval "base=\$base_$3"
+
+    awk -v lib="$1" -v mrate="$2" -v thr="$3" -v runs="$4" -v rate="$5" \
+	-v samples="$6" -v lost="$7" -v cost="$8" -v base="$base" -v status="$status" '
+BEGIN {
+    over = ""
+    if (lib == "none") over = "0.00"
+    else if (rate > 0 && base > 0) over = sprintf("%.2f", 100 * (base / rate - 1))
+    if (lib == "none") { samples = ""; lost = ""; cost = "" }
+    printf("%s,%s,%s,%d,%s,%s,%s,%s,%s,%s\n", lib, mrate, thr, runs,
+	   rate, over, samples, lost, cost, status)
+}'
+
+    echo "$1  rate: $2  threads: $3  runs: $4  status: $status" 1>&2
+}
+
+echo "preload,malloc_rate,threads,runs,mallocs_per_sec,overhead_pct,samples,lost,sample_cost_pct,status"
+
+for thr in $threads
+do
+    run_config none "" "$thr"
+
+    for lib in $libs
+    do
+	case "$lib" in
+	    */* ) ;;
+	    * ) lib="./${lib}" ;;
+	esac
+	for mrate in $rates
+	do
+	    run_config "$lib" "$mrate" "$thr"
+	done
+    done
+done
@@ -9,38 +9,164 @@
 //  sum the elements and then clear the map.  This is just an excuse
 //  to trigger a lot of calls to malloc() and free().
 //
-//  Usage: ./map-sum  [time-in-seconds]
+//  With -t, run that many threads, each with its own map, for the
+//  same time.  Main only waits for them.  With -d, each thread first
+//  recurses that many (non-inlined) calls deep, for testing call path
+//  unwinders.
+//
+//  With -w, run a different allocation pattern instead of the map:
+//
+//    map     -- the map fill/sum/clear loop (the default)
+//    sizes   -- batches of malloc() across size classes from 16 bytes
+//               to 32K, freed in a different order
+//    xfree   -- producer/consumer, each thread passes its blocks to
+//               the next thread (in a ring) to free, so most frees are
+//               cross-thread (with one thread, it frees its own blocks
+//               and reports 0 cross-thread frees)
+//    realloc -- grow a block by realloc() doubling from 4K to 64M,
+//               across the mmap threshold, then free it
+//
+//  At the end, prints the number of iterations per second (summed
+//  over all threads), so that run.sh -o can compare a profiled run
+//  against a plain one, and the allocation throughput (calls to
+//  malloc or realloc and MB allocated per second), so that a slowdown
+//  from the profiler can be told apart from allocator contention.  For
+//  realloc, the MB are the sizes requested, which the library mostly
+//  satisfies with mremap() and does not copy, so the output labels
+//  them "requested MB/sec".
+//
+//  Each thread keeps its counters in locals and stores them in its
+//  ThreadArg at the end, and the ThreadArgs and the queue head and
+//  tail are on separate cache lines, so the threads don't slow each
+//  other down by false sharing.
+//
+//  Usage: ./map-sum  [-t threads]  [-d depth]  [-w mode]
+//                    [time-in-seconds]
 //
 
 #include <sys/types.h>
 #include <sys/time.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <unistd.h>
+#include <atomic>
 #include <iostream>
 #include <map>
+#include <new>
+#include <vector>
 
 #define SIZE  50000
 #define DEFAULT_TIME  20
 
+#define BATCH  1024
+#define QUEUE_SIZE  4096
+#define REALLOC_MIN  (4L * 1024)
+#define REALLOC_MAX  (64L * 1024 * 1024)
+
+#define CACHE_LINE  64
+
+#define MODE_MAP      0
+#define MODE_SIZES    1
+#define MODE_XFREE    2
+#define MODE_REALLOC  3
+
 using namespace std;
 
 typedef map <long, long> Lmap;
 
-int
-main(int argc, char **argv)
+// Single producer, single consumer queue of blocks for xfree.
+//
+struct BlockQueue {
+    alignas(CACHE_LINE) atomic <size_t> head;
+    alignas(CACHE_LINE) atomic <size_t> tail;
+    void * slot[QUEUE_SIZE];
+};
+
+struct alignas(CACHE_LINE) ThreadArg {
+    int   num;
+    int   depth;
+    long  len;
+    long  iter;
+    long  sum;
+    long  allocs;
+    long  bytes;
+    long  xfrees;
+    BlockQueue * out;
+    BlockQueue * in;
+};
+
+// rb-tree node: color, parent, left and right, plus the value
+static const size_t map_node_size = 4 * sizeof(void *) + sizeof(Lmap::value_type);
+
+static const size_t size_class[] = {
+    16, 32, 64, 128, 256, 512, 1024, 4096, 8192, 32768
+};
+#define NUM_SIZE_CLASS  (sizeof(size_class) / sizeof(size_class[0]))
+
+static struct timeval start;
+static volatile int sink;
+static int mode = MODE_MAP;
+
+//----------------------------------------------------------------------
+
+// Returns: an array of num value-initialized T's aligned to a cache
+// line.  vector <T> honors alignas() only from C++17 on.
+//
+template <class T>
+static T *
+new_aligned(int num)
 {
-    struct timeval start, last, now;
-    Lmap lmap;
-    long n, len, sum;
+    void * mem;
 
-    len = DEFAULT_TIME;
-    if (argc > 1 && atol(argv[1]) > 0) {
-	len = atol(argv[1]);
+    if (posix_memalign(&mem, CACHE_LINE, num * sizeof(T)) != 0) {
+	errx(1, "posix_memalign failed");
     }
+    T * array = (T *) mem;
+    for (int i = 0; i < num; i++) {
+	new (&array[i]) T();
+    }
+
+    return array;
+}
 
-    cout << "start\n";
+static inline unsigned long
+next_random(unsigned long *seed)
+{
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    return *seed >> 33;
+}
 
-    gettimeofday(&start, NULL);
-    last = start;
+// Returns: true if len seconds have passed since start.  Only thread
+// 0 prints the progress lines.
+//
+static bool
+time_up(ThreadArg * arg, struct timeval * last, long sum)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    if (arg->num == 0 && now.tv_sec > last->tv_sec) {
+	cout << "time: " << now.tv_sec - start.tv_sec
+	     << "  sum: " << sum << "\n";
+	*last = now;
+    }
+
+    return now.tv_sec >= start.tv_sec + arg->len;
+}
+
+// Fill and sum a map until len seconds after start.
+//
+static void
+fill_sum(ThreadArg * arg)
+{
+    struct timeval last = start;
+    Lmap lmap;
+    long n, sum;
+    long iter = 0, allocs = 0, bytes = 0;
 
     // run for len seconds
     for (;;) {
@@ -53,20 +179,329 @@ main(int argc, char **argv)
 	for (n = 1; n <= SIZE; n++) {
 	    sum += lmap[n];
 	}
+	iter++;
+	allocs += SIZE;
+	bytes += SIZE * map_node_size;
+
+	if (time_up(arg, &last, sum)) {
+	    break;
+	}
+    }
+
+    arg->iter = iter;
+    arg->allocs = allocs;
+    arg->bytes = bytes;
+    arg->sum = sum;
+}
+
+// Allocate a batch of blocks from random size classes, touch them and
+// free them in a different (strided) order.
+//
+static void
+alloc_sizes(ThreadArg * arg)
+{
+    struct timeval last = start;
+    unsigned long seed = 12345 + 7919 * arg->num;
+    char * block[BATCH];
+    long sum = 0;
+    long iter = 0, allocs = 0, bytes = 0;
+
+    for (;;) {
+	for (int i = 0; i < BATCH; i++) {
+	    size_t size = size_class[next_random(&seed) % NUM_SIZE_CLASS];
+
+	    block[i] = (char *) malloc(size);
+	    if (block[i] == NULL) {
+		err(1, "malloc failed");
+	    }
+	    block[i][0] = i;
+	    block[i][size - 1] = i;
+	    bytes += size;
+	}
+	allocs += BATCH;
+
+	for (int i = 0; i < BATCH; i++) {
+	    int j = (i * 7) % BATCH;
+	    sum += block[j][0];
+	    free(block[j]);
+	}
+	iter++;
+
+	if (time_up(arg, &last, sum)) {
+	    break;
+	}
+    }
+
+    arg->iter = iter;
+    arg->allocs = allocs;
+    arg->bytes = bytes;
+    arg->sum = sum;
+}
+
+// Returns: number of blocks freed from the in queue.
+//
+static long
+drain_queue(BlockQueue * q, long * sum)
+{
+    size_t head = q->head.load(memory_order_relaxed);
+    size_t tail = q->tail.load(memory_order_acquire);
+    long num = 0;
+
+    while (head != tail) {
+	char * block = (char *) q->slot[head % QUEUE_SIZE];
+	*sum += block[0];
+	free(block);
+	head++;
+	num++;
+    }
+    q->head.store(head, memory_order_release);
+
+    return num;
+}
+
+// Allocate a batch of blocks and pass them to the next thread to free,
+// and free the blocks from the previous thread.  Blocks that don't fit
+// in the queue are freed here.
+//
+static void
+alloc_xfree(ThreadArg * arg)
+{
+    struct timeval last = start;
+    unsigned long seed = 12345 + 7919 * arg->num;
+    BlockQueue * q = arg->out;
+    long sum = 0;
+    long iter = 0, allocs = 0, bytes = 0, xfrees = 0;
+
+    for (;;) {
+	size_t tail = q->tail.load(memory_order_relaxed);
+	size_t head = q->head.load(memory_order_acquire);
+
+	for (int i = 0; i < BATCH; i++) {
+	    size_t size = size_class[next_random(&seed) % NUM_SIZE_CLASS];
+
+	    char * block = (char *) malloc(size);
+	    if (block == NULL) {
+		err(1, "malloc failed");
+	    }
+	    block[0] = i;
+	    bytes += size;
+
+	    if (tail - head < QUEUE_SIZE) {
+		q->slot[tail % QUEUE_SIZE] = block;
+		tail++;
+	    }
+	    else {
+		sum += block[0];
+		free(block);
+	    }
+	}
+	q->tail.store(tail, memory_order_release);
+	allocs += BATCH;
 
-	gettimeofday(&now, NULL);
+	xfrees += drain_queue(arg->in, &sum);
+	iter++;
 
-	if (now.tv_sec > last.tv_sec) {
-	    cout << "time: " << now.tv_sec - start.tv_sec
-		 << "  sum: " << sum << "\n";
-	    last = now;
+	if (time_up(arg, &last, sum)) {
+	    break;
 	}
+	sched_yield();
+    }
+
+    arg->iter = iter;
+    arg->allocs = allocs;
+    arg->bytes = bytes;
+    arg->xfrees = xfrees;
+    arg->sum = sum;
+}
+
+// Grow one block by doubling with realloc(), touching the new end,
+// then free it.
+//
+static void
+alloc_realloc(ThreadArg * arg)
+{
+    struct timeval last = start;
+    long sum = 0;
+    long iter = 0, allocs = 0, bytes = 0;
+
+    for (;;) {
+	char * block = NULL;
+
+	for (long size = REALLOC_MIN; size <= REALLOC_MAX; size *= 2) {
+	    block = (char *) realloc(block, size);
+	    if (block == NULL) {
+		err(1, "realloc failed");
+	    }
+	    block[size - 1] = 1;
+	    allocs++;
+	    bytes += size;
+	}
+	sum += block[REALLOC_MAX - 1];
+	free(block);
+	iter++;
+
+	if (time_up(arg, &last, sum)) {
+	    break;
+	}
+    }
+
+    arg->iter = iter;
+    arg->allocs = allocs;
+    arg->bytes = bytes;
+    arg->sum = sum;
+}
+
+static void *
+run_mode(ThreadArg * arg)
+{
+    switch (mode) {
+    case MODE_SIZES:
+	alloc_sizes(arg);
+	break;
+    case MODE_XFREE:
+	alloc_xfree(arg);
+	break;
+    case MODE_REALLOC:
+	alloc_realloc(arg);
+	break;
+    default:
+	fill_sum(arg);
+	break;
+    }
+
+    return NULL;
+}
+
+// Recurse depth calls before the workload.  The volatile store after
+// the call keeps it from being a tail call.
+//
+static void * __attribute__ ((noinline))
+recurse(ThreadArg * arg, int depth)
+{
+    if (depth <= 0) {
+	return run_mode(arg);
+    }
 
-	if (now.tv_sec >= start.tv_sec + len) {
+    void * ret = recurse(arg, depth - 1);
+    sink = depth;
+
+    return ret;
+}
+
+static void *
+thread_main(void *ptr)
+{
+    ThreadArg * arg = (ThreadArg *) ptr;
+
+    return recurse(arg, arg->depth);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char * mode_name[] = { "map", "sizes", "xfree", "realloc" };
+    struct timeval now;
+    long len = DEFAULT_TIME;
+    long iter = 0;
+    long allocs = 0;
+    long bytes = 0;
+    long xfrees = 0;
+    int num_threads = 1;
+    int depth = 0;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "t:d:w:")) != -1) {
+	switch (ch) {
+	case 't':
+	    num_threads = atoi(optarg);
+	    if (num_threads < 1) {
+		errx(1, "bad number of threads: %s", optarg);
+	    }
+	    break;
+	case 'd':
+	    depth = atoi(optarg);
+	    break;
+	case 'w':
+	    for (mode = MODE_REALLOC; mode >= 0; mode--) {
+		if (strcmp(optarg, mode_name[mode]) == 0) {
+		    break;
+		}
+	    }
+	    if (mode < 0) {
+		errx(1, "unknown mode: %s (map, sizes, xfree or realloc)", optarg);
+	    }
 	    break;
+	default:
+	    errx(1, "usage: map-sum [-t threads] [-d depth] [-w mode] [time]");
 	}
     }
-    cout << "done\n";
+    if (optind < argc && atol(argv[optind]) > 0) {
+	len = atol(argv[optind]);
+    }
+
+    cout << "start  mode: " << mode_name[mode] << "\n";
+
+    ThreadArg * arg = new_aligned <ThreadArg> (num_threads);
+    BlockQueue * queue = new_aligned <BlockQueue> (num_threads);
+    vector <pthread_t> tid(num_threads);
+
+    gettimeofday(&start, NULL);
+
+    for (int i = 0; i < num_threads; i++) {
+	arg[i].num = i;
+	arg[i].depth = depth;
+	arg[i].len = len;
+	arg[i].out = &queue[i];
+	arg[i].in = &queue[(i + num_threads - 1) % num_threads];
+	queue[i].head = 0;
+	queue[i].tail = 0;
+    }
+
+    if (num_threads == 1) {
+	thread_main(&arg[0]);
+    }
+    else {
+	for (int i = 0; i < num_threads; i++) {
+	    if (pthread_create(&tid[i], NULL, thread_main, &arg[i]) != 0) {
+		errx(1, "pthread_create failed");
+	    }
+	}
+	for (int i = 0; i < num_threads; i++) {
+	    pthread_join(tid[i], NULL);
+	}
+    }
+
+    gettimeofday(&now, NULL);
+    double secs = (now.tv_sec - start.tv_sec)
+	+ (now.tv_usec - start.tv_usec) / 1000000.0;
+
+    for (int i = 0; i < num_threads; i++) {
+	long sum = 0;
+	drain_queue(&queue[i], &sum);
+
+	iter += arg[i].iter;
+	allocs += arg[i].allocs;
+	bytes += arg[i].bytes;
+	xfrees += arg[i].xfrees;
+    }
+
+    cout << "done  threads: " << num_threads
+	 << "  iterations: " << iter
+	 << "  iter/sec: " << iter / secs << "\n";
+
+    cout << "allocs: " << allocs
+	 << "  allocs/sec: " << allocs / secs
+	 << (mode == MODE_REALLOC ? "  requested MB/sec: " : "  MB/sec: ")
+	 << bytes / secs / (1024 * 1024)
+	 << "  per thread allocs/sec: " << allocs / secs / num_threads;
+    if (mode == MODE_XFREE) {
+	// with one thread, in == out and the frees are all local
+	cout << "  cross-thread frees: " << (num_threads > 1 ? xfrees : 0);
+    }
+    cout << "\n";
+
+    free(arg);
+    free(queue);
 
     return 0;
 }
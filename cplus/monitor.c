@@ -31,9 +31,10 @@
  *
  * ----------------------------------------------------------------------
  *
- *  This file is a stripped-down version of libmonitor's main.c to
- *  provide just the init and fini process callbacks.  See monitor.h
- *  for the list of callbacks and support functions.
+ *  This file is a stripped-down version of libmonitor's main.c and
+ *  pthread.c to provide just the init and fini process and thread
+ *  callbacks.  See monitor.h for the list of callbacks and support
+ *  functions.
  *
  *  Notes:
  *  1. Only implements the dynamic case with __libc_start_main().
@@ -45,6 +46,11 @@
  *  won't happen.
  *
  *  4. All callbacks must be implemented, no weak symbols.
+ *
+ *  5. Threads are caught by overriding pthread_create().  The fini
+ *  thread callback runs when the start routine returns or the thread
+ *  calls pthread_exit() or is canceled.  Thread numbers start at 1,
+ *  the main thread is 0.
  */
 
 #include <sys/types.h>
@@ -52,7 +58,9 @@
 #include <err.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "monitor.h"
@@ -96,19 +104,45 @@ static void *new_stinfo[4];
 typedef int start_main_fcn_t(START_MAIN_PARAM_LIST);
 typedef int main_fcn_t(int, char **, char **  AUXVEC_DECL );
 
+typedef void *pthread_start_fcn_t(void *);
+typedef int pthread_create_fcn_t(pthread_t *, const pthread_attr_t *,
+				 pthread_start_fcn_t *, void *);
+
+struct monitor_thread_info {
+    pthread_start_fcn_t *start_routine;
+    void *arg;
+    int  tid;
+};
+
 static start_main_fcn_t  *real_start_main = NULL;
 static main_fcn_t  *real_main = NULL;
+static pthread_create_fcn_t  *real_pthread_create = NULL;
 
-static void *stack_bottom = NULL;
+static __thread void *stack_bottom = NULL;
+static __thread int  thread_num = 0;
+static int  next_thread_num = 0;
 
 //----------------------------------------------------------------------
 
+/*
+ *  Returns: the bottom of the current thread's stack, that is, an
+ *  address in the frame of monitor_main() or monitor_thread_start().
+ */
 void *
 monitor_stack_bottom(void)
 {
     return stack_bottom;
 }
 
+/*
+ *  Returns: the current thread's number, 0 for the main thread.
+ */
+int
+monitor_get_thread_num(void)
+{
+    return thread_num;
+}
+
 static int
 monitor_main(int argc, char **argv, char **envp  AUXVEC_DECL )
 {
@@ -156,3 +190,67 @@ __libc_start_main(START_MAIN_PARAM_LIST)
 
     return 0;
 }
+
+//----------------------------------------------------------------------
+
+static void
+monitor_thread_cleanup(void *user_data)
+{
+    monitor_fini_thread(user_data);
+}
+
+static void *
+monitor_thread_start(void *ptr)
+{
+    struct monitor_thread_info info = *(struct monitor_thread_info *) ptr;
+    void *user_data;
+    void *ret;
+
+    free(ptr);
+
+    stack_bottom = alloca(8);
+    strncpy(stack_bottom, "stakbot", 8);
+    thread_num = info.tid;
+
+    user_data = monitor_init_thread(info.tid, NULL);
+
+    pthread_cleanup_push(monitor_thread_cleanup, user_data);
+    ret = (*info.start_routine)(info.arg);
+    pthread_cleanup_pop(1);
+
+    return ret;
+}
+
+int
+pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+	       pthread_start_fcn_t *start_routine, void *arg)
+{
+    struct monitor_thread_info *info;
+    const char *err_str;
+    int ret;
+
+    if (real_pthread_create == NULL) {
+	dlerror();
+	real_pthread_create = dlsym(RTLD_NEXT, "pthread_create");
+	err_str = dlerror();
+
+	if (real_pthread_create == NULL) {
+	    errx(1, "dlsym failed: %s", err_str);
+	}
+    }
+
+    info = malloc(sizeof(*info));
+    if (info == NULL) {
+	return EAGAIN;
+    }
+    info->start_routine = start_routine;
+    info->arg = arg;
+    info->tid = __sync_add_and_fetch(&next_thread_num, 1);
+
+    ret = (*real_pthread_create)(thread, attr, monitor_thread_start, info);
+    if (ret != 0) {
+	free(info);
+    }
+
+    return ret;
+}
@@ -52,19 +52,31 @@ extern "C" {
  */
 extern void *monitor_init_process(int *argc, char **argv, void *data);
 extern void monitor_fini_process(int how, void *data);
+extern void *monitor_init_thread(int tid, void *data);
+extern void monitor_fini_thread(void *data);
 
 /*
  *  Monitor support functions.
  */
 extern void *monitor_stack_bottom(void);
+extern int monitor_get_thread_num(void);
 
 /*
  *  Support functions from realtime.c.
  */
+#define RT_CLOCK_REALTIME  0
+#define RT_CLOCK_CPUTIME   1
+
 int  rt_make_timer(rt_sighandler_t *);
 void rt_start_timer(long);
 void rt_stop_timer();
 
+int  rt_make_thread_timer(rt_sighandler_t *, int);
+void rt_start_thread_timer(long);
+void rt_stop_thread_timer(void);
+void rt_delete_thread_timer(void);
+int  rt_thread_timer_overrun(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -7,18 +7,27 @@
  *
  *  This file provides support functions to create a POSIX
  *  CLOCK_REALTIME interrupt timer and to start and stop the timer.
- *  This is a process-wide (no threads) version of hpcrun's REALTIME
- *  sample source.
+ *  The rt_*_timer() functions are a process-wide (no threads) version
+ *  of hpcrun's REALTIME sample source.
+ *
+ *  The rt_*_thread_timer() functions give each thread its own timer,
+ *  either CLOCK_REALTIME or CLOCK_THREAD_CPUTIME_ID (hpcrun's CPUTIME),
+ *  delivered to that thread with SIGEV_THREAD_ID.  Each thread must
+ *  make, start, stop and delete its own timer.  The overrun count is
+ *  the number of extra expirations since the last signal, that is,
+ *  samples lost because the handler was too slow.
  *
  *  The header file for using these functions is part of monitor.h.
  */
 
 #include <sys/types.h>
+#include <sys/syscall.h>
 #include <err.h>
 #include <error.h>
 #include <signal.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "monitor.h"
 
@@ -26,8 +35,15 @@
 #define NOTIFY_METHOD   SIGEV_SIGNAL
 #define PROF_SIGNAL    (SIGRTMIN + 4)
 
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id  _sigev_un._tid
+#endif
+
 static timer_t timerid;
 
+static __thread timer_t thread_timerid;
+static __thread int  thread_timer_valid = 0;
+
 //----------------------------------------------------------------------
 
 int
@@ -89,3 +105,110 @@ rt_stop_timer(void)
 
     timer_settime(timerid, 0, &stop, NULL);
 }
+
+//----------------------------------------------------------------------
+
+/*
+ *  Make a timer for the current thread on clock RT_CLOCK_REALTIME or
+ *  RT_CLOCK_CPUTIME and install handler for it.
+ */
+int
+rt_make_thread_timer(rt_sighandler_t *handler, int clock)
+{
+    struct sigevent sev;
+    struct sigaction act;
+    clockid_t clock_id;
+    int ret;
+
+    clock_id = (clock == RT_CLOCK_CPUTIME) ? CLOCK_THREAD_CPUTIME_ID
+	: CLOCK_REALTIME;
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = PROF_SIGNAL;
+    sev.sigev_value.sival_ptr = &thread_timerid;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+
+    ret = timer_create(clock_id, &sev, &thread_timerid);
+    if (ret != 0) {
+	warn("timer_create failed");
+	return ret;
+    }
+    thread_timer_valid = 1;
+
+    memset(&act, 0, sizeof(act));
+    sigemptyset(&act.sa_mask);
+    act.sa_sigaction = handler;
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+
+    ret = sigaction(PROF_SIGNAL, &act, NULL);
+    if (ret != 0) {
+	warn("sigaction failed");
+	return ret;
+    }
+
+    return 0;
+}
+
+/*
+ *  Period in micro-seconds.
+ */
+void
+rt_start_thread_timer(long usec)
+{
+    struct itimerspec start;
+    long million = 1000000;
+
+    if (! thread_timer_valid) {
+	return;
+    }
+
+    memset(&start, 0, sizeof(start));
+    start.it_value.tv_sec = usec / million;
+    start.it_value.tv_nsec = 1000 * (usec % million);
+    start.it_interval.tv_sec = usec / million;
+    start.it_interval.tv_nsec = 1000 * (usec % million);
+
+    timer_settime(thread_timerid, 0, &start, NULL);
+}
+
+void
+rt_stop_thread_timer(void)
+{
+    struct itimerspec stop;
+
+    if (! thread_timer_valid) {
+	return;
+    }
+
+    memset(&stop, 0, sizeof(stop));
+
+    timer_settime(thread_timerid, 0, &stop, NULL);
+}
+
+void
+rt_delete_thread_timer(void)
+{
+    if (thread_timer_valid) {
+	thread_timer_valid = 0;
+	timer_delete(thread_timerid);
+    }
+}
+
+/*
+ *  Returns: the overrun count for the current thread's timer, safe
+ *  to call from the signal handler.
+ */
+int
+rt_thread_timer_overrun(void)
+{
+    int ret;
+
+    if (! thread_timer_valid) {
+	return 0;
+    }
+
+    ret = timer_getoverrun(thread_timerid);
+
+    return (ret > 0) ? ret : 0;
+}
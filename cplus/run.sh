@@ -10,11 +10,17 @@
 #  hpcrun.  This script is just a convenience.  You can always export
 #  these variables manually.
 #
-#  Usage: ./run.sh [period] file.so ... program arg ...
+#  Usage: ./run.sh [-o] [period] file.so ... program arg ...
+#
+#  With -o, run the program twice, once plain and once with the
+#  preload, and report samples/sec and the profiler's overhead.  The
+#  overhead comes from the program's "iter/sec:" line if it prints one
+#  (map-sum does), else from the wall time.
 #
 
 period=
 preload=
+overhead=no
 
 die() {
     echo "error: $@" 1>&2
@@ -23,14 +29,20 @@ die() {
 
 if test "x$1" = x ; then
     cat <<EOF
-usage: ./run.sh [period] file.so ... program arg ...
+usage: ./run.sh [-o] [period] file.so ... program arg ...
 
 where period is time in micro-seconds
 and file.so is a file to preload
+and -o reports samples/sec and overhead against a run without preload
 EOF
     exit 0
 fi
 
+if test "x$1" = x-o ; then
+    overhead=yes
+    shift
+fi
+
 while test "x$1" != x
 do
     arg="$1"
@@ -70,6 +82,53 @@ if test "x$period" != x ; then
     export PERIOD="$period"
 fi
 
-export LD_PRELOAD="$preload"
+if test "$overhead" = no ; then
+    export LD_PRELOAD="$preload"
+    exec "$@"
+fi
+
+#
+#  Overhead mode.
+#
+now() {
+    date +%s.%N
+}
+
+# iter/sec from program output, or empty
+rate() {
+    sed -n -e 's/.*iter\/sec: *\([0-9.e+]*\).*/\1/p' "$1" | tail -1
+}
+
+base_out=`mktemp`
+prof_out=`mktemp`
+trap 'rm -f "$base_out" "$prof_out"' EXIT
+
+t0=`now`
+"$@" >"$base_out" 2>&1 || die "plain run failed"
+t1=`now`
+LD_PRELOAD="$preload" "$@" >"$prof_out" 2>&1 || die "profiled run failed"
+t2=`now`
+
+base_rate=`rate "$base_out"`
+prof_rate=`rate "$prof_out"`
+samples=`sed -n -e 's/.*total samples = *\([0-9]*\).*/\1/p' "$prof_out" | tail -1`
+lost=`sed -n -e 's/.*lost: *\([0-9]*\).*/\1/p' "$prof_out" | tail -1`
 
-exec "$@"
+awk -v t0="$t0" -v t1="$t1" -v t2="$t2" -v br="$base_rate" -v pr="$prof_rate" \
+    -v samples="${samples:-0}" -v lost="${lost:-0}" -v preload="$preload" '
+BEGIN {
+    base = t1 - t0
+    prof = t2 - t1
+    printf("preload:%s\n", preload)
+    printf("plain:     %.3f sec", base)
+    if (br != "") printf("  %s iter/sec", br)
+    printf("\nprofiled:  %.3f sec", prof)
+    if (pr != "") printf("  %s iter/sec", pr)
+    printf("\nsamples: %d  lost: %d  samples/sec: %.1f\n",
+	   samples, lost, (prof > 0) ? samples / prof : 0)
+    if (br != "" && pr != "" && pr > 0)
+	over = 100.0 * (br / pr - 1.0)
+    else
+	over = (base > 0) ? 100.0 * (prof / base - 1.0) : 0
+    printf("overhead: %.2f%%\n", over)
+}'
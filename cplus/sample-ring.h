@@ -0,0 +1,110 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A fixed-size, single-producer, single-consumer ring of binary
+//  sample records.  The producer is the signal handler and the
+//  consumer runs outside signal context, so push() must never call
+//  malloc(), take a lock or make a syscall.
+//
+//  The ring's memory comes from mmap(), not malloc(), and is allocated
+//  before the timer starts.  When the ring is full, push() drops the
+//  record and counts it as lost rather than wait for the consumer.
+//
+
+#ifndef _SAMPLE_RING_H_
+#define _SAMPLE_RING_H_
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <atomic>
+
+typedef unsigned long ulong;
+
+// One sample: sequence number, time in usec since init, stack depth
+// in bytes and the interrupted IP.  Formatting the IP as a string is
+// left to the consumer.
+//
+struct SampleRecord {
+    ulong  count;
+    ulong  time;
+    long   depth;
+    void * ip;
+};
+
+class SampleRing {
+public:
+    // Returns: a new ring with room for size records (rounded up to a
+    // power of 2), or NULL if mmap fails.
+    //
+    static SampleRing * create(ulong size) {
+	ulong len = 1;
+	while (len < size) {
+	    len *= 2;
+	}
+
+	size_t bytes = sizeof(SampleRing) + len * sizeof(SampleRecord);
+	void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+	    return NULL;
+	}
+
+	SampleRing *ring = (SampleRing *) mem;
+	ring->mask = len - 1;
+	ring->bytes = bytes;
+	ring->lost = 0;
+	ring->head.store(0);
+	ring->tail.store(0);
+	ring->buf = (SampleRecord *) (ring + 1);
+
+	return ring;
+    }
+
+    static void destroy(SampleRing *ring) {
+	munmap(ring, ring->bytes);
+    }
+
+    // Producer side.  Returns: false if the ring is full.
+    //
+    bool push(const SampleRecord & rec) {
+	ulong t = tail.load(std::memory_order_relaxed);
+
+	if (t - head.load(std::memory_order_acquire) > mask) {
+	    lost++;
+	    return false;
+	}
+	buf[t & mask] = rec;
+	tail.store(t + 1, std::memory_order_release);
+
+	return true;
+    }
+
+    // Consumer side.  Returns: false if the ring is empty.
+    //
+    bool pop(SampleRecord & rec) {
+	ulong h = head.load(std::memory_order_relaxed);
+
+	if (h == tail.load(std::memory_order_acquire)) {
+	    return false;
+	}
+	rec = buf[h & mask];
+	head.store(h + 1, std::memory_order_release);
+
+	return true;
+    }
+
+    ulong capacity() { return mask + 1; }
+    ulong num_lost() { return lost; }
+
+private:
+    // producer and consumer indices on separate cache lines
+    alignas(64) std::atomic <ulong> tail;
+    ulong  lost;
+    alignas(64) std::atomic <ulong> head;
+    alignas(64) SampleRecord * buf;
+    ulong  mask;
+    size_t  bytes;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#!/bin/sh
+#
+#  Copyright (c) 2017, Rice University.
+#  See the file LICENSE for details.
+#
+#  Overhead sweep for the preload libraries.  Runs map-sum plain and
+#  then with each libtrace*.so variant, for each PERIOD and thread
+#  count, and writes one CSV line per configuration.
+#
+#  Each configuration is repeated until the 95% confidence interval
+#  of its iter/sec (or wall time if the program doesn't print one) is
+#  within -c percent of the mean, or until -N runs.  Overhead is
+#  against the plain run with the same thread count.
+#
+#  A run that doesn't finish within twice its time plus 30 seconds is
+#  killed and reported as a timeout, and a run that crashes is
+#  reported as failed.  The configuration stops at its first bad run
+#  (libtrace.so can deadlock or corrupt the malloc() heap, that's the
+#  point).
+#
+#  Usage: ./sweep.sh [options] [file.so ...]
+#
+#    -p "periods"   PERIOD values in usec (default "10000 2000 500")
+#    -t "threads"   map-sum thread counts (default "1 4")
+#    -s secs        map-sum time per run (default 5)
+#    -n min         min runs per configuration (default 3)
+#    -N max         max runs per configuration (default 10)
+#    -c pct         target CI half-width, percent of mean (default 2)
+#    -m map-sum     path to map-sum (default ./map-sum)
+#    -o file.csv    output file (default stdout)
+#
+#  The default .so files are all of the libtrace*.so files in the
+#  current directory.  Progress goes to stderr.
+#
+
+periods="10000 2000 500"
+threads="1 4"
+secs=5
+min_runs=3
+max_runs=10
+ci_pct=2
+mapsum=./map-sum
+outfile=
+
+die() {
+    echo "error: $@" 1>&2
+    exit 1
+}
+
+usage() {
+    cat <<EOF
+usage: ./sweep.sh [-p periods] [-t threads] [-s secs] [-n min] [-N max]
+		  [-c pct] [-m map-sum] [-o file.csv] [file.so ...]
+EOF
+    exit 1
+}
+
+while getopts p:t:s:n:N:c:m:o:h opt
+do
+    case "$opt" in
+	p ) periods="$OPTARG" ;;
+	t ) threads="$OPTARG" ;;
+	s ) secs="$OPTARG" ;;
+	n ) min_runs="$OPTARG" ;;
+	N ) max_runs="$OPTARG" ;;
+	c ) ci_pct="$OPTARG" ;;
+	m ) mapsum="$OPTARG" ;;
+	o ) outfile="$OPTARG" ;;
+	* ) usage ;;
+    esac
+done
+shift `expr $OPTIND - 1`
+
+libs="$*"
+if test "x$libs" = x ; then
+    libs=`ls libtrace*.so 2>/dev/null`
+fi
+if test "x$libs" = x ; then
+    die "no libtrace*.so files to preload"
+fi
+test -x "$mapsum" || die "unable to run: $mapsum"
+
+if test "$min_runs" -lt 2 ; then
+    min_runs=2
+fi
+if test "$max_runs" -lt "$min_runs" ; then
+    max_runs="$min_runs"
+fi
+
+tmpdir=`mktemp -d` || die "mktemp failed"
+trap 'rm -rf "$tmpdir"' EXIT
+
+if test "x$outfile" != x ; then
+    exec >"$outfile" || die "unable to write: $outfile"
+fi
+
+now() {
+    date +%s.%N
+}
+
+#
+#  Mean and 95% CI half-width (Student t) of column $1 of file $2,
+#  skipping "-" (no value).  Prints: n mean half-width.
+#
+stats() {
+    awk -v col="$1" '
+BEGIN {
+    split("12.706 4.303 3.182 2.776 2.571 2.447 2.365 2.306 2.262 2.228 " \
+	  "2.201 2.179 2.160 2.145 2.131 2.120 2.110 2.101 2.093 2.086", t, " ")
+}
+$col != "" && $col != "-" { n++; sum += $col; sq += $col * $col }
+END {
+    if (n == 0) { print 0, 0, 0; exit }
+    mean = sum / n
+    var = (n > 1) ? (sq - n * mean * mean) / (n - 1) : 0
+    if (var < 0) var = 0
+    tv = ((n - 1) in t) ? t[n - 1] : 1.96
+    half = (n > 1) ? tv * sqrt(var / n) : 0
+    printf("%d %.6g %.6g\n", n, mean, half)
+}' "$2"
+}
+
+#
+#  One run, append "wall rate samples lost" to $runs, with rate "-"
+#  if the program doesn't print one.  Returns non-zero on timeout or
+#  failure.
+#
+run_once() {
+    out="$tmpdir/out"
+    limit=`expr 2 \* $secs + 30`
+
+    t0=`now`
+    if test "x$1" = xnone ; then
+	timeout "$limit" "$mapsum" -t "$2" "$secs" >"$out" 2>&1
+    else
+	# preload only the program, not timeout
+	timeout "$limit" env PERIOD="$3" TRACE_DIR="$tmpdir" LD_PRELOAD="$1" \
+	    "$mapsum" -t "$2" "$secs" >"$out" 2>&1
+    fi
+    ret=$?
+    t1=`now`
+    rm -f "$tmpdir"/trace-*.bin
+
+    if test $ret -eq 124 ; then
+	status=timeout
+	return 1
+    elif test $ret -ne 0 ; then
+	status=failed
+	return 1
+    fi
+
+    rate=`sed -n -e 's/.*iter\/sec: *\([0-9.e+]*\).*/\1/p' "$out" | tail -1`
+    samples=`sed -n -e 's/.*total samples = *\([0-9]*\).*/\1/p' "$out" | tail -1`
+    lost=`sed -n -e 's/.*lost: *\([0-9]*\).*/\1/p' "$out" | tail -1`
+
+    echo "$t0 $t1 ${rate:--} ${samples:-0} ${lost:-0}" \
+	| awk '{ print $2 - $1, $3, $4, $5 }' >>"$runs"
+
+    return 0
+}
+
+#
+#  Repeat one configuration until the CI is tight, then print its CSV
+#  line.  Args: preload threads period.
+#
+run_config() {
+    runs="$tmpdir/runs"
+    : >"$runs"
+    status=ok
+    n=0
+
+    while test $n -lt "$max_runs"
+    do
+	run_once "$1" "$2" "$3" || break
+	n=`expr $n + 1`
+
+	if test $n -ge "$min_runs" ; then
+	    set -- "$1" "$2" "$3" `stats 2 "$runs"`
+	    if test "$4" -lt "$n" ; then
+		set -- "$1" "$2" "$3" `stats 1 "$runs"`
+	    fi
+	    tight=`awk -v m="$5" -v h="$6" -v c="$ci_pct" \
+		'BEGIN { print (m > 0 && 100 * h / m <= c) ? "yes" : "no" }'`
+	    set -- "$1" "$2" "$3"
+	    test "$tight" = yes && break
+	fi
+    done
+
+    set -- "$1" "$2" "$3" `stats 1 "$runs"` `stats 2 "$runs"` \
+	`stats 3 "$runs"` `stats 4 "$runs"`
+    # $4-6 wall, $7-9 rate, $10-12 samples, $13-15 lost
+
+    if test "x$1" = xnone ; then
+	eval "base_rate_$2=$8 base_rci_$2=$9 base_wall_$2=$5 base_wci_$2=$6"
+    fi
+    eval "br=\$base_rate_$2 brci=\$base_rci_$2 bw=\$base_wall_$2 bwci=\$base_wci_$2"
+
+    awk -v lib="$1" -v thr="$2" -v per="$3" -v runs="$4" \
+	-v wall="$5" -v wci="$6" -v rn="$7" -v rate="$8" -v rci="$9" \
+	-v samples="${11}" -v lost="${14}" -v status="$status" \
+	-v br="$br" -v brci="$brci" -v bw="$bw" -v bwci="$bwci" '
+BEGIN {
+    # overhead and its CI from the relative errors of the two means
+    over = ""; oci = ""
+    if (lib == "none") {
+	over = 0; oci = 0
+    }
+    else if (runs > 0 && rn == runs && br > 0 && rate > 0) {
+	over = 100 * (br / rate - 1)
+	oci = 100 * (br / rate) * sqrt((brci / br)^2 + (rci / rate)^2)
+    }
+    else if (runs > 0 && bw > 0 && wall > 0) {
+	over = 100 * (wall / bw - 1)
+	oci = 100 * (wall / bw) * sqrt((bwci / bw)^2 + (wci / wall)^2)
+    }
+    if (over != "") over = sprintf("%.2f", over)
+    if (oci != "") oci = sprintf("%.2f", oci)
+    if (runs == 0) { wall = ""; wci = ""; rate = ""; rci = ""; samples = ""; lost = "" }
+    if (rn == 0) { rate = ""; rci = "" }
+    printf("%s,%s,%s,%d,%s,%s,%s,%s,%s,%s,%s,%s,%s\n", lib, per, thr, runs,
+	   wall, wci, rate, rci, over, oci, samples, lost, status)
+}'
+
+    echo "$1  period: $3  threads: $2  runs: $4  status: $status" 1>&2
+}
+
+echo "preload,period,threads,runs,wall_sec,wall_ci,iter_per_sec,iter_ci,overhead_pct,overhead_ci,samples,lost,status"
+
+for thr in $threads
+do
+    run_config none "$thr" ""
+
+    for lib in $libs
+    do
+	case "$lib" in
+	    */* ) ;;
+	    * ) lib="./${lib}" ;;
+	esac
+	for per in $periods
+	do
+	    run_config "$lib" "$thr" "$per"
+	done
+    done
+done
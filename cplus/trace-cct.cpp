@@ -0,0 +1,572 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A call-path version of trace-thread.cpp.  Instead of just the leaf
+//  IP, the signal handler walks the frame pointers from the
+//  interrupted context up to the thread's stack bottom and inserts the
+//  path into a per-thread calling context tree (CCT).
+//
+//  The unwinder checks every frame pointer against the interrupted sp
+//  and monitor_stack_bottom() and requires frames to move strictly up
+//  the stack, so code without frame pointers gives a short path, not a
+//  crash.  Build the application with -fno-omit-frame-pointer to get
+//  full paths.  x86_64 only, other platforms get just the leaf.
+//
+//  A path deeper than MAX_DEPTH keeps its MAX_DEPTH frames nearest the
+//  root, so it still goes under the right part of the tree, and the
+//  frames nearest the leaf are dropped.  These samples are counted as
+//  truncated.
+//
+//  The CCT nodes live in an mmap'd array per thread and link by 32-bit
+//  index, so the handler does no malloc().  The tree caches the last
+//  path inserted: the new path is compared with it from the root, and
+//  only the changed suffix is looked up in the tree.  CCT_CACHE=0
+//  turns off the cache, so the two insertion strategies can be
+//  compared.
+//
+//  At fini process time, prints per thread the samples, nodes and
+//  bytes, and the mean and max cost of unwinding and inserting.
+//
+//  TIMER selects the timer, the same as trace-thread.cpp: process
+//  (the default), thread or cputime.  With the per-thread timers, each
+//  thread makes and starts its own timer at init thread time, and the
+//  timer overruns are counted.
+//
+//  Usage: LD_PRELOAD this file and export PERIOD as the number of
+//  micro-seconds per interrupt, per thread with the per-thread timers.
+//  CCT_NODES is the max nodes per thread (default 1M, at most 2^32 - 1
+//  since nodes link by 32-bit index).
+//
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+
+#include "monitor.h"
+
+#define DEFAULT_PERIOD  2000
+#define DEFAULT_CCT_NODES  (1024 * 1024)
+
+#define MAX_THREADS  1024
+#define MAX_DEPTH  256
+
+#define NO_NODE  0xffffffffu
+
+#define TIMER_PROCESS  0
+#define TIMER_THREAD   1
+#define TIMER_CPUTIME  2
+
+static_assert(DEFAULT_CCT_NODES <= NO_NODE, "CCT_NODES must fit in a node index");
+
+using namespace std;
+
+typedef unsigned long ulong;
+
+// One node per distinct call path prefix.  The root (index 0) has no
+// ip.  count is the number of samples with this node as the leaf.
+//
+struct CCTNode {
+    uint64_t  ip;
+    uint32_t  parent;
+    uint32_t  first_child;
+    uint32_t  next_sibling;
+    uint32_t  count;
+};
+
+// Per-thread state, written only by its own thread until fini
+// process.
+//
+struct ThreadData {
+    int    tid;
+    ulong  stack_bottom;
+
+    CCTNode * node;
+    uint32_t  num_nodes;
+    uint32_t  max_nodes;
+
+    // last path inserted, root first, and its nodes
+    int    last_depth;
+    ulong  last_ip[MAX_DEPTH];
+    uint32_t  last_node[MAX_DEPTH];
+
+    long   samples;
+    long   full;
+    long   truncated;
+    long   overrun;
+    long   total_depth;
+    long   cached_frames;
+    ulong  unwind_nsec;
+    ulong  unwind_max;
+    ulong  insert_nsec;
+    ulong  insert_max;
+    bool   done;
+};
+
+// A thread claims its slot with numThreads and then fills it in, so
+// the fini code may see a slot that is not yet set, and skips it.
+static atomic <ThreadData *> threadList[MAX_THREADS];
+static atomic <int> numThreads;
+static atomic <long> noThreadSamples;
+
+static __thread ThreadData * myData = NULL;
+
+static ulong  time0;
+static ulong  max_nodes;
+static bool   use_cache;
+static long   period;
+static int    timer_mode;
+
+//----------------------------------------------------------------------
+
+// Returns: current time since the epoch in micro-seconds.
+//
+static ulong
+get_usec(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return 1000000 * now.tv_sec + now.tv_usec;
+}
+
+// Returns: monotonic time in nano-seconds, for unwind and insert cost.
+//
+static ulong
+get_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return 1000000000 * now.tv_sec + now.tv_nsec;
+}
+
+//----------------------------------------------------------------------
+
+// Walk the frame pointers from context and fill in path[] leaf first:
+// the interrupted ip, then the return address of each frame.  Every
+// frame pointer must be 8-byte aligned, above the interrupted sp,
+// below the stack bottom, and above the previous frame, so the walk
+// always ends.  path[] is used as a circular buffer, so a stack
+// deeper than MAX_DEPTH keeps its outermost frames.
+//
+// Returns: the number of ips in path, and sets *truncated if frames
+// were dropped from the leaf end.
+//
+static int
+unwind(ucontext_t *context, ulong stack_bottom, ulong *path, bool *truncated)
+{
+    mcontext_t *mcontext = &(context->uc_mcontext);
+    int depth = 0;
+
+#if defined(__x86_64__)
+    ulong ip = mcontext->gregs[REG_RIP];
+    ulong sp = mcontext->gregs[REG_RSP];
+    ulong bp = mcontext->gregs[REG_RBP];
+
+    path[depth++] = ip;
+
+    ulong low = sp;
+    for (;;) {
+	if (bp < low || bp + 2 * sizeof(ulong) > stack_bottom
+	    || (bp & (sizeof(ulong) - 1)) != 0) {
+	    break;
+	}
+	ulong *frame = (ulong *) bp;
+	ulong ret = frame[1];
+
+	if (ret == 0) {
+	    break;
+	}
+	path[depth % MAX_DEPTH] = ret;
+	depth++;
+
+	low = bp + 2 * sizeof(ulong);
+	bp = frame[0];
+    }
+
+#elif defined(__powerpc__)
+    path[depth++] = mcontext->gregs[PPC_REG_PC];
+
+#endif
+
+    *truncated = (depth > MAX_DEPTH);
+    if (*truncated) {
+	// put the innermost frame kept at path[0]
+	rotate(path, path + depth % MAX_DEPTH, path + MAX_DEPTH);
+	depth = MAX_DEPTH;
+    }
+
+    return depth;
+}
+
+// Returns: the child of parent with this ip, making it if needed, or
+// NO_NODE if the node array is full.
+//
+static uint32_t
+findChild(ThreadData * td, uint32_t parent, ulong ip)
+{
+    uint32_t prev = NO_NODE;
+    uint32_t n = td->node[parent].first_child;
+
+    while (n != NO_NODE) {
+	if (td->node[n].ip == ip) {
+	    // move to front, the next sample likely takes the same path
+	    if (prev != NO_NODE) {
+		td->node[prev].next_sibling = td->node[n].next_sibling;
+		td->node[n].next_sibling = td->node[parent].first_child;
+		td->node[parent].first_child = n;
+	    }
+	    return n;
+	}
+	prev = n;
+	n = td->node[n].next_sibling;
+    }
+
+    if (td->num_nodes >= td->max_nodes) {
+	return NO_NODE;
+    }
+
+    n = td->num_nodes++;
+    td->node[n].ip = ip;
+    td->node[n].parent = parent;
+    td->node[n].first_child = NO_NODE;
+    td->node[n].next_sibling = td->node[parent].first_child;
+    td->node[n].count = 0;
+    td->node[parent].first_child = n;
+
+    return n;
+}
+
+// Insert a path given leaf first into the CCT.  With the cache, skip
+// the prefix (from the root) that matches the last path.
+//
+static void
+insertPath(ThreadData * td, ulong *path, int depth)
+{
+    int k = 0;
+
+    if (use_cache) {
+	int len = (depth < td->last_depth) ? depth : td->last_depth;
+	while (k < len && td->last_ip[k] == path[depth - 1 - k]) {
+	    k++;
+	}
+	// the leaf node is never shared with the last path unless the
+	// paths are identical
+	td->cached_frames += k;
+    }
+
+    uint32_t parent = (k > 0) ? td->last_node[k - 1] : 0;
+
+    for (int i = k; i < depth; i++) {
+	ulong ip = path[depth - 1 - i];
+	uint32_t n = findChild(td, parent, ip);
+
+	if (n == NO_NODE) {
+	    td->full++;
+	    td->last_depth = i;
+	    return;
+	}
+	td->last_ip[i] = ip;
+	td->last_node[i] = n;
+	parent = n;
+    }
+    td->last_depth = depth;
+    td->node[parent].count++;
+}
+
+// Make the current thread's data and CCT and add it to the list.
+// Not called from the signal handler.
+//
+static ThreadData *
+newThreadData(int tid)
+{
+    ThreadData * td = new ThreadData;
+
+    memset(td, 0, sizeof(*td));
+    td->tid = tid;
+    td->stack_bottom = (ulong) monitor_stack_bottom();
+
+    size_t bytes = max_nodes * sizeof(CCTNode);
+    void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+	err(1, "mmap for cct failed");
+    }
+    td->node = (CCTNode *) mem;
+    td->max_nodes = max_nodes;
+
+    // root
+    td->node[0].ip = 0;
+    td->node[0].parent = NO_NODE;
+    td->node[0].first_child = NO_NODE;
+    td->node[0].next_sibling = NO_NODE;
+    td->num_nodes = 1;
+
+    int n = numThreads.fetch_add(1);
+    if (n >= MAX_THREADS) {
+	errx(1, "too many threads: %d", n + 1);
+    }
+    threadList[n].store(td, memory_order_release);
+
+    return td;
+}
+
+// Safe in a signal handler: no malloc, no locks, and touches only the
+// current thread's data.
+//
+static void
+addSample(ucontext_t *context)
+{
+    ThreadData * td = myData;
+    ulong path[MAX_DEPTH];
+
+    if (td == NULL) {
+	// before init thread or after fini thread
+	noThreadSamples++;
+	return;
+    }
+
+    bool truncated;
+    ulong t0 = get_nsec();
+    int depth = unwind(context, td->stack_bottom, path, &truncated);
+    ulong t1 = get_nsec();
+    insertPath(td, path, depth);
+    ulong t2 = get_nsec();
+
+    td->samples++;
+    td->total_depth += depth;
+    if (truncated) {
+	td->truncated++;
+    }
+    td->unwind_nsec += t1 - t0;
+    td->insert_nsec += t2 - t1;
+    if (t1 - t0 > td->unwind_max) {
+	td->unwind_max = t1 - t0;
+    }
+    if (t2 - t1 > td->insert_max) {
+	td->insert_max = t2 - t1;
+    }
+}
+
+static void
+my_handler(int sig, siginfo_t *info, void *context)
+{
+    addSample((ucontext_t *) context);
+
+    ThreadData * td = myData;
+    if (td != NULL && timer_mode != TIMER_PROCESS) {
+	td->overrun += rt_thread_timer_overrun();
+    }
+}
+
+// Make and start the current thread's timer, if per-thread.
+//
+static void
+startThreadTimer()
+{
+    if (timer_mode == TIMER_PROCESS) {
+	return;
+    }
+
+    int clock = (timer_mode == TIMER_CPUTIME) ? RT_CLOCK_CPUTIME
+	: RT_CLOCK_REALTIME;
+
+    if (rt_make_thread_timer(my_handler, clock) != 0) {
+	err(1, "thread timer create failed");
+    }
+    rt_start_thread_timer(period);
+}
+
+static void
+stopThreadTimer()
+{
+    if (timer_mode == TIMER_PROCESS) {
+	return;
+    }
+
+    rt_stop_thread_timer();
+    rt_delete_thread_timer();
+}
+
+//----------------------------------------------------------------------
+//  Libmonitor callbacks
+//----------------------------------------------------------------------
+
+extern "C" {
+
+void *
+monitor_init_process(int *argc, char **argv, void *data)
+{
+    char *str = getenv("PERIOD");
+    period = DEFAULT_PERIOD;
+
+    if (str != NULL && atol(str) > 0) {
+	period = atol(str);
+    }
+
+    const char *timer_name = getenv("TIMER");
+    if (timer_name == NULL) {
+	timer_name = "process";
+    }
+    if (strcmp(timer_name, "process") == 0) {
+	timer_mode = TIMER_PROCESS;
+    }
+    else if (strcmp(timer_name, "thread") == 0) {
+	timer_mode = TIMER_THREAD;
+    }
+    else if (strcmp(timer_name, "cputime") == 0) {
+	timer_mode = TIMER_CPUTIME;
+    }
+    else {
+	errx(1, "unknown TIMER: %s (process, thread or cputime)", timer_name);
+    }
+
+    max_nodes = DEFAULT_CCT_NODES;
+    str = getenv("CCT_NODES");
+    if (str != NULL && atol(str) > 0) {
+	max_nodes = atol(str);
+    }
+    // NO_NODE is reserved, so the last index is NO_NODE - 1
+    if (max_nodes > NO_NODE) {
+	errx(1, "CCT_NODES too large: %lu (max %u)", max_nodes, NO_NODE);
+    }
+
+    str = getenv("CCT_CACHE");
+    use_cache = ! (str != NULL && atoi(str) == 0);
+
+    cout << "===>  init process:  period = " << period << " usec"
+	 << "  timer = " << timer_name
+	 << "  cache = " << (use_cache ? "on" : "off")
+	 << "  <===\n\n";
+
+    numThreads = 0;
+    noThreadSamples = 0;
+    time0 = get_usec();
+    myData = newThreadData(0);
+
+    if (timer_mode == TIMER_PROCESS) {
+	if (rt_make_timer(my_handler) != 0) {
+	    err(1, "timer create failed");
+	}
+	rt_start_timer(period);
+    }
+    else {
+	startThreadTimer();
+    }
+
+    return NULL;
+}
+
+void
+monitor_fini_process(int how, void *data)
+{
+    if (timer_mode == TIMER_PROCESS) {
+	rt_stop_timer();
+    }
+    else {
+	stopThreadTimer();
+    }
+
+    int num = numThreads.load();
+    long samples = 0;
+    long nodes = 0;
+    long full = 0;
+    long truncated = 0;
+    long overrun = 0;
+    long total_depth = 0;
+    long cached = 0;
+    ulong unwind_nsec = 0, unwind_max = 0;
+    ulong insert_nsec = 0, insert_max = 0;
+
+    cout << "\n";
+
+    for (int n = 0; n < num; n++) {
+	ThreadData * td = threadList[n].load(memory_order_acquire);
+	if (td == NULL) {
+	    continue;
+	}
+
+	cout << "thread: " << td->tid
+	     << "  samples: " << td->samples
+	     << "  nodes: " << td->num_nodes
+	     << "  bytes: " << td->num_nodes * sizeof(CCTNode)
+	     << "  mean depth: "
+	     << (td->samples > 0 ? (double) td->total_depth / td->samples : 0.0)
+	     << "  overrun: " << td->overrun
+	     << (td->done ? "" : "  (running)") << "\n";
+
+	samples += td->samples;
+	nodes += td->num_nodes;
+	full += td->full;
+	truncated += td->truncated;
+	overrun += td->overrun;
+	total_depth += td->total_depth;
+	cached += td->cached_frames;
+	unwind_nsec += td->unwind_nsec;
+	insert_nsec += td->insert_nsec;
+	if (td->unwind_max > unwind_max) {
+	    unwind_max = td->unwind_max;
+	}
+	if (td->insert_max > insert_max) {
+	    insert_max = td->insert_max;
+	}
+    }
+
+    cout << "\n===>  fini process:  total samples = " << samples
+	 << "  <===\n";
+
+    cout << "threads: " << num
+	 << "  nodes: " << nodes
+	 << "  bytes: " << nodes * sizeof(CCTNode)
+	 << "  mean depth: "
+	 << (samples > 0 ? (double) total_depth / samples : 0.0)
+	 << "  full: " << full
+	 << "  truncated: " << truncated
+	 << "  overrun: " << overrun
+	 << "  no thread: " << noThreadSamples.load() << "\n";
+
+    cout << "unwind: mean " << (samples > 0 ? unwind_nsec / samples : 0)
+	 << " nsec  max " << unwind_max << " nsec"
+	 << "  insert: mean " << (samples > 0 ? insert_nsec / samples : 0)
+	 << " nsec  max " << insert_max << " nsec"
+	 << "  cached frames: "
+	 << (total_depth > 0 ? 100.0 * cached / total_depth : 0.0) << "%\n";
+}
+
+void *
+monitor_init_thread(int tid, void *data)
+{
+    myData = newThreadData(tid);
+    startThreadTimer();
+
+    return myData;
+}
+
+void
+monitor_fini_thread(void *data)
+{
+    ThreadData * td = (ThreadData *) data;
+
+    stopThreadTimer();
+    myData = NULL;
+    if (td != NULL) {
+	td->done = true;
+    }
+}
+
+}  // extern "C"
@@ -0,0 +1,304 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A copy of trace.cpp that thins the samples online in O(1) amortized
+//  time per sample instead of rescanning and erasing a list.
+//
+//  The samples live in a fixed array of NUM_SLOTS time buckets, each
+//  width usec wide.  A new sample goes into bucket (time / width) if
+//  that bucket is empty and is dropped otherwise.  When time runs past
+//  the last bucket, the width doubles and buckets 2i and 2i+1 merge
+//  into bucket i, keeping the earlier sample.  So the kept samples are
+//  at most one per bucket, evenly spaced in time, and the first and
+//  last samples are always kept, the same guarantee as trace.cpp's
+//  reduceSampleList() with delta = width.
+//
+//  The merge touches NUM_SLOTS entries, but happens only log(time)
+//  times.  Time comes from CLOCK_MONOTONIC, so it never steps back,
+//  and the width stops doubling at MAX_WIDTH (about 12 days, so over
+//  two years of run time); past that, samples land in the last
+//  bucket.  The handler makes no malloc() calls, and the latency of
+//  every handler call is measured and the worst case reported at
+//  fini time.
+//
+//  Usage: LD_PRELOAD this file and export PERIOD as the number of
+//  micro-seconds for REALTIME interrupts.
+//
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "monitor.h"
+#include "sample-ring.h"
+
+#define DEFAULT_PERIOD  2000
+
+// NUM_SLOTS must be even.  After a merge, at least half of the slots
+// span elapsed time, so this keeps between 32 and 64 samples, close
+// to trace.cpp's MIN_SAMPLES and MAX_SAMPLES.
+#define NUM_SLOTS  64
+#define MAX_WIDTH  (1UL << 40)
+
+using namespace std;
+
+static SampleRecord slot[NUM_SLOTS];
+static SampleRecord last;
+static ulong  width;
+static long  merges;
+
+static ulong  time0;
+static ulong  stack_bottom;
+static long  count;
+
+static ulong  max_nsec;
+static ulong  total_nsec;
+static long  num_handler;
+
+//----------------------------------------------------------------------
+
+// Get instruction pointer (ip) and stack pointer (sp) from user
+// context.
+//
+static void
+get_regs(ucontext_t *context, void **ip, void **sp)
+{
+    mcontext_t *mcontext = &(context->uc_mcontext);
+
+#if defined(__x86_64__)
+    *ip = (void *) mcontext->gregs[REG_RIP];
+    *sp = (void *) mcontext->gregs[REG_RSP];
+
+#elif defined(__powerpc__)
+    *ip = (void *) mcontext->gregs[PPC_REG_PC];
+    *sp = (void *) mcontext->gregs[PPC_REG_SP];
+
+#else
+    *ip = NULL;
+    *sp = NULL;
+
+#endif
+}
+
+// Returns: monotonic time in micro-seconds.
+//
+static ulong
+get_usec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return 1000000 * now.tv_sec + now.tv_nsec / 1000;
+}
+
+// Returns: monotonic time in nano-seconds, for handler latency.
+//
+static ulong
+get_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return 1000000000 * now.tv_sec + now.tv_nsec;
+}
+
+//----------------------------------------------------------------------
+
+// Double the bucket width and merge pairs of buckets, keeping the
+// earlier sample of each pair.  Slots with count 0 are empty.
+//
+static void
+mergeSlots()
+{
+    for (int i = 0; i < NUM_SLOTS/2; i++) {
+	slot[i] = (slot[2*i].count != 0) ? slot[2*i] : slot[2*i + 1];
+    }
+    memset(&slot[NUM_SLOTS/2], 0, (NUM_SLOTS/2) * sizeof(SampleRecord));
+
+    width *= 2;
+    merges++;
+}
+
+// Returns: the bucket for a sample at time, clamped to the last one
+// once the width has reached MAX_WIDTH.
+//
+static ulong
+timeSlot(ulong time)
+{
+    ulong bucket = time / width;
+
+    return (bucket < NUM_SLOTS) ? bucket : NUM_SLOTS - 1;
+}
+
+// Safe in a signal handler: no malloc, no locks.
+//
+static void
+addSample(ucontext_t *context)
+{
+    SampleRecord rec;
+
+    count++;
+    rec.count = count;
+    rec.time = get_usec() - time0;
+
+    void *sp;
+    get_regs(context, &rec.ip, &sp);
+    rec.depth = stack_bottom - (ulong) sp;
+
+    while (rec.time / width >= NUM_SLOTS && width < MAX_WIDTH) {
+	mergeSlots();
+    }
+
+    ulong bucket = timeSlot(rec.time);
+    if (slot[bucket].count == 0) {
+	slot[bucket] = rec;
+    }
+    last = rec;
+}
+
+static void
+my_handler(int sig, siginfo_t *info, void *context)
+{
+    ulong start = get_nsec();
+
+    addSample((ucontext_t *) context);
+
+    ulong nsec = get_nsec() - start;
+    if (nsec > max_nsec) {
+	max_nsec = nsec;
+    }
+    total_nsec += nsec;
+    num_handler++;
+}
+
+//----------------------------------------------------------------------
+//  Libmonitor callbacks
+//----------------------------------------------------------------------
+
+extern "C" {
+
+void *
+monitor_init_process(int *argc, char **argv, void *data)
+{
+    char *str = getenv("PERIOD");
+    long period = DEFAULT_PERIOD;
+
+    if (str != NULL && atol(str) > 0) {
+	period = atol(str);
+    }
+
+    cout << "===>  init process:  period = " << period << " usec"
+	 << "  <===\n\n";
+
+    memset(slot, 0, sizeof(slot));
+    width = period;
+    merges = 0;
+    time0 = get_usec();
+    stack_bottom = (ulong) monitor_stack_bottom();
+    count = 0;
+    max_nsec = 0;
+    total_nsec = 0;
+    num_handler = 0;
+
+    ucontext_t context;
+    if (getcontext(&context) != 0) {
+	err(1, "getcontext failed");
+    }
+    addSample(&context);
+
+    if (rt_make_timer(my_handler) != 0) {
+	err(1, "timer create failed");
+    }
+    rt_start_timer(period);
+
+    return NULL;
+}
+
+void
+monitor_fini_process(int how, void *data)
+{
+    rt_stop_timer();
+
+    cout << "\n===>  fini process:  total samples = " << count + 1
+	 << "  <===\n";
+
+    ucontext_t context;
+    if (getcontext(&context) == 0) {
+	addSample(&context);
+    }
+    else {
+	warn("getcontext failed");
+    }
+
+    long kept = 0;
+    for (int i = 0; i < NUM_SLOTS; i++) {
+	if (slot[i].count != 0) {
+	    kept++;
+	}
+    }
+    bool last_kept = (slot[timeSlot(last.time)].count == last.count);
+    if (! last_kept) {
+	kept++;
+    }
+
+    cout << "handler calls: " << num_handler
+	 << "  max: " << max_nsec << " nsec"
+	 << "  mean: " << (num_handler > 0 ? total_nsec / num_handler : 0)
+	 << " nsec  merges: " << merges
+	 << "  width: " << width << " usec\n";
+
+    cout << "kept samples = " << kept << "\n";
+
+    for (int i = 0; i <= NUM_SLOTS; i++) {
+	SampleRecord *rec;
+
+	if (i < NUM_SLOTS) {
+	    rec = &slot[i];
+	    if (rec->count == 0) {
+		continue;
+	    }
+	}
+	else if (! last_kept) {
+	    rec = &last;
+	}
+	else {
+	    break;
+	}
+
+	stringstream buf;
+	buf << "ip@" << rec->ip;
+
+	cout << "index: " << rec->count
+	     << "  time: " << rec->time
+	     << "  depth: " << rec->depth
+	     << "  " << buf.str() << "\n";
+    }
+}
+
+// Samples are process-wide, nothing to do per thread.
+//
+void *
+monitor_init_thread(int tid, void *data)
+{
+    return NULL;
+}
+
+void
+monitor_fini_thread(void *data)
+{
+}
+
+}  // extern "C"
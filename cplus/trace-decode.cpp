@@ -0,0 +1,167 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  Offline decoder for the binary trace files from trace-stream.cpp
+//  (format in trace-file.h).  Prints each file's header and then one
+//  line per sample in the same form as trace.cpp, with time in usec
+//  since the thread started.
+//
+//  With -s, print only a one-line summary per file: samples, lost,
+//  duration, sample rate and the max stack depth.
+//
+//  Usage: ./trace-decode [-s] trace-file.bin ...
+//
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "trace-file.h"
+
+using namespace std;
+
+typedef unsigned long ulong;
+
+static bool summary = false;
+
+//----------------------------------------------------------------------
+
+// Returns: the number of records in the file.  A closed file (even
+// one with no records) has the count in the header.  If the writer
+// did not close the file, then the header count may be 0, so count up
+// to the first all-zero record.
+//
+static ulong
+numRecords(TraceHeader *header, TraceRecord *rec, ulong max_rec)
+{
+    if ((header->flags & TRACE_CLOSED) || header->num_records != 0) {
+	return (header->num_records <= max_rec) ? header->num_records : max_rec;
+    }
+
+    ulong n = 0;
+    while (n < max_rec
+	   && ! (rec[n].delta == 0 && rec[n].depth == 0 && rec[n].ip == 0)) {
+	n++;
+    }
+
+    return n;
+}
+
+// Returns: 0 on success, 1 if the file is unreadable or not a trace
+// file.
+//
+static int
+decodeFile(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+	warn("unable to open: %s", path);
+	return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(TraceHeader)) {
+	warnx("not a trace file: %s", path);
+	close(fd);
+	return 1;
+    }
+
+    void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+	warn("mmap failed: %s", path);
+	return 1;
+    }
+
+    TraceHeader *header = (TraceHeader *) mem;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0
+	|| header->version != TRACE_VERSION) {
+	warnx("not a trace file (or wrong version): %s", path);
+	munmap(mem, st.st_size);
+	return 1;
+    }
+
+    TraceRecord *rec = (TraceRecord *) (header + 1);
+    ulong max_rec = (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    ulong num = numRecords(header, rec, max_rec);
+
+    ulong time = 0;
+    long max_depth = 0;
+
+    if (! summary) {
+	cout << "file: " << path
+	     << "  thread: " << header->tid
+	     << "  start: " << header->start_usec
+	     << "  period: " << header->period << " usec"
+	     << "  samples: " << num
+	     << "  lost: " << header->num_lost
+	     << ((header->flags & TRACE_CLOSED) ? "" : "  (not closed)") << "\n";
+    }
+
+    for (ulong n = 0; n < num; n++) {
+	time += rec[n].delta;
+	if (rec[n].depth > max_depth) {
+	    max_depth = rec[n].depth;
+	}
+
+	if (! summary) {
+	    stringstream buf;
+	    buf << "ip@" << (void *) rec[n].ip;
+
+	    cout << "index: " << n + 1
+		 << "  time: " << time
+		 << "  depth: " << rec[n].depth
+		 << "  " << buf.str() << "\n";
+	}
+    }
+
+    if (summary) {
+	cout << path
+	     << "  thread: " << header->tid
+	     << "  samples: " << num
+	     << "  lost: " << header->num_lost
+	     << "  usec: " << time
+	     << "  samples/sec: " << (time > 0 ? 1000000.0 * num / time : 0.0)
+	     << "  max depth: " << max_depth << "\n";
+    }
+
+    munmap(mem, st.st_size);
+
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    int ch;
+
+    while ((ch = getopt(argc, argv, "s")) != -1) {
+	switch (ch) {
+	case 's':
+	    summary = true;
+	    break;
+	default:
+	    errx(1, "usage: trace-decode [-s] trace-file.bin ...");
+	}
+    }
+
+    if (optind >= argc) {
+	errx(1, "usage: trace-decode [-s] trace-file.bin ...");
+    }
+
+    int ret = 0;
+    for (int i = optind; i < argc; i++) {
+	ret |= decodeFile(argv[i]);
+    }
+
+    return ret;
+}
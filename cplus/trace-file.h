@@ -0,0 +1,51 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  Binary trace file format for trace-stream.cpp and trace-decode.
+//
+//  One file per thread: a 64-byte header followed by 16-byte records,
+//  all in native byte order.  Each record holds the time since the
+//  previous record in usec (the first record is relative to the
+//  header's start time), the stack depth in bytes and the IP.
+//
+//  The writer ftruncates the file to its final length at fini thread
+//  time, sets num_records in the header and sets TRACE_CLOSED in
+//  flags.  A thread still running at fini process time gets
+//  num_records but not TRACE_CLOSED.  If the process dies first, the
+//  file is still sparse out to its full mapped size and num_records
+//  is 0, so a reader stops at the first all-zero record.
+//
+
+#ifndef _TRACE_FILE_H_
+#define _TRACE_FILE_H_
+
+#include <stdint.h>
+
+#define TRACE_MAGIC    "TRCSTRM\0"
+#define TRACE_VERSION  2
+
+#define TRACE_CLOSED  1
+
+struct TraceHeader {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  tid;
+    uint64_t  start_usec;     // time of thread init since the epoch
+    uint64_t  period;         // sampling period in usec
+    uint64_t  num_records;    // 0 until the file is closed
+    uint64_t  num_lost;       // samples dropped when the file was full
+    uint64_t  flags;          // TRACE_CLOSED
+    uint64_t  pad;
+};
+
+struct TraceRecord {
+    uint32_t  delta;          // usec since the previous record
+    int32_t   depth;          // stack depth in bytes
+    uint64_t  ip;
+};
+
+static_assert(sizeof(TraceHeader) == 64, "TraceHeader must be 64 bytes");
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must be 16 bytes");
+
+#endif
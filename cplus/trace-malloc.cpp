@@ -0,0 +1,537 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  Sampled allocation tracking, a proxy for the hpcrun MEMLEAK source
+//  that only pays for a small fraction of the allocations.
+//
+//  The library overrides malloc(), calloc(), realloc() and free() and
+//  passes them on to glibc's __libc_malloc() and friends.  Each thread
+//  counts down the bytes it allocates, and when the count reaches
+//  zero, the allocation is sampled and the count restarts from an
+//  exponential random interval with mean MALLOC_RATE bytes (default
+//  512K), so the samples are a Poisson process in bytes allocated.
+//  A block of size s is sampled with probability 1 - exp(-s/rate), so
+//  a sampled block stands for s / (1 - exp(-s/rate)) bytes, and the
+//  sum of the weights is an unbiased estimate of the bytes allocated.
+//
+//  Only sampled allocations walk the frame pointers for their call
+//  path (x86_64, same bounds checks as trace-cct.cpp) and go into the
+//  live table, a fixed mmap'd open-addressing hash table keyed by
+//  address.  Slots are claimed and released with compare-and-swap,
+//  so there are no locks and no malloc() on either path.  Beside the
+//  table, a byte per slot counts the live blocks whose probe starts
+//  there, so free() of an unsampled block is almost always one load
+//  from a small array, not a probe of the table.  If the table is
+//  full, the sample is counted as lost.
+//
+//  At fini process time, prints the number of mallocs and bytes, the
+//  samples and the estimated bytes, the estimated live bytes at exit
+//  (leaks) and at peak, the cost of sampling and the top MALLOC_TOP
+//  call paths by estimated live bytes.  Mallocs and bytes are only
+//  counted for threads that have exited and main.  The sampling cost
+//  is wall time, so with more threads than CPUs, it includes the time
+//  a thread was preempted while sampling.
+//
+//  Usage: LD_PRELOAD this file.  MALLOC_TABLE is the table size
+//  (rounded up to a power of 2, default 64K).  Build the application
+//  with -fno-omit-frame-pointer for full paths.
+//
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include "monitor.h"
+
+#define DEFAULT_RATE  (512 * 1024)
+#define DEFAULT_TABLE  (64 * 1024)
+#define DEFAULT_TOP  10
+
+#define MAX_FRAMES  24
+#define MAX_PROBE  64
+
+#define EMPTY_KEY  0UL
+#define TOMB_KEY   1UL
+
+// TLS in this library must not go through __tls_get_addr(), which
+// can call malloc().
+#define TLS_IE  __attribute__ ((tls_model ("initial-exec")))
+
+using namespace std;
+
+typedef unsigned long ulong;
+
+extern "C" {
+void * __libc_malloc(size_t);
+void * __libc_calloc(size_t, size_t);
+void * __libc_realloc(void *, size_t);
+void   __libc_free(void *);
+}
+
+// One live sampled block.  key is the block address, or EMPTY_KEY or
+// TOMB_KEY.  The other fields belong to the thread that claimed the
+// slot until the block is freed.
+//
+struct LiveEntry {
+    atomic <ulong> key;
+    ulong  size;
+    ulong  weight;
+    int    tid;
+    int    depth;
+    ulong  ip[MAX_FRAMES];
+};
+
+static LiveEntry * table;
+static atomic <uint8_t> * home_count;
+static ulong  table_mask;
+static int    table_shift;
+
+static ulong  rate;
+static int    num_top;
+static ulong  time0;
+static bool   sampling = false;
+
+static atomic <long> numLive;
+static atomic <long> liveBytes;
+static atomic <long> peakBytes;
+static atomic <long> numSamples;
+static atomic <long> numLost;
+static atomic <long> sampleBytes;
+static atomic <ulong> sampleNsec;
+static atomic <long> totalMallocs;
+static atomic <long> totalBytes;
+
+static __thread long  bytes_left TLS_IE = 0;
+static __thread ulong seed TLS_IE = 0;
+static __thread long  my_mallocs TLS_IE = 0;
+static __thread long  my_bytes TLS_IE = 0;
+
+//----------------------------------------------------------------------
+
+// Returns: current time since the epoch in micro-seconds.
+//
+static ulong
+get_usec(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return 1000000 * now.tv_sec + now.tv_usec;
+}
+
+// Returns: monotonic time in nano-seconds, for sampling cost.
+//
+static ulong
+get_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return 1000000000 * now.tv_sec + now.tv_nsec;
+}
+
+// Returns: the next exponential interval in bytes with mean rate,
+// from a per-thread xorshift generator.
+//
+static long
+nextInterval(void)
+{
+    if (seed == 0) {
+	seed = (ulong) &seed ^ get_nsec() ^ 0x9e3779b97f4a7c15UL;
+    }
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+
+    // u in (0, 1]
+    double u = ((seed >> 11) + 1) * (1.0 / 9007199254740992.0);
+    long len = (long) (- (double) rate * log(u));
+
+    return (len > 0) ? len : 1;
+}
+
+static inline ulong
+hashKey(ulong key)
+{
+    return ((key >> 4) * 0x9e3779b97f4a7c15UL) >> table_shift;
+}
+
+//----------------------------------------------------------------------
+
+// Walk the frame pointers from bp (malloc's frame) and fill in path[]
+// leaf first with the return addresses.  Every frame pointer must be
+// 8-byte aligned, below the stack bottom and above the previous
+// frame.
+//
+// Returns: the number of ips in path.
+//
+static int
+unwind(ulong bp, ulong stack_bottom, ulong *path)
+{
+    int depth = 0;
+
+#if defined(__x86_64__)
+    ulong low = bp;
+
+    while (depth < MAX_FRAMES) {
+	if (bp < low || bp + 2 * sizeof(ulong) > stack_bottom
+	    || (bp & (sizeof(ulong) - 1)) != 0) {
+	    break;
+	}
+	ulong *frame = (ulong *) bp;
+	ulong ret = frame[1];
+
+	if (ret == 0) {
+	    break;
+	}
+	path[depth++] = ret;
+
+	low = bp + 2 * sizeof(ulong);
+	bp = frame[0];
+    }
+#endif
+
+    return depth;
+}
+
+// Record one sampled block in the live table.  Called from inside
+// malloc(), so no malloc and no locks.
+//
+static void __attribute__ ((noinline))
+sampleBlock(void *ptr, size_t size, void *bp)
+{
+    ulong start = get_nsec();
+    ulong key = (ulong) ptr;
+    ulong weight = (size > 0) ?
+	(ulong) (size / - expm1(- (double) size / rate)) : rate;
+
+    bytes_left = nextInterval();
+    numSamples++;
+    sampleBytes += weight;
+
+    ulong slot = hashKey(key);
+    LiveEntry * entry = NULL;
+
+    for (int n = 0; n < MAX_PROBE; n++) {
+	LiveEntry * e = &table[(slot + n) & table_mask];
+	ulong old = e->key.load(memory_order_relaxed);
+
+	if ((old == EMPTY_KEY || old == TOMB_KEY)
+	    && e->key.compare_exchange_strong(old, key)) {
+	    entry = e;
+	    break;
+	}
+    }
+
+    if (entry == NULL) {
+	numLost++;
+	sampleNsec += get_nsec() - start;
+	return;
+    }
+
+    // at most MAX_PROBE blocks can share a home slot
+    home_count[slot]++;
+
+    entry->size = size;
+    entry->weight = weight;
+    entry->tid = monitor_get_thread_num();
+    entry->depth = unwind((ulong) bp, (ulong) monitor_stack_bottom(), entry->ip);
+
+    numLive++;
+    long live = (liveBytes += weight);
+    long peak = peakBytes.load(memory_order_relaxed);
+    while (live > peak && ! peakBytes.compare_exchange_weak(peak, live)) {
+    }
+
+    sampleNsec += get_nsec() - start;
+}
+
+// If ptr is a live sampled block, take it out of the table.  Called
+// before the block goes back to glibc, so its address can't be
+// reused yet.
+//
+static void
+removeBlock(void *ptr)
+{
+    ulong key = (ulong) ptr;
+    ulong slot = hashKey(key);
+
+    if (home_count[slot].load(memory_order_relaxed) == 0) {
+	return;
+    }
+
+    for (int n = 0; n < MAX_PROBE; n++) {
+	LiveEntry * e = &table[(slot + n) & table_mask];
+	ulong old = e->key.load(memory_order_acquire);
+
+	if (old == EMPTY_KEY) {
+	    return;
+	}
+	if (old == key) {
+	    long weight = e->weight;
+	    if (e->key.compare_exchange_strong(old, TOMB_KEY)) {
+		home_count[slot]--;
+		numLive--;
+		liveBytes -= weight;
+	    }
+	    return;
+	}
+    }
+}
+
+static inline void
+countAlloc(void *ptr, size_t size, void *bp)
+{
+    my_mallocs++;
+    my_bytes += size;
+
+    // first malloc in this thread, start the count
+    if (seed == 0) {
+	bytes_left = nextInterval();
+    }
+
+    bytes_left -= size;
+    if (bytes_left <= 0 && ptr != NULL) {
+	sampleBlock(ptr, size, bp);
+    }
+}
+
+static void
+foldThreadCounts(void)
+{
+    totalMallocs += my_mallocs;
+    totalBytes += my_bytes;
+    my_mallocs = 0;
+    my_bytes = 0;
+}
+
+//----------------------------------------------------------------------
+//  Malloc overrides
+//----------------------------------------------------------------------
+
+extern "C" {
+
+void *
+malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+
+    if (sampling) {
+	countAlloc(ptr, size, __builtin_frame_address(0));
+    }
+    return ptr;
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    void *ptr = __libc_calloc(nmemb, size);
+
+    if (sampling) {
+	countAlloc(ptr, nmemb * size, __builtin_frame_address(0));
+    }
+    return ptr;
+}
+
+// Take old out of the table only if the realloc succeeded (or freed
+// old with size 0).  If it fails, old is still allocated and stays
+// tracked.  By then old has gone back to glibc, so another thread
+// could get and sample the same address first and lose its entry
+// instead, which only skews the live estimate.
+//
+void *
+realloc(void *old, size_t size)
+{
+    void *ptr = __libc_realloc(old, size);
+
+    if (sampling && old != NULL && (ptr != NULL || size == 0)
+	&& numLive.load(memory_order_relaxed) > 0) {
+	removeBlock(old);
+    }
+
+    if (sampling && size > 0) {
+	countAlloc(ptr, size, __builtin_frame_address(0));
+    }
+    return ptr;
+}
+
+void
+free(void *ptr)
+{
+    if (sampling && ptr != NULL && numLive.load(memory_order_relaxed) > 0) {
+	removeBlock(ptr);
+    }
+    __libc_free(ptr);
+}
+
+}  // extern "C"
+
+//----------------------------------------------------------------------
+//  Libmonitor callbacks
+//----------------------------------------------------------------------
+
+struct PathInfo {
+    long  weight;
+    long  blocks;
+};
+
+typedef map <vector <ulong>, PathInfo> PathMap;
+
+extern "C" {
+
+void *
+monitor_init_process(int *argc, char **argv, void *data)
+{
+    char *str = getenv("MALLOC_RATE");
+    rate = DEFAULT_RATE;
+
+    if (str != NULL && atol(str) > 0) {
+	rate = atol(str);
+    }
+
+    long size = DEFAULT_TABLE;
+    str = getenv("MALLOC_TABLE");
+    if (str != NULL && atol(str) > 0) {
+	size = atol(str);
+    }
+
+    num_top = DEFAULT_TOP;
+    str = getenv("MALLOC_TOP");
+    if (str != NULL && atoi(str) >= 0) {
+	num_top = atoi(str);
+    }
+
+    int bits = 4;
+    while ((1L << bits) < size) {
+	bits++;
+    }
+    size = 1L << bits;
+    table_mask = size - 1;
+    table_shift = 64 - bits;
+
+    table = (LiveEntry *) mmap(NULL, size * sizeof(LiveEntry),
+			       PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (table == MAP_FAILED) {
+	err(1, "mmap for live table failed");
+    }
+
+    home_count = (atomic <uint8_t> *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+					    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (home_count == MAP_FAILED) {
+	err(1, "mmap for live table failed");
+    }
+
+    cout << "===>  init process:  rate = " << rate << " bytes"
+	 << "  table = " << size << "  <===\n\n";
+
+    time0 = get_usec();
+    sampling = true;
+
+    return NULL;
+}
+
+void
+monitor_fini_process(int how, void *data)
+{
+    // the C++ below calls malloc, don't sample it
+    sampling = false;
+    foldThreadCounts();
+
+    ulong elapsed = get_usec() - time0;
+    long samples = numSamples.load();
+    ulong nsec = sampleNsec.load();
+
+    cout << "\n===>  fini process:  total samples = " << samples
+	 << "  <===\n";
+
+    cout << "mallocs: " << totalMallocs.load()
+	 << "  bytes: " << totalBytes.load()
+	 << "  samples: " << samples
+	 << "  est bytes: " << sampleBytes.load()
+	 << "  lost: " << numLost.load() << "\n";
+
+    cout << "live blocks: " << numLive.load()
+	 << "  live est bytes: " << liveBytes.load()
+	 << "  peak est bytes: " << peakBytes.load() << "\n";
+
+    cout << "sample cost: mean " << (samples > 0 ? nsec / samples : 0)
+	 << " nsec  total: " << nsec / 1000 << " usec"
+	 << "  (" << (elapsed > 0 ? 0.1 * nsec / elapsed : 0.0)
+	 << "% of wall time)\n";
+
+    // live blocks at exit by call path
+    PathMap paths;
+
+    for (ulong n = 0; n <= table_mask; n++) {
+	LiveEntry * e = &table[n];
+	ulong key = e->key.load();
+
+	if (key == EMPTY_KEY || key == TOMB_KEY) {
+	    continue;
+	}
+	vector <ulong> path(e->ip, e->ip + e->depth);
+	PathInfo & info = paths[path];
+	info.weight += e->weight;
+	info.blocks++;
+    }
+
+    vector <pair <long, const vector <ulong> *>> top;
+
+    for (auto it = paths.begin(); it != paths.end(); ++it) {
+	top.push_back(make_pair(it->second.weight, &it->first));
+    }
+    sort(top.begin(), top.end(),
+	 [](const pair <long, const vector <ulong> *> & a,
+	    const pair <long, const vector <ulong> *> & b) {
+	     return a.first > b.first;
+	 });
+
+    cout << "live paths: " << paths.size() << "\n";
+
+    for (int n = 0; n < num_top && n < (int) top.size(); n++) {
+	const vector <ulong> & path = *top[n].second;
+
+	cout << "\npath: " << n + 1
+	     << "  live est bytes: " << top[n].first
+	     << "  blocks: " << paths[path].blocks
+	     << "  depth: " << path.size() << "\n";
+
+	for (auto it = path.begin(); it != path.end(); ++it) {
+	    stringstream buf;
+	    buf << "ip@" << (void *) *it;
+	    cout << "  " << buf.str() << "\n";
+	}
+    }
+}
+
+void *
+monitor_init_thread(int tid, void *data)
+{
+    return NULL;
+}
+
+void
+monitor_fini_thread(void *data)
+{
+    foldThreadCounts();
+}
+
+}  // extern "C"
@@ -0,0 +1,310 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A copy of trace.cpp that does not deadlock over the malloc() lock.
+//  The signal handler writes a fixed-size binary record into a
+//  preallocated ring (sample-ring.h) and does nothing else: no new, no
+//  stringstream, no list insert.  All of the C++ (draining the rings,
+//  thinning the samples, formatting "ip@" strings) happens in
+//  monitor_fini_process() after the timer is stopped.
+//
+//  The process timer interrupts any one thread, so two handlers can
+//  run at once on different threads.  Each thread gets its own ring at
+//  init thread time, found through a __thread pointer, so every ring
+//  has a single producer.  The sample counter is atomic.  Samples in a
+//  thread before init thread or after fini thread are counted and
+//  dropped.  trace-thread.cpp adds per-thread timers on top of this.
+//
+//  Each ring holds RING_SIZE records (default 256K).  Samples that
+//  arrive when a ring is full are counted as lost.
+//
+//  Usage: LD_PRELOAD this file and export PERIOD as the number of
+//  micro-seconds for REALTIME interrupts.
+//
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "monitor.h"
+#include "sample-ring.h"
+
+#define DEFAULT_PERIOD  2000
+#define DEFAULT_RING_SIZE  (256 * 1024)
+
+#define MAX_THREADS  1024
+#define MIN_SAMPLES  30
+
+using namespace std;
+
+typedef vector <SampleRecord> SampleVec;
+
+// A thread claims its slot with numRings and then fills it in, so the
+// fini code may see a slot that is not yet set, and skips it.
+static atomic <SampleRing *> ringList[MAX_THREADS];
+static atomic <int> numRings;
+static atomic <long> numSamples;
+static atomic <long> noRingSamples;
+
+static __thread SampleRing * myRing = NULL;
+static __thread ulong myStackBottom;
+
+static ulong  time0;
+static ulong  ring_size;
+
+//----------------------------------------------------------------------
+
+// Get instruction pointer (ip) and stack pointer (sp) from user
+// context.
+//
+static void
+get_regs(ucontext_t *context, void **ip, void **sp)
+{
+    mcontext_t *mcontext = &(context->uc_mcontext);
+
+#if defined(__x86_64__)
+    *ip = (void *) mcontext->gregs[REG_RIP];
+    *sp = (void *) mcontext->gregs[REG_RSP];
+
+#elif defined(__powerpc__)
+    *ip = (void *) mcontext->gregs[PPC_REG_PC];
+    *sp = (void *) mcontext->gregs[PPC_REG_SP];
+
+#else
+    *ip = NULL;
+    *sp = NULL;
+
+#endif
+}
+
+// Returns: current time since the epoch in micro-seconds.
+//
+static ulong
+get_usec(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return 1000000 * now.tv_sec + now.tv_usec;
+}
+
+//----------------------------------------------------------------------
+
+// Make the current thread's ring and add it to the list.  Not called
+// from the signal handler.
+//
+static SampleRing *
+newRing()
+{
+    SampleRing * ring = SampleRing::create(ring_size);
+    if (ring == NULL) {
+	err(1, "mmap for sample ring failed");
+    }
+
+    int n = numRings.fetch_add(1);
+    if (n >= MAX_THREADS) {
+	errx(1, "too many threads: %d", n + 1);
+    }
+    ringList[n].store(ring, memory_order_release);
+
+    return ring;
+}
+
+// Keep samples that are at least delta usec apart, plus the first and
+// last ones, the same as trace.cpp's reduceSampleList(), but once at
+// the end and on a vector.
+//
+static void
+reduceSamples(SampleVec & samples, ulong delta)
+{
+    if (samples.size() <= MIN_SAMPLES) {
+	return;
+    }
+
+    size_t keep = 0;
+    size_t last = samples.size() - 1;
+
+    for (size_t i = 1; i < last; i++) {
+	if (samples[i].time >= samples[keep].time + delta) {
+	    samples[++keep] = samples[i];
+	}
+    }
+    samples[++keep] = samples[last];
+    samples.resize(keep + 1);
+}
+
+// Safe in a signal handler: no malloc, no locks, and writes only the
+// current thread's ring.
+//
+static void
+addSample(ucontext_t *context)
+{
+    SampleRing * ring = myRing;
+
+    if (ring == NULL) {
+	// before init thread or after fini thread
+	noRingSamples++;
+	return;
+    }
+
+    SampleRecord rec;
+
+    rec.count = ++numSamples;
+    rec.time = get_usec() - time0;
+
+    void *sp;
+    get_regs(context, &rec.ip, &sp);
+    rec.depth = myStackBottom - (ulong) sp;
+
+    ring->push(rec);
+}
+
+static void
+my_handler(int sig, siginfo_t *info, void *context)
+{
+    addSample((ucontext_t *) context);
+}
+
+//----------------------------------------------------------------------
+//  Libmonitor callbacks
+//----------------------------------------------------------------------
+
+extern "C" {
+
+void *
+monitor_init_process(int *argc, char **argv, void *data)
+{
+    char *str = getenv("PERIOD");
+    long period = DEFAULT_PERIOD;
+
+    if (str != NULL && atol(str) > 0) {
+	period = atol(str);
+    }
+
+    ring_size = DEFAULT_RING_SIZE;
+    str = getenv("RING_SIZE");
+    if (str != NULL && atol(str) > 0) {
+	ring_size = atol(str);
+    }
+
+    cout << "===>  init process:  period = " << period << " usec"
+	 << "  <===\n\n";
+
+    numRings = 0;
+    numSamples = 0;
+    noRingSamples = 0;
+    time0 = get_usec();
+    myStackBottom = (ulong) monitor_stack_bottom();
+    myRing = newRing();
+
+    ucontext_t context;
+    if (getcontext(&context) != 0) {
+	err(1, "getcontext failed");
+    }
+    addSample(&context);
+
+    if (rt_make_timer(my_handler) != 0) {
+	err(1, "timer create failed");
+    }
+    rt_start_timer(period);
+
+    return NULL;
+}
+
+void
+monitor_fini_process(int how, void *data)
+{
+    rt_stop_timer();
+
+    ucontext_t context;
+    if (getcontext(&context) == 0) {
+	addSample(&context);
+    }
+    else {
+	warn("getcontext failed");
+    }
+
+    ulong elapsed = get_usec() - time0;
+
+    cout << "\n===>  fini process:  total samples = " << numSamples
+	 << "  <===\n";
+
+    SampleVec samples;
+    SampleRecord rec;
+    int num = numRings.load();
+    long lost = 0;
+
+    samples.reserve(numSamples);
+    for (int n = 0; n < num; n++) {
+	SampleRing * ring = ringList[n].load(memory_order_acquire);
+	if (ring == NULL) {
+	    continue;
+	}
+	while (ring->pop(rec)) {
+	    samples.push_back(rec);
+	}
+	lost += ring->num_lost();
+    }
+
+    // each ring is in time order, merge them
+    stable_sort(samples.begin(), samples.end(),
+		[](const SampleRecord & a, const SampleRecord & b) {
+		    return a.time < b.time;
+		});
+
+    cout << "samples: " << numSamples.load()
+	 << "  lost: " << lost
+	 << "  no thread: " << noRingSamples.load()
+	 << "  threads: " << num
+	 << "  samples/sec: " << (elapsed > 0 ? 1000000.0 * numSamples / elapsed : 0.0)
+	 << "\n";
+
+    reduceSamples(samples, elapsed / MIN_SAMPLES);
+
+    cout << "kept samples = " << samples.size() << "\n";
+
+    for (auto it = samples.begin(); it != samples.end(); ++it) {
+	stringstream buf;
+	buf << "ip@" << it->ip;
+
+	cout << "index: " << it->count
+	     << "  time: " << it->time
+	     << "  depth: " << it->depth
+	     << "  " << buf.str() << "\n";
+    }
+
+    // the rings are not unmapped, other threads may still be running
+    // if main() returns without joining them
+}
+
+void *
+monitor_init_thread(int tid, void *data)
+{
+    myStackBottom = (ulong) monitor_stack_bottom();
+    myRing = newRing();
+
+    return NULL;
+}
+
+// Keep the thread's ring for fini process, but stop sampling into it.
+//
+void
+monitor_fini_thread(void *data)
+{
+    myRing = NULL;
+}
+
+}  // extern "C"
@@ -0,0 +1,367 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A streaming version of trace-thread.cpp.  Instead of keeping a
+//  ring in memory and printing a thinned summary at exit, each thread
+//  writes every sample as a 16-byte binary record (trace-file.h)
+//  into its own trace file.
+//
+//  The file is created, extended to TRACE_SIZE bytes (sparse) and
+//  mmap'd MAP_SHARED at init thread time, so the signal handler only
+//  stores into memory: no write(), no malloc(), no locks.  The kernel
+//  writes the dirty pages back to the file in the background.  At
+//  fini thread time, the file is unmapped and truncated to the records
+//  actually written.  Threads still running at fini process time keep
+//  their mapping, but the record count goes into the header.  Samples
+//  after the file is full are counted as lost.
+//
+//  The files are TRACE_DIR/trace-<pid>-<tid>.bin (default dir ".").
+//  Use trace-decode to read them.
+//
+//  Usage: LD_PRELOAD this file and export PERIOD as the number of
+//  micro-seconds for REALTIME interrupts.  TRACE_SIZE is in MB per
+//  thread (default 64, about 4 million samples).
+//
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+
+#include "monitor.h"
+#include "trace-file.h"
+
+#define DEFAULT_PERIOD  2000
+#define DEFAULT_TRACE_SIZE  64
+
+#define MAX_THREADS  1024
+
+using namespace std;
+
+typedef unsigned long ulong;
+
+// Per-thread state, written only by its own thread until it is
+// closed.
+//
+struct ThreadData {
+    int    tid;
+    int    fd;
+    ulong  stack_bottom;
+    ulong  last_usec;
+    size_t  map_size;
+    TraceHeader * header;
+    TraceRecord * rec;
+    ulong  num_rec;
+    ulong  max_rec;
+    ulong  lost;
+    bool   closed;
+    char   path[256];
+};
+
+// A thread claims its slot with numThreads and then fills it in, so
+// the fini code may see a slot that is not yet set, and skips it.
+static atomic <ThreadData *> threadList[MAX_THREADS];
+static atomic <int> numThreads;
+static atomic <long> noThreadSamples;
+
+static __thread ThreadData * myData = NULL;
+
+static ulong  time0;
+static long   period;
+static size_t  trace_size;
+static const char * trace_dir;
+
+//----------------------------------------------------------------------
+
+// Get instruction pointer (ip) and stack pointer (sp) from user
+// context.
+//
+static void
+get_regs(ucontext_t *context, void **ip, void **sp)
+{
+    mcontext_t *mcontext = &(context->uc_mcontext);
+
+#if defined(__x86_64__)
+    *ip = (void *) mcontext->gregs[REG_RIP];
+    *sp = (void *) mcontext->gregs[REG_RSP];
+
+#elif defined(__powerpc__)
+    *ip = (void *) mcontext->gregs[PPC_REG_PC];
+    *sp = (void *) mcontext->gregs[PPC_REG_SP];
+
+#else
+    *ip = NULL;
+    *sp = NULL;
+
+#endif
+}
+
+// Returns: current time since the epoch in micro-seconds.
+//
+static ulong
+get_usec(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return 1000000 * now.tv_sec + now.tv_usec;
+}
+
+//----------------------------------------------------------------------
+
+// Create and map the current thread's trace file and add it to the
+// list.  Not called from the signal handler.
+//
+static ThreadData *
+openTrace(int tid)
+{
+    ThreadData * td = new ThreadData;
+
+    memset(td, 0, sizeof(*td));
+    td->tid = tid;
+    td->stack_bottom = (ulong) monitor_stack_bottom();
+    td->last_usec = get_usec();
+
+    snprintf(td->path, sizeof(td->path), "%s/trace-%d-%d.bin",
+	     trace_dir, (int) getpid(), tid);
+
+    td->fd = open(td->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (td->fd < 0) {
+	err(1, "unable to open trace file: %s", td->path);
+    }
+
+    td->map_size = trace_size;
+    if (ftruncate(td->fd, td->map_size) != 0) {
+	err(1, "ftruncate failed: %s", td->path);
+    }
+
+    void *mem = mmap(NULL, td->map_size, PROT_READ | PROT_WRITE,
+		     MAP_SHARED, td->fd, 0);
+    if (mem == MAP_FAILED) {
+	err(1, "mmap failed: %s", td->path);
+    }
+
+    td->header = (TraceHeader *) mem;
+    td->rec = (TraceRecord *) (td->header + 1);
+    td->max_rec = (td->map_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+
+    memcpy(td->header->magic, TRACE_MAGIC, sizeof(td->header->magic));
+    td->header->version = TRACE_VERSION;
+    td->header->tid = tid;
+    td->header->start_usec = td->last_usec;
+    td->header->period = period;
+
+    int n = numThreads.fetch_add(1);
+    if (n >= MAX_THREADS) {
+	errx(1, "too many threads: %d", n + 1);
+    }
+    threadList[n].store(td, memory_order_release);
+
+    return td;
+}
+
+// Fill in the header counts, unmap and truncate the file to the
+// records written.  The caller must make sure that the handler no
+// longer writes to it.
+//
+static void
+closeTrace(ThreadData * td)
+{
+    if (td->closed) {
+	return;
+    }
+    td->closed = true;
+
+    td->header->num_records = td->num_rec;
+    td->header->num_lost = td->lost;
+    td->header->flags |= TRACE_CLOSED;
+
+    munmap(td->header, td->map_size);
+
+    off_t len = sizeof(TraceHeader) + td->num_rec * sizeof(TraceRecord);
+    if (ftruncate(td->fd, len) != 0) {
+	warn("ftruncate failed: %s", td->path);
+    }
+    close(td->fd);
+}
+
+// Safe in a signal handler: no malloc, no locks, no syscalls, and
+// touches only the current thread's data.
+//
+static void
+addSample(ucontext_t *context)
+{
+    ThreadData * td = myData;
+
+    if (td == NULL) {
+	// before init thread or after fini thread
+	noThreadSamples++;
+	return;
+    }
+
+    if (td->num_rec >= td->max_rec) {
+	td->lost++;
+	return;
+    }
+
+    ulong now = get_usec();
+    ulong delta = now - td->last_usec;
+    td->last_usec = now;
+
+    void *ip, *sp;
+    get_regs(context, &ip, &sp);
+
+    TraceRecord * rec = &td->rec[td->num_rec];
+    rec->delta = (delta > UINT32_MAX) ? UINT32_MAX : delta;
+    rec->depth = td->stack_bottom - (ulong) sp;
+    rec->ip = (uint64_t) ip;
+
+    td->num_rec++;
+}
+
+static void
+my_handler(int sig, siginfo_t *info, void *context)
+{
+    addSample((ucontext_t *) context);
+}
+
+//----------------------------------------------------------------------
+//  Libmonitor callbacks
+//----------------------------------------------------------------------
+
+extern "C" {
+
+void *
+monitor_init_process(int *argc, char **argv, void *data)
+{
+    char *str = getenv("PERIOD");
+    period = DEFAULT_PERIOD;
+
+    if (str != NULL && atol(str) > 0) {
+	period = atol(str);
+    }
+
+    long size = DEFAULT_TRACE_SIZE;
+    str = getenv("TRACE_SIZE");
+    if (str != NULL && atol(str) > 0) {
+	size = atol(str);
+    }
+    trace_size = size << 20;
+
+    trace_dir = getenv("TRACE_DIR");
+    if (trace_dir == NULL || trace_dir[0] == 0) {
+	trace_dir = ".";
+    }
+
+    cout << "===>  init process:  period = " << period << " usec"
+	 << "  <===\n\n";
+
+    numThreads = 0;
+    noThreadSamples = 0;
+    time0 = get_usec();
+    myData = openTrace(0);
+
+    ucontext_t context;
+    if (getcontext(&context) != 0) {
+	err(1, "getcontext failed");
+    }
+    addSample(&context);
+
+    if (rt_make_timer(my_handler) != 0) {
+	err(1, "timer create failed");
+    }
+    rt_start_timer(period);
+
+    return NULL;
+}
+
+void
+monitor_fini_process(int how, void *data)
+{
+    rt_stop_timer();
+
+    ucontext_t context;
+    if (getcontext(&context) == 0) {
+	addSample(&context);
+    }
+    else {
+	warn("getcontext failed");
+    }
+
+    myData = NULL;
+
+    ulong elapsed = get_usec() - time0;
+    int num = numThreads.load();
+    ulong total = 0;
+    ulong lost = 0;
+    ulong bytes = 0;
+
+    for (int n = 0; n < num; n++) {
+	ThreadData * td = threadList[n].load(memory_order_acquire);
+	if (td == NULL) {
+	    continue;
+	}
+
+	// a thread still running could be in the handler, so leave its
+	// file mapped and full size, and only fill in the header
+	if (td->tid == 0) {
+	    closeTrace(td);
+	}
+	else if (! td->closed) {
+	    td->header->num_records = td->num_rec;
+	    td->header->num_lost = td->lost;
+	}
+	total += td->num_rec;
+	lost += td->lost;
+	bytes += sizeof(TraceHeader) + td->num_rec * sizeof(TraceRecord);
+    }
+
+    cout << "\n===>  fini process:  total samples = " << total
+	 << "  <===\n";
+
+    cout << "threads: " << num
+	 << "  files: " << trace_dir << "/trace-" << getpid() << "-*.bin"
+	 << "  bytes: " << bytes << "\n";
+
+    cout << "samples: " << total
+	 << "  lost: " << lost
+	 << "  no thread: " << noThreadSamples.load()
+	 << "  samples/sec: " << (elapsed > 0 ? 1000000.0 * total / elapsed : 0.0)
+	 << "\n";
+}
+
+void *
+monitor_init_thread(int tid, void *data)
+{
+    myData = openTrace(tid);
+
+    return myData;
+}
+
+void
+monitor_fini_thread(void *data)
+{
+    ThreadData * td = (ThreadData *) data;
+
+    myData = NULL;
+    if (td != NULL) {
+	closeTrace(td);
+    }
+}
+
+}  // extern "C"
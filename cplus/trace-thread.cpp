@@ -0,0 +1,461 @@
+//
+//  Copyright (c) 2017, Rice University.
+//  See the file LICENSE for details.
+//
+//  A per-thread version of trace-ring.cpp.  Each thread, including
+//  main, gets its own sample ring (sample-ring.h) at init thread time,
+//  and the signal handler writes only into the ring of the thread it
+//  interrupts, found through a __thread pointer.  So the sampling path
+//  has no shared state, no locks and no malloc().
+//
+//  TIMER selects the timer (realtime.c):
+//
+//    process -- one process-wide REALTIME timer (the default), each
+//       interrupt lands in some one thread
+//    thread  -- a REALTIME timer per thread
+//    cputime -- a CLOCK_THREAD_CPUTIME_ID timer per thread
+//
+//  With the per-thread timers, each thread makes and starts its own
+//  timer at init thread time, and the handler adds the timer's
+//  overrun count, the samples the kernel dropped because the handler
+//  was too slow.  The handler's own cost is also measured.
+//
+//  At fini process time, the timers are stopped and all of the rings
+//  are drained, merged by time and thinned, and the per-thread counts
+//  are printed.
+//
+//  Each ring holds RING_SIZE records (default 64K).  Samples that
+//  arrive when the ring is full are counted as lost.
+//
+//  Usage: LD_PRELOAD this file and export PERIOD as the number of
+//  micro-seconds per interrupt, per thread with the per-thread timers.
+//
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "monitor.h"
+#include "sample-ring.h"
+
+#define DEFAULT_PERIOD  2000
+#define DEFAULT_RING_SIZE  (64 * 1024)
+
+#define MAX_THREADS  1024
+#define MIN_SAMPLES  30
+
+#define TIMER_PROCESS  0
+#define TIMER_THREAD   1
+#define TIMER_CPUTIME  2
+
+using namespace std;
+
+// Per-thread state, written only by its own thread until fini
+// process.
+//
+struct ThreadData {
+    int    tid;
+    ulong  stack_bottom;
+    long   count;
+    long   overrun;
+    ulong  handler_nsec;
+    bool   done;
+    SampleRing * ring;
+};
+
+struct ThreadSample {
+    int  tid;
+    SampleRecord  rec;
+};
+
+typedef vector <ThreadSample> SampleVec;
+
+// A thread claims its slot with numThreads and then fills it in, so
+// the fini code may see a slot that is not yet set, and skips it.
+static atomic <ThreadData *> threadList[MAX_THREADS];
+static atomic <int> numThreads;
+static atomic <long> noThreadSamples;
+
+static __thread ThreadData * myData = NULL;
+
+static ulong  time0;
+static ulong  ring_size;
+static long   period;
+static int    timer_mode;
+
+//----------------------------------------------------------------------
+
+// Get instruction pointer (ip) and stack pointer (sp) from user
+// context.
+//
+static void
+get_regs(ucontext_t *context, void **ip, void **sp)
+{
+    mcontext_t *mcontext = &(context->uc_mcontext);
+
+#if defined(__x86_64__)
+    *ip = (void *) mcontext->gregs[REG_RIP];
+    *sp = (void *) mcontext->gregs[REG_RSP];
+
+#elif defined(__powerpc__)
+    *ip = (void *) mcontext->gregs[PPC_REG_PC];
+    *sp = (void *) mcontext->gregs[PPC_REG_SP];
+
+#else
+    *ip = NULL;
+    *sp = NULL;
+
+#endif
+}
+
+// Returns: current time since the epoch in micro-seconds.
+//
+static ulong
+get_usec(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return 1000000 * now.tv_sec + now.tv_usec;
+}
+
+// Returns: monotonic time in nano-seconds, for handler cost.
+//
+static ulong
+get_nsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return 1000000000 * now.tv_sec + now.tv_nsec;
+}
+
+//----------------------------------------------------------------------
+
+// Make the current thread's data and ring and add it to the list.
+// Not called from the signal handler.
+//
+static ThreadData *
+newThreadData(int tid)
+{
+    ThreadData * td = new ThreadData;
+
+    td->tid = tid;
+    td->stack_bottom = (ulong) monitor_stack_bottom();
+    td->count = 0;
+    td->overrun = 0;
+    td->handler_nsec = 0;
+    td->done = false;
+    td->ring = SampleRing::create(ring_size);
+    if (td->ring == NULL) {
+	err(1, "mmap for sample ring failed");
+    }
+
+    int n = numThreads.fetch_add(1);
+    if (n >= MAX_THREADS) {
+	errx(1, "too many threads: %d", n + 1);
+    }
+    threadList[n].store(td, memory_order_release);
+
+    return td;
+}
+
+// Keep samples that are at least delta usec apart, plus the first and
+// last ones, the same as trace-ring.cpp.
+//
+static void
+reduceSamples(SampleVec & samples, ulong delta)
+{
+    if (samples.size() <= MIN_SAMPLES) {
+	return;
+    }
+
+    size_t keep = 0;
+    size_t last = samples.size() - 1;
+
+    for (size_t i = 1; i < last; i++) {
+	if (samples[i].rec.time >= samples[keep].rec.time + delta) {
+	    samples[++keep] = samples[i];
+	}
+    }
+    samples[++keep] = samples[last];
+    samples.resize(keep + 1);
+}
+
+// Safe in a signal handler: no malloc, no locks, and touches only the
+// current thread's data.
+//
+static void
+addSample(ucontext_t *context)
+{
+    ThreadData * td = myData;
+
+    if (td == NULL) {
+	// before init thread or after fini thread
+	noThreadSamples++;
+	return;
+    }
+
+    SampleRecord rec;
+
+    td->count++;
+    rec.count = td->count;
+    rec.time = get_usec() - time0;
+
+    void *sp;
+    get_regs(context, &rec.ip, &sp);
+    rec.depth = td->stack_bottom - (ulong) sp;
+
+    td->ring->push(rec);
+}
+
+static void
+my_handler(int sig, siginfo_t *info, void *context)
+{
+    ulong start = get_nsec();
+
+    addSample((ucontext_t *) context);
+
+    ThreadData * td = myData;
+    if (td != NULL) {
+	if (timer_mode != TIMER_PROCESS) {
+	    td->overrun += rt_thread_timer_overrun();
+	}
+	td->handler_nsec += get_nsec() - start;
+    }
+}
+
+// Make and start the current thread's timer, if per-thread.
+//
+static void
+startThreadTimer()
+{
+    if (timer_mode == TIMER_PROCESS) {
+	return;
+    }
+
+    int clock = (timer_mode == TIMER_CPUTIME) ? RT_CLOCK_CPUTIME
+	: RT_CLOCK_REALTIME;
+
+    if (rt_make_thread_timer(my_handler, clock) != 0) {
+	err(1, "thread timer create failed");
+    }
+    rt_start_thread_timer(period);
+}
+
+static void
+stopThreadTimer()
+{
+    if (timer_mode == TIMER_PROCESS) {
+	return;
+    }
+
+    rt_stop_thread_timer();
+    rt_delete_thread_timer();
+}
+
+//----------------------------------------------------------------------
+//  Libmonitor callbacks
+//----------------------------------------------------------------------
+
+extern "C" {
+
+void *
+monitor_init_process(int *argc, char **argv, void *data)
+{
+    char *str = getenv("PERIOD");
+    period = DEFAULT_PERIOD;
+
+    if (str != NULL && atol(str) > 0) {
+	period = atol(str);
+    }
+
+    const char *timer_name = getenv("TIMER");
+    if (timer_name == NULL) {
+	timer_name = "process";
+    }
+    if (strcmp(timer_name, "process") == 0) {
+	timer_mode = TIMER_PROCESS;
+    }
+    else if (strcmp(timer_name, "thread") == 0) {
+	timer_mode = TIMER_THREAD;
+    }
+    else if (strcmp(timer_name, "cputime") == 0) {
+	timer_mode = TIMER_CPUTIME;
+    }
+    else {
+	errx(1, "unknown TIMER: %s (process, thread or cputime)", timer_name);
+    }
+
+    ring_size = DEFAULT_RING_SIZE;
+    str = getenv("RING_SIZE");
+    if (str != NULL && atol(str) > 0) {
+	ring_size = atol(str);
+    }
+
+    cout << "===>  init process:  period = " << period << " usec"
+	 << "  timer = " << timer_name
+	 << "  <===\n\n";
+
+    numThreads = 0;
+    noThreadSamples = 0;
+    time0 = get_usec();
+    myData = newThreadData(0);
+
+    ucontext_t context;
+    if (getcontext(&context) != 0) {
+	err(1, "getcontext failed");
+    }
+    addSample(&context);
+
+    if (timer_mode == TIMER_PROCESS) {
+	if (rt_make_timer(my_handler) != 0) {
+	    err(1, "timer create failed");
+	}
+	rt_start_timer(period);
+    }
+    else {
+	startThreadTimer();
+    }
+
+    return NULL;
+}
+
+void
+monitor_fini_process(int how, void *data)
+{
+    if (timer_mode == TIMER_PROCESS) {
+	rt_stop_timer();
+    }
+    else {
+	stopThreadTimer();
+    }
+
+    ucontext_t context;
+    if (getcontext(&context) == 0) {
+	addSample(&context);
+    }
+    else {
+	warn("getcontext failed");
+    }
+
+    ulong elapsed = get_usec() - time0;
+    int num = numThreads.load();
+    long total = 0;
+    long lost = 0;
+    long overrun = 0;
+    ulong handler_nsec = 0;
+
+    for (int n = 0; n < num; n++) {
+	ThreadData * td = threadList[n].load(memory_order_acquire);
+	if (td == NULL) {
+	    continue;
+	}
+	total += td->count;
+	lost += td->ring->num_lost();
+	overrun += td->overrun;
+	handler_nsec += td->handler_nsec;
+    }
+
+    cout << "\n===>  fini process:  total samples = " << total
+	 << "  <===\n";
+
+    SampleVec samples;
+    ThreadSample ts;
+
+    samples.reserve(total);
+    for (int n = 0; n < num; n++) {
+	ThreadData * td = threadList[n].load(memory_order_acquire);
+	if (td == NULL) {
+	    continue;
+	}
+
+	cout << "thread: " << td->tid
+	     << "  samples: " << td->count
+	     << "  lost: " << td->ring->num_lost()
+	     << "  overrun: " << td->overrun
+	     << (td->done ? "" : "  (running)") << "\n";
+
+	ts.tid = td->tid;
+	while (td->ring->pop(ts.rec)) {
+	    samples.push_back(ts);
+	}
+    }
+
+    cout << "threads: " << num
+	 << "  samples: " << total
+	 << "  lost: " << lost
+	 << "  no thread: " << noThreadSamples.load()
+	 << "  samples/sec: " << (elapsed > 0 ? 1000000.0 * total / elapsed : 0.0)
+	 << "\n";
+
+    cout << "overrun: " << overrun
+	 << "  handler mean: " << (total > 0 ? handler_nsec / total : 0)
+	 << " nsec  handler total: " << handler_nsec / 1000 << " usec"
+	 << "  (" << (elapsed > 0 ? 0.1 * handler_nsec / elapsed : 0.0)
+	 << "% of wall time)\n";
+
+    stable_sort(samples.begin(), samples.end(),
+		[](const ThreadSample & a, const ThreadSample & b) {
+		    return a.rec.time < b.rec.time;
+		});
+
+    reduceSamples(samples, elapsed / MIN_SAMPLES);
+
+    cout << "kept samples = " << samples.size() << "\n";
+
+    for (auto it = samples.begin(); it != samples.end(); ++it) {
+	stringstream buf;
+	buf << "ip@" << it->rec.ip;
+
+	cout << "thread: " << it->tid
+	     << "  index: " << it->rec.count
+	     << "  time: " << it->rec.time
+	     << "  depth: " << it->rec.depth
+	     << "  " << buf.str() << "\n";
+    }
+
+    // the rings are not unmapped, other threads may still be running
+    // if main() returns without joining them
+}
+
+void *
+monitor_init_thread(int tid, void *data)
+{
+    myData = newThreadData(tid);
+    startThreadTimer();
+
+    return myData;
+}
+
+// Keep the thread's ring for fini process, but stop sampling into it
+// (the thread's stack is about to go away).
+//
+void
+monitor_fini_thread(void *data)
+{
+    ThreadData * td = (ThreadData *) data;
+
+    stopThreadTimer();
+    myData = NULL;
+    if (td != NULL) {
+	td->done = true;
+    }
+}
+
+}  // extern "C"
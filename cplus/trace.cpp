@@ -248,4 +248,17 @@ monitor_fini_process(int how, void *data)
     }
 }
 
+// Samples are process-wide, nothing to do per thread.
+//
+void *
+monitor_init_thread(int tid, void *data)
+{
+    return NULL;
+}
+
+void
+monitor_fini_thread(void *data)
+{
+}
+
 }  // extern "C"
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2019-2020, Rice University.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Rice University (RICE) nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  This software is provided by RICE and contributors "as is" and any
+ *  express or implied warranties, including, but not limited to, the
+ *  implied warranties of merchantability and fitness for a particular
+ *  purpose are disclaimed. In no event shall RICE or contributors be
+ *  liable for any direct, indirect, incidental, special, exemplary, or
+ *  consequential damages (including, but not limited to, procurement of
+ *  substitute goods or services; loss of use, data, or profits; or
+ *  business interruption) however caused and on any theory of liability,
+ *  whether in contract, strict liability, or tort (including negligence
+ *  or otherwise) arising in any way out of the use of this software, even
+ *  if advised of the possibility of such damage.
+ *
+ *  ----------------------------------------------------------------------
+ *
+ *  Used as part of phdr-bench.c.
+ *
+ *  A small synthetic library with some text, data and bss, so that it
+ *  has the usual PT_LOAD segments.  phdr-bench copies libphdr.so to
+ *  as many file names as it needs, each copy is a separate load
+ *  module to the dynamic loader.
+ */
+
+#define SUM_FUNC(num)				\
+double phdr_sum_ ## num (long len) {		\
+    double sum = 0.0;				\
+    long k;					\
+    for (k = 1; k <= len; k++) {		\
+	sum += (double) (k * num);		\
+    }						\
+    return sum;					\
+}
+
+long phdr_data[64] = { 1, 2, 3, 4 };
+long phdr_bss[1024];
+
+SUM_FUNC(0)
+SUM_FUNC(1)
+SUM_FUNC(2)
+SUM_FUNC(3)
@@ -0,0 +1,496 @@
+/*
+ *  Copyright (c) 2019-2020, Rice University.
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are
+ *  met:
+ *
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  * Neither the name of Rice University (RICE) nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  This software is provided by RICE and contributors "as is" and any
+ *  express or implied warranties, including, but not limited to, the
+ *  implied warranties of merchantability and fitness for a particular
+ *  purpose are disclaimed. In no event shall RICE or contributors be
+ *  liable for any direct, indirect, incidental, special, exemplary, or
+ *  consequential damages (including, but not limited to, procurement of
+ *  substitute goods or services; loss of use, data, or profits; or
+ *  business interruption) however caused and on any theory of liability,
+ *  whether in contract, strict liability, or tort (including negligence
+ *  or otherwise) arising in any way out of the use of this software, even
+ *  if advised of the possibility of such damage.
+ *
+ *  ----------------------------------------------------------------------
+ *
+ *  Test and benchmark for tracking the set of load modules with
+ *  dl_iterate_phdr().  The program dlopens N synthetic libraries (N
+ *  copies of libphdr.so in a temp directory), one at a time, and after
+ *  each dlopen, updates two module tables:
+ *
+ *   full  -- rescan every module: discard the table and rebuild it,
+ *            copying the name and computing the address range from
+ *            the PT_LOAD headers for each module.
+ *
+ *   incr  -- incremental tracker: return at the first callback if
+ *            dlpi_adds and dlpi_subs are unchanged, else skip the
+ *            modules already in the table and only add the new ones
+ *            at the end.  If any module was unloaded (dlpi_subs
+ *            changed) or the list doesn't match the table, fall back
+ *            to a full rebuild.
+ *
+ *  After each dlopen, the two tables must agree.  At the end, closes
+ *  every other library (exercising the dlpi_subs path) and checks
+ *  again.  Reports the mean scan cost per dlopen for both trackers,
+ *  overall and over windows of the number of modules loaded, plus an
+ *  unchanged rescan (no dlopen since the last scan) for the
+ *  incremental tracker.  Full rescans make the total cost quadratic
+ *  in the number of libraries, the incremental tracker only pays for
+ *  the walk inside libc plus the new modules.
+ *
+ *  The incremental tracker assumes that new modules are appended to
+ *  the end of the list, which is true for dlopen() in the base
+ *  namespace (not dlmopen()).  It checks the address of every known
+ *  module as it skips it, so a violation falls back to a rebuild.
+ *
+ *  Usage:  phdr-bench [-n num-libs] [-l libphdr.so] [-w windows]
+ *
+ *   -n  number of libraries to dlopen (default 500)
+ *   -l  path to the library to copy (default ./libphdr.so)
+ *   -w  number of rows in the cost table (default 10)
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <dlfcn.h>
+#include <link.h>
+
+#define DEFAULT_LIBS     500
+#define DEFAULT_WINDOWS  10
+#define DEFAULT_LIB      "./libphdr.so"
+
+typedef double (sum_func_t) (long);
+
+struct module {
+    char * name;
+    ElfW(Addr)  addr;
+    uintptr_t   start;
+    uintptr_t   end;
+};
+
+struct table {
+    struct module * mod;
+    int  num;
+    int  size;
+    unsigned long long  adds;
+    unsigned long long  subs;
+    long  rebuilds;
+};
+
+struct incr_state {
+    struct table * table;
+    int  index;
+    int  mismatch;
+};
+
+int num_libs = DEFAULT_LIBS;
+int num_windows = DEFAULT_WINDOWS;
+char * lib_path = DEFAULT_LIB;
+
+char tmp_dir[PATH_MAX];
+
+//----------------------------------------------------------------------
+
+long
+time_nsec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+//----------------------------------------------------------------------
+
+/*
+ * Add one module to the end of the table: copy the name and compute
+ * the address range from the PT_LOAD headers.  This is the per-module
+ * work that the incremental tracker saves.
+ */
+void
+table_add(struct table * table, struct dl_phdr_info * info)
+{
+    struct module * mod;
+    uintptr_t start = UINTPTR_MAX, end = 0;
+    int j;
+
+    if (table->num >= table->size) {
+	table->size = (table->size == 0) ? 64 : 2 * table->size;
+	table->mod = realloc(table->mod, table->size * sizeof(struct module));
+	if (table->mod == NULL) {
+	    err(1, "realloc failed");
+	}
+    }
+
+    for (j = 0; j < info->dlpi_phnum; j++) {
+	const ElfW(Phdr) * ph = &info->dlpi_phdr[j];
+
+	if (ph->p_type == PT_LOAD) {
+	    uintptr_t lo = info->dlpi_addr + ph->p_vaddr;
+	    uintptr_t hi = lo + ph->p_memsz;
+
+	    if (lo < start) { start = lo; }
+	    if (hi > end) { end = hi; }
+	}
+    }
+
+    mod = &table->mod[table->num];
+    mod->name = strdup(info->dlpi_name);
+    mod->addr = info->dlpi_addr;
+    mod->start = start;
+    mod->end = end;
+    table->num++;
+}
+
+void
+table_clear(struct table * table)
+{
+    int k;
+
+    for (k = 0; k < table->num; k++) {
+	free(table->mod[k].name);
+    }
+    table->num = 0;
+}
+
+//----------------------------------------------------------------------
+
+int
+full_callback(struct dl_phdr_info * info, size_t size, void * data)
+{
+    struct table * table = data;
+
+    if (table->num == 0) {
+	table->adds = info->dlpi_adds;
+	table->subs = info->dlpi_subs;
+    }
+    table_add(table, info);
+
+    return 0;
+}
+
+/*
+ * Rebuild the table from scratch.
+ */
+void
+full_scan(struct table * table)
+{
+    table_clear(table);
+    dl_iterate_phdr(full_callback, table);
+    table->rebuilds++;
+}
+
+/*
+ * Skip the modules already in the table (checking their address),
+ * add the rest.  Stop at the first callback if nothing changed.
+ */
+int
+incr_callback(struct dl_phdr_info * info, size_t size, void * data)
+{
+    struct incr_state * state = data;
+    struct table * table = state->table;
+    int index = state->index++;
+
+    if (index == 0) {
+	if (info->dlpi_adds == table->adds && info->dlpi_subs == table->subs) {
+	    return 1;
+	}
+	if (info->dlpi_subs != table->subs) {
+	    state->mismatch = 1;
+	    return 1;
+	}
+	table->adds = info->dlpi_adds;
+    }
+
+    if (index < table->num) {
+	if (table->mod[index].addr != info->dlpi_addr) {
+	    state->mismatch = 1;
+	    return 1;
+	}
+	return 0;
+    }
+
+    table_add(table, info);
+
+    return 0;
+}
+
+void
+incr_scan(struct table * table)
+{
+    struct incr_state state = { table, 0, 0 };
+
+    if (table->num > 0) {
+	dl_iterate_phdr(incr_callback, &state);
+	if (! state.mismatch) {
+	    return;
+	}
+    }
+    full_scan(table);
+}
+
+//----------------------------------------------------------------------
+
+void
+check_tables(struct table * full, struct table * incr, const char * when)
+{
+    int k;
+
+    if (full->num != incr->num) {
+	errx(1, "%s: full has %d modules, incr has %d",
+	     when, full->num, incr->num);
+    }
+
+    for (k = 0; k < full->num; k++) {
+	struct module * a = &full->mod[k];
+	struct module * b = &incr->mod[k];
+
+	if (a->addr != b->addr || a->start != b->start || a->end != b->end
+	    || strcmp(a->name, b->name) != 0) {
+	    errx(1, "%s: module %d differs: %s (%p) vs %s (%p)",
+		 when, k, a->name, (void *) a->start, b->name, (void *) b->start);
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+
+/*
+ * Copy the library to tmp_dir/libphdr-<num>.so, each copy has its own
+ * inode, so the loader treats them as separate modules.
+ */
+char *
+copy_lib(const char * buf, ssize_t len, int num)
+{
+    char name[PATH_MAX + 32];
+    int fd;
+
+    snprintf(name, sizeof(name), "%s/libphdr-%d.so", tmp_dir, num);
+
+    fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    if (fd < 0) {
+	err(1, "unable to create: %s", name);
+    }
+    if (write(fd, buf, len) != len) {
+	err(1, "write failed: %s", name);
+    }
+    close(fd);
+
+    return strdup(name);
+}
+
+char **
+mk_libs(void)
+{
+    struct stat st;
+    char ** names;
+    char * buf;
+    int fd, k;
+
+    fd = open(lib_path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+	err(1, "unable to open: %s", lib_path);
+    }
+    buf = malloc(st.st_size);
+    if (buf == NULL || read(fd, buf, st.st_size) != st.st_size) {
+	err(1, "unable to read: %s", lib_path);
+    }
+    close(fd);
+
+    const char * tmp = getenv("TMPDIR");
+    snprintf(tmp_dir, sizeof(tmp_dir), "%s/phdr-bench.XXXXXX",
+	     (tmp != NULL) ? tmp : "/tmp");
+    if (mkdtemp(tmp_dir) == NULL) {
+	err(1, "mkdtemp failed");
+    }
+
+    names = malloc(num_libs * sizeof(char *));
+    for (k = 0; k < num_libs; k++) {
+	names[k] = copy_lib(buf, st.st_size, k);
+    }
+    free(buf);
+
+    return names;
+}
+
+void
+rm_libs(char ** names)
+{
+    int k;
+
+    for (k = 0; k < num_libs; k++) {
+	unlink(names[k]);
+    }
+    rmdir(tmp_dir);
+}
+
+//----------------------------------------------------------------------
+
+void
+parse_args(int argc, char **argv)
+{
+    int ch;
+
+    while ((ch = getopt(argc, argv, "n:l:w:")) != -1) {
+	switch (ch) {
+	case 'n':
+	    num_libs = atoi(optarg);
+	    break;
+	case 'l':
+	    lib_path = optarg;
+	    break;
+	case 'w':
+	    num_windows = atoi(optarg);
+	    break;
+	default:
+	    errx(1, "usage: phdr-bench [-n num-libs] [-l libphdr.so] [-w windows]");
+	}
+    }
+
+    if (num_libs < 1) {
+	errx(1, "bad number of libraries: %d", num_libs);
+    }
+    if (num_windows < 1 || num_windows > num_libs) {
+	num_windows = (num_libs < DEFAULT_WINDOWS) ? num_libs : DEFAULT_WINDOWS;
+    }
+}
+
+//----------------------------------------------------------------------
+
+int
+main(int argc, char **argv)
+{
+    struct table full = { NULL, 0, 0, 0, 0, 0 };
+    struct table incr = { NULL, 0, 0, 0, 0, 0 };
+    char ** names;
+    void ** handle;
+    double sum = 0.0;
+    long t0, t1;
+    long open_tot = 0, full_tot = 0, incr_tot = 0, same_tot = 0;
+    long open_win = 0, full_win = 0, incr_win = 0, same_win = 0;
+    int base_mods, win_start, k;
+
+    parse_args(argc, argv);
+
+    printf("phdr-bench: full vs incremental dl_iterate_phdr scan\n"
+	   "libraries: %d  (copies of %s)\n\n", num_libs, lib_path);
+
+    names = mk_libs();
+    handle = malloc(num_libs * sizeof(void *));
+
+    full_scan(&full);
+    incr_scan(&incr);
+    base_mods = full.num;
+    full.rebuilds = 0;
+    incr.rebuilds = 0;
+
+    printf("%10s  %12s  %12s  %12s  %12s  %8s\n", "modules",
+	   "dlopen (us)", "full (us)", "incr (us)", "same (us)", "speedup");
+
+    win_start = 0;
+    for (k = 0; k < num_libs; k++) {
+	t0 = time_nsec();
+	handle[k] = dlopen(names[k], RTLD_NOW);
+	t1 = time_nsec();
+	if (handle[k] == NULL) {
+	    errx(1, "dlopen failed: %s", dlerror());
+	}
+	open_win += t1 - t0;
+
+	sum_func_t * func = dlsym(handle[k], "phdr_sum_1");
+	if (func != NULL) {
+	    sum += (* func) (10);
+	}
+
+	t0 = time_nsec();
+	full_scan(&full);
+	t1 = time_nsec();
+	full_win += t1 - t0;
+
+	t0 = time_nsec();
+	incr_scan(&incr);
+	t1 = time_nsec();
+	incr_win += t1 - t0;
+
+	// rescan with no change
+	t0 = time_nsec();
+	incr_scan(&incr);
+	t1 = time_nsec();
+	same_win += t1 - t0;
+
+	check_tables(&full, &incr, "dlopen");
+
+	if ((k + 1) % (num_libs / num_windows) == 0 || k == num_libs - 1) {
+	    int n = k + 1 - win_start;
+
+	    printf("%10d  %12.2f  %12.2f  %12.2f  %12.2f  %7.1fx\n",
+		   full.num, open_win / 1000.0 / n, full_win / 1000.0 / n,
+		   incr_win / 1000.0 / n, same_win / 1000.0 / n,
+		   (incr_win > 0) ? (double) full_win / incr_win : 0.0);
+
+	    open_tot += open_win;  full_tot += full_win;
+	    incr_tot += incr_win;  same_tot += same_win;
+	    open_win = 0;  full_win = 0;  incr_win = 0;  same_win = 0;
+	    win_start = k + 1;
+	}
+    }
+
+    printf("\nper dlopen (%d + %d modules):\n"
+	   "  dlopen:       %10.2f us\n"
+	   "  full rescan:  %10.2f us\n"
+	   "  incremental:  %10.2f us  (%.1fx, %ld rebuilds)\n"
+	   "  unchanged:    %10.2f us\n"
+	   "total scan time:  full %.3f sec,  incremental %.3f sec\n",
+	   base_mods, num_libs,
+	   open_tot / 1000.0 / num_libs,
+	   full_tot / 1000.0 / num_libs,
+	   incr_tot / 1000.0 / num_libs,
+	   (incr_tot > 0) ? (double) full_tot / incr_tot : 0.0,
+	   incr.rebuilds,
+	   same_tot / 1000.0 / num_libs,
+	   full_tot / 1e9, incr_tot / 1e9);
+
+    // close every other library, the incremental tracker must notice
+    // dlpi_subs and rebuild
+    for (k = 0; k < num_libs; k += 2) {
+	dlclose(handle[k]);
+    }
+    full_scan(&full);
+    incr_scan(&incr);
+    check_tables(&full, &incr, "dlclose");
+    printf("\nafter dlclose:  %d modules, tables agree\n", full.num);
+
+    rm_libs(names);
+    printf("done  (sum = %g)\n", sum);
+
+    return 0;
+}
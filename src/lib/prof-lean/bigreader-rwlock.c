@@ -0,0 +1,189 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: bigreader-rwlock.c
+//
+// purpose:
+//   distributed-reader rwlock. see bigreader-rwlock.h.
+//
+//   a reader publishes itself in its slot and then checks the writer
+//   flag; a writer sets the flag and then checks every slot. both steps
+//   are sequentially consistent, so at least one side sees the other.
+//   if a reader sees the flag, it withdraws and waits for the writer to
+//   finish. so writers are preferred, and a stream of readers cannot
+//   starve a dlopen.
+//******************************************************************************
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "bigreader-rwlock.h"
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static atomic_int next_slot;
+
+static __thread int my_slot = -1;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static inline bigreader_slot_t *
+bigreader_slot
+(
+ bigreader_rwlock_t *l
+)
+{
+  if (my_slot < 0) {
+    my_slot = atomic_fetch_add(&next_slot, 1) % BIGREADER_SLOTS;
+  }
+  return &l->slot[my_slot];
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+void
+bigreader_rwlock_init
+(
+ bigreader_rwlock_t *l
+)
+{
+  int i;
+
+  atomic_init(&l->writer, false);
+  mcs_init(&l->wlock);
+  for (i = 0; i < BIGREADER_SLOTS; i++) {
+    atomic_init(&l->slot[i].readers, 0);
+  }
+}
+
+
+void
+bigreader_rwlock_read_lock
+(
+ bigreader_rwlock_t *l
+)
+{
+  bigreader_slot_t *s = bigreader_slot(l);
+
+  for (;;) {
+    atomic_fetch_add(&s->readers, 1);
+    if (!atomic_load(&l->writer)) return;
+
+    // a writer is active or waiting: back out and let it go first
+    atomic_fetch_sub(&s->readers, 1);
+    while (atomic_load_explicit(&l->writer, memory_order_relaxed));
+  }
+}
+
+
+bool
+bigreader_rwlock_read_trylock
+(
+ bigreader_rwlock_t *l
+)
+{
+  bigreader_slot_t *s = bigreader_slot(l);
+
+  atomic_fetch_add(&s->readers, 1);
+  if (!atomic_load(&l->writer)) return true;
+
+  atomic_fetch_sub(&s->readers, 1);
+  return false;
+}
+
+
+void
+bigreader_rwlock_read_unlock
+(
+ bigreader_rwlock_t *l
+)
+{
+  atomic_fetch_sub_explicit(&l->slot[my_slot].readers, 1,
+			    memory_order_release);
+}
+
+
+void
+bigreader_rwlock_write_lock
+(
+ bigreader_rwlock_t *l,
+ bigreader_rwlock_node_t *me
+)
+{
+  int i;
+
+  mcs_lock(&l->wlock, me);
+  atomic_store(&l->writer, true);
+
+  for (i = 0; i < BIGREADER_SLOTS; i++) {
+    while (atomic_load_explicit(&l->slot[i].readers, memory_order_acquire));
+  }
+}
+
+
+void
+bigreader_rwlock_write_unlock
+(
+ bigreader_rwlock_t *l,
+ bigreader_rwlock_node_t *me
+)
+{
+  atomic_store_explicit(&l->writer, false, memory_order_release);
+  mcs_unlock(&l->wlock, me);
+}
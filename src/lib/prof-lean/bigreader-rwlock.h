@@ -0,0 +1,173 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: bigreader-rwlock.h
+//
+// purpose:
+//   a distributed-reader ("big reader") rwlock for read paths taken on
+//   every sample. each reader increments a counter in its own
+//   cache-line-sized slot rather than one shared counter, so readers on
+//   different threads do not contend. a writer raises a flag, then
+//   waits until every slot is empty. this makes writes expensive and
+//   reads cheap, which suits tables updated only on events such as
+//   dlopen.
+//
+//   a thread is assigned a slot on its first read. with more than
+//   BIGREADER_SLOTS threads, several threads share a slot; that is
+//   still correct, only slower.
+//
+//   the interface matches pfq_rwlock: readers take no queue node, and
+//   writers queue on an MCS lock using a caller-supplied node.
+//
+//   reads must not nest on one thread with bigreader_rwlock_read_lock.
+//   the outer read keeps the thread's slot raised, so a waiting writer
+//   never sees it drain, while the inner read backs out and waits for
+//   that writer: a deadlock. signal handlers, and any other code that
+//   may run inside a read on its own thread, must use
+//   bigreader_rwlock_read_trylock and give up when it fails. likewise,
+//   a writer must not interrupt a reader on its own thread, because it
+//   would wait for that reader forever.
+//******************************************************************************
+
+#ifndef __bigreader_rwlock_h__
+#define __bigreader_rwlock_h__
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "mcs-lock.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define BIGREADER_SLOTS  64
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef mcs_node_t bigreader_rwlock_node_t;
+
+typedef struct {
+  atomic_long readers;
+} __attribute__((aligned(64))) bigreader_slot_t;
+
+typedef struct {
+  atomic_bool writer;
+  mcs_lock_t wlock;
+  bigreader_slot_t slot[BIGREADER_SLOTS];
+} bigreader_rwlock_t;
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+void
+bigreader_rwlock_init
+(
+ bigreader_rwlock_t *l
+);
+
+
+// wait while a writer is active or waiting. must not be called
+// inside a read on the same thread, see above.
+void
+bigreader_rwlock_read_lock
+(
+ bigreader_rwlock_t *l
+);
+
+
+// take the read side only if no writer is active or waiting; for
+// signal handlers and nested readers, which must drop a sample rather
+// than wait
+bool
+bigreader_rwlock_read_trylock
+(
+ bigreader_rwlock_t *l
+);
+
+
+void
+bigreader_rwlock_read_unlock
+(
+ bigreader_rwlock_t *l
+);
+
+
+void
+bigreader_rwlock_write_lock
+(
+ bigreader_rwlock_t *l,
+ bigreader_rwlock_node_t *me
+);
+
+
+void
+bigreader_rwlock_write_unlock
+(
+ bigreader_rwlock_t *l,
+ bigreader_rwlock_node_t *me
+);
+
+#endif
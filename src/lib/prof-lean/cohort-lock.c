@@ -0,0 +1,224 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: cohort-lock.c
+//
+// purpose:
+//   cohort lock over per-socket MCS queues. see cohort-lock.h.
+//
+//   the socket of each cpu is read from sysfs once. a thread that
+//   migrates while it holds the lock still releases the socket lock it
+//   acquired, since the socket is recorded in its queue node.
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "cohort-lock.h"
+#include "cpu-socket.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define MAX_CPUS  4096
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static signed char cpu_socket[MAX_CPUS];
+static volatile int cpu_socket_ready;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static void
+cpu_socket_init
+(
+ void
+)
+{
+  int cpu;
+
+  for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+    cpu_socket[cpu] = cpu_socket_read(cpu) % COHORT_MAX_SOCKETS;
+  }
+  cpu_socket_ready = 1;
+}
+
+
+// true if another thread has queued behind me on my socket's lock
+static bool
+cohort_has_waiter
+(
+ cohort_socket_t *s,
+ cohort_node_t *me
+)
+{
+  return atomic_load(&me->local.next) != mcs_nil ||
+    atomic_load(&s->lock.tail) != &me->local;
+}
+
+
+
+//******************************************************************************
+// interface functions
+//******************************************************************************
+
+void
+cohort_init
+(
+ cohort_lock_t *l
+)
+{
+  int i;
+
+  if (!cpu_socket_ready) cpu_socket_init();
+
+  mcs_init(&l->global);
+  for (i = 0; i < COHORT_MAX_SOCKETS; i++) {
+    mcs_init(&l->socket[i].lock);
+    l->socket[i].global_held = false;
+    l->socket[i].passes = 0;
+  }
+}
+
+
+int
+cohort_current_socket
+(
+ void
+)
+{
+  int cpu = sched_getcpu();
+  return (cpu >= 0 && cpu < MAX_CPUS) ? cpu_socket[cpu] : 0;
+}
+
+
+void
+cohort_lock
+(
+ cohort_lock_t *l,
+ cohort_node_t *me
+)
+{
+  me->socket = cohort_current_socket();
+  cohort_socket_t *s = &l->socket[me->socket];
+
+  mcs_lock(&s->lock, &me->local);
+
+  // a predecessor on this socket may have passed us the global lock
+  if (!s->global_held) {
+    mcs_lock(&l->global, &s->global_node);
+    s->global_held = true;
+  }
+}
+
+
+bool
+cohort_trylock
+(
+ cohort_lock_t *l,
+ cohort_node_t *me
+)
+{
+  me->socket = cohort_current_socket();
+  cohort_socket_t *s = &l->socket[me->socket];
+
+  if (!mcs_trylock(&s->lock, &me->local)) return false;
+
+  // the socket lock was free, so no global lock was passed to us
+  if (!mcs_trylock(&l->global, &s->global_node)) {
+    mcs_unlock(&s->lock, &me->local);
+    return false;
+  }
+  s->global_held = true;
+
+  return true;
+}
+
+
+void
+cohort_unlock
+(
+ cohort_lock_t *l,
+ cohort_node_t *me
+)
+{
+  cohort_socket_t *s = &l->socket[me->socket];
+
+  if (s->passes < COHORT_MAX_PASSES && cohort_has_waiter(s, me)) {
+    // keep the global lock in this cohort
+    s->passes++;
+  } else {
+    s->passes = 0;
+    s->global_held = false;
+    mcs_unlock(&l->global, &s->global_node);
+  }
+
+  mcs_unlock(&s->lock, &me->local);
+}
@@ -0,0 +1,155 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: cohort-lock.h
+//
+// purpose:
+//   a NUMA-aware cohort lock built from one MCS queue per socket and a
+//   global MCS lock. a thread queues on its own socket's lock; the
+//   first thread of a cohort takes the global lock, and on release the
+//   lock is passed to the next waiter on the same socket, with the
+//   global lock still held, up to COHORT_MAX_PASSES times in a row.
+//   the lock therefore changes sockets only once per batch rather than
+//   at nearly every handoff.
+//
+//   acquire and release have the shape of mcs_lock and mcs_unlock: the
+//   caller supplies a queue node that lives until the matching unlock.
+//******************************************************************************
+
+#ifndef __cohort_lock_h__
+#define __cohort_lock_h__
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdbool.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "mcs-lock.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define COHORT_MAX_SOCKETS  8
+#define COHORT_MAX_PASSES   64
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  mcs_lock_t lock;
+  mcs_node_t global_node;
+  volatile bool global_held;
+  int passes;
+} __attribute__((aligned(128))) cohort_socket_t;
+
+typedef struct {
+  mcs_lock_t global;
+  cohort_socket_t socket[COHORT_MAX_SOCKETS];
+} cohort_lock_t;
+
+typedef struct {
+  mcs_node_t local;
+  int socket;
+} cohort_node_t;
+
+
+
+//******************************************************************************
+// interface functions
+//******************************************************************************
+
+void
+cohort_init
+(
+ cohort_lock_t *l
+);
+
+
+void
+cohort_lock
+(
+ cohort_lock_t *l,
+ cohort_node_t *me
+);
+
+
+bool
+cohort_trylock
+(
+ cohort_lock_t *l,
+ cohort_node_t *me
+);
+
+
+void
+cohort_unlock
+(
+ cohort_lock_t *l,
+ cohort_node_t *me
+);
+
+
+// socket of the calling thread's current cpu, as used by cohort_lock
+int
+cohort_current_socket
+(
+ void
+);
+
+#endif
@@ -0,0 +1,90 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: cpu-socket.c
+//
+// purpose:
+//   read the socket of a cpu from sysfs. see cpu-socket.h.
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdio.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "cpu-socket.h"
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+int
+cpu_socket_read
+(
+ int cpu
+)
+{
+  char path[200];
+  int socket = 0;
+
+  sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+	  cpu);
+  FILE *f = fopen(path, "r");
+  if (f != NULL) {
+    if (fscanf(f, "%d", &socket) != 1 || socket < 0) socket = 0;
+    fclose(f);
+  }
+  return socket;
+}
@@ -0,0 +1,332 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: cskiplist-batch.c
+//
+// purpose:
+//   sorted-run insertion for cskiplist. see cskiplist-batch.h.
+//
+//   the predecessors found for one value are the starting points of the
+//   search for the next, and the node just inserted becomes the
+//   predecessor at each of its levels. like cskl_insert, the batch holds
+//   the list's lock in read mode, so nodes are not unlinked underneath
+//   it; if a validation nevertheless finds a marked predecessor, the
+//   search restarts from the left sentinel.
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <alloca.h>
+#include <stdint.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "cskiplist-batch.h"
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static __thread uint64_t batch_seed;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+// geometric height in [1, max_height] with p = 1/2, as in cskl_insert
+static int
+random_height
+(
+ int max_height
+)
+{
+  if (batch_seed == 0) {
+    batch_seed = (uintptr_t) &batch_seed | 1;
+  }
+
+  uint64_t x = batch_seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  batch_seed = x;
+
+  int height = 1;
+  while (height < max_height && (x & 1)) {
+    height++;
+    x >>= 1;
+  }
+  return height;
+}
+
+
+static csklnode_t *
+node_new
+(
+ void *value,
+ int height,
+ mem_alloc m_alloc
+)
+{
+  csklnode_t *node = 
+    (csklnode_t *) m_alloc(sizeof(csklnode_t) + height * sizeof(csklnode_t *));
+
+  node->val = value;
+  node->height = height;
+  node->fully_linked = false;
+  node->marked = false;
+  mcs_init(&node->lock);
+
+  return node;
+}
+
+
+static void
+reset_preds
+(
+ cskiplist_t *cskl,
+ csklnode_t **preds
+)
+{
+  int l;
+  for (l = 0; l < cskl->max_height; l++) {
+    preds[l] = cskl->left_sentinel;
+  }
+}
+
+
+// starting from preds[], find the predecessor and successor of value
+// at every level. returns the highest level at which a node equal to
+// value was found, or -1.
+static int
+batch_find
+(
+ cskiplist_t *cskl,
+ void *value,
+ csklnode_t **preds,
+ csklnode_t **succs
+)
+{
+  csklnode_t *left = cskl->left_sentinel;
+  csklnode_t *right = cskl->right_sentinel;
+  csklnode_t *above = left;
+  int found = -1;
+  int l;
+
+  for (l = cskl->max_height - 1; l >= 0; l--) {
+    // resume from the old finger or the predecessor one level up,
+    // whichever is further along
+    csklnode_t *pred = preds[l];
+    if (above != left &&
+	(pred == left || cskl->compare(above->val, pred->val) > 0)) {
+      pred = above;
+    }
+
+    csklnode_t *cur = pred->nexts[l];
+    while (cur != right && cskl->compare(cur->val, value) < 0) {
+      pred = cur;
+      cur = pred->nexts[l];
+    }
+
+    if (found == -1 && cur != right && cskl->compare(cur->val, value) == 0) {
+      found = l;
+    }
+
+    preds[l] = pred;
+    succs[l] = cur;
+    above = pred;
+  }
+
+  return found;
+}
+
+
+static void
+unlock_preds
+(
+ csklnode_t **preds,
+ mcs_node_t *me,
+ int highest_locked
+)
+{
+  csklnode_t *prev = NULL;
+  int l;
+
+  for (l = 0; l <= highest_locked; l++) {
+    if (preds[l] != prev) {
+      mcs_unlock(&preds[l]->lock, &me[l]);
+      prev = preds[l];
+    }
+  }
+}
+
+
+// link value into the list at its predecessors, or report the node of
+// an equal value already present. returns true if a node was inserted.
+static bool
+batch_insert_one
+(
+ cskiplist_t *cskl,
+ void *value,
+ csklnode_t **preds,
+ csklnode_t **succs,
+ mcs_node_t *me,
+ csklnode_t **result,
+ mem_alloc m_alloc
+)
+{
+  int height = random_height(cskl->max_height);
+
+  for (;;) {
+    int found = batch_find(cskl, value, preds, succs);
+
+    if (found != -1) {
+      csklnode_t *node = succs[found];
+      if (!node->marked) {
+	while (!node->fully_linked);
+	*result = node;
+	return false;
+      }
+      // an equal node is being deleted; look again
+      reset_preds(cskl, preds);
+      continue;
+    }
+
+    // lock the distinct predecessors bottom up and validate
+    csklnode_t *prev = NULL;
+    bool valid = true;
+    bool stale = false;
+    int highest_locked = -1;
+    int l;
+
+    for (l = 0; valid && l < height; l++) {
+      csklnode_t *pred = preds[l];
+      if (pred != prev) {
+	mcs_lock(&pred->lock, &me[l]);
+	highest_locked = l;
+	prev = pred;
+      }
+      stale = pred->marked;
+      valid = !stale && !succs[l]->marked && pred->nexts[l] == succs[l];
+    }
+
+    if (!valid) {
+      unlock_preds(preds, me, highest_locked);
+      if (stale) reset_preds(cskl, preds);
+      continue;
+    }
+
+    csklnode_t *node = node_new(value, height, m_alloc);
+    for (l = 0; l < height; l++) {
+      node->nexts[l] = succs[l];
+    }
+    __sync_synchronize();
+
+    for (l = 0; l < height; l++) {
+      preds[l]->nexts[l] = node;
+    }
+    node->fully_linked = true;
+
+    unlock_preds(preds, me, highest_locked);
+
+    // the new node precedes the next value of the run at its levels
+    for (l = 0; l < height; l++) {
+      preds[l] = node;
+    }
+
+    *result = node;
+    return true;
+  }
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+int
+cskl_insert_batch
+(
+ cskiplist_t *cskl,
+ void **values,
+ int n,
+ csklnode_t **nodes,
+ mem_alloc m_alloc
+)
+{
+  int max_height = cskl->max_height;
+  csklnode_t **preds = (csklnode_t **) alloca(max_height * sizeof(csklnode_t *));
+  csklnode_t **succs = (csklnode_t **) alloca(max_height * sizeof(csklnode_t *));
+  mcs_node_t *me = (mcs_node_t *) alloca(max_height * sizeof(mcs_node_t));
+  int inserted = 0;
+  int i;
+
+  reset_preds(cskl, preds);
+
+  pfq_rwlock_read_lock(&cskl->lock);
+
+  for (i = 0; i < n; i++) {
+    csklnode_t *node;
+    if (batch_insert_one(cskl, values[i], preds, succs, me, &node, m_alloc)) {
+      inserted++;
+    }
+    if (nodes) nodes[i] = node;
+  }
+
+  pfq_rwlock_read_unlock(&cskl->lock);
+
+  return inserted;
+}
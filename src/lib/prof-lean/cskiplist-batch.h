@@ -0,0 +1,91 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: cskiplist-batch.h
+//
+// purpose:
+//   batch insertion for cskiplist. when a load module is mapped, all of
+//   its segments are added at once as a sorted run; inserting them one
+//   at a time with cskl_insert repeats the search from the top of the
+//   list for every segment. cskl_insert_batch finds each insertion point
+//   by continuing from the predecessors of the previous one, so the
+//   whole run costs about one traversal.
+//
+//   each node is linked with the same lock-validate-link protocol as
+//   cskl_insert, so concurrent lookups and inserts proceed as usual.
+//******************************************************************************
+
+#ifndef __cskiplist_batch_h__
+#define __cskiplist_batch_h__
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "cskiplist.h"
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+// insert values[0 .. n-1], which must be sorted in increasing order by
+// the list's compare function. a value equal to one already in the list
+// is not inserted. if nodes is non-NULL, nodes[i] receives the list
+// node holding values[i], or the node of the equal value already
+// present. returns the number of values inserted.
+int
+cskl_insert_batch
+(
+ cskiplist_t *cskl,
+ void **values,
+ int n,
+ csklnode_t **nodes,
+ mem_alloc m_alloc
+);
+
+#endif
@@ -0,0 +1,517 @@
+//******************************************************************************
+// file: cskiplist-bench.c
+//
+// purpose:
+//   concurrent throughput and latency benchmark for cskiplist used as an
+//   address -> interval map, the way hpcrun uses it to find the load
+//   module for a sample address. each thread runs a random mix of
+//   in-range lookups, inserts and deletes over a fixed space of
+//   interval slots and records the latency of every operation.
+//
+//   -m index runs the identical workload against the flat
+//   interval-index instead, for comparison.
+//
+// usage:
+//   cskiplist-bench [-m cskiplist|index] [-t threads] [-s seconds]
+//                   [-r read%] [-i insert%] [-d delete%] [-n slots]
+//                   [-k uniform|zipf] [-z theta] [-p prefill%]
+//                   [-h max_height]
+//******************************************************************************
+
+//******************************************************************************
+// global include files
+//******************************************************************************
+
+#include <alloca.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//******************************************************************************
+// local include files
+//******************************************************************************
+
+#include <cskiplist.h>
+#include <interval-index.h>
+
+#include "interval.h"
+#include "latency.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define MAX_HEIGHT      4
+
+#define SLOT_BASE       0x10000000L
+#define SLOT_STRIDE     4096
+#define SLOT_LEN        2048
+
+#define OP_LOOKUP       0
+#define OP_INSERT       1
+#define OP_DELETE       2
+#define NUM_OPS         3
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef enum {
+  MAP_CSKIPLIST,
+  MAP_INDEX
+} map_kind_t;
+
+typedef enum {
+  KEYS_UNIFORM,
+  KEYS_ZIPF
+} key_dist_t;
+
+typedef struct {
+  int id;
+  uint64_t rng;
+  long ops[NUM_OPS];
+  long hits;
+  latency_hist_t lat[NUM_OPS];
+} bench_thread_t;
+
+typedef struct graveyard_s {
+  struct graveyard_s *next;
+} graveyard_t;
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static const char *op_name[NUM_OPS] = { "lookup", "insert", "delete" };
+
+static volatile int finished;
+static pthread_barrier_t barrier;
+
+static map_kind_t map_kind = MAP_CSKIPLIST;
+static cskiplist_t *cs;
+static interval_index_t *idx;
+
+static int num_slots = 4096;
+static int read_pct = 90;
+static int insert_pct = 5;
+static int delete_pct = 5;
+static key_dist_t key_dist = KEYS_UNIFORM;
+static double zipf_theta = 0.99;
+static double *zipf_cdf;
+
+// deleted nodes may still be visible to concurrent readers, so they
+// are parked here and only freed once all threads have joined.
+static graveyard_t * volatile graveyard;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static uint64_t
+rng_next
+(
+ uint64_t *state
+)
+{
+  uint64_t x = *state;
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  *state = x;
+  return x * 0x2545F4914F6CDD1DUL;
+}
+
+
+static double
+rng_unit
+(
+ uint64_t *state
+)
+{
+  return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+static void
+zipf_init
+(
+ void
+)
+{
+  double sum = 0.0;
+  int i;
+
+  zipf_cdf = (double *) malloc(num_slots * sizeof(double));
+  for (i = 0; i < num_slots; i++) {
+    sum += 1.0 / pow(i + 1, zipf_theta);
+    zipf_cdf[i] = sum;
+  }
+  for (i = 0; i < num_slots; i++) {
+    zipf_cdf[i] /= sum;
+  }
+}
+
+
+static int
+next_slot
+(
+ uint64_t *rng
+)
+{
+  if (key_dist == KEYS_UNIFORM) {
+    return rng_next(rng) % num_slots;
+  }
+
+  double u = rng_unit(rng);
+  int lo = 0, hi = num_slots - 1;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (zipf_cdf[mid] < u) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+
+static long
+slot_start
+(
+ int slot
+)
+{
+  return SLOT_BASE + (long) slot * SLOT_STRIDE;
+}
+
+
+static void
+graveyard_free
+(
+ void *node
+)
+{
+  graveyard_t *g = (graveyard_t *) node;
+  graveyard_t *head;
+  do {
+    head = graveyard;
+    g->next = head;
+  } while (!__sync_bool_compare_and_swap(&graveyard, head, g));
+}
+
+
+static void
+graveyard_empty
+(
+ void
+)
+{
+  while (graveyard) {
+    graveyard_t *g = graveyard;
+    graveyard = g->next;
+    free(g);
+  }
+}
+
+
+static void
+insert_slot
+(
+ int slot
+)
+{
+  long lo = slot_start(slot);
+  interval_t *e = interval_new(lo, lo + SLOT_LEN);
+
+  if (map_kind == MAP_INDEX) {
+    if (!interval_index_insert(idx, e->start, e->end, e)) free(e);
+    return;
+  }
+
+  csklnode_t *node = cskl_insert(cs, e, malloc);
+
+  // the slot was already present
+  if (node->val != e) free(e);
+}
+
+
+static void
+delete_slot
+(
+ int slot
+)
+{
+  interval_t key;
+  key.start = key.end = (void *) slot_start(slot);
+
+  if (map_kind == MAP_INDEX) {
+    interval_index_delete_bulk(idx, key.start, key.end);
+    return;
+  }
+
+  cskl_cmp_del_bulk_unsynch(cs, &key, &key, graveyard_free);
+}
+
+
+static void *
+lookup
+(
+ void *addr
+)
+{
+  if (map_kind == MAP_INDEX) {
+    return interval_index_inrange_find(idx, addr);
+  }
+  return cskl_inrange_find(cs, addr);
+}
+
+
+static void *
+bench_thread
+(
+ void *arg
+)
+{
+  bench_thread_t *t = (bench_thread_t *) arg;
+  int op;
+
+  for (op = 0; op < NUM_OPS; op++) {
+    latency_hist_init(&t->lat[op]);
+  }
+
+  pthread_barrier_wait(&barrier);
+
+  while (!finished) {
+    int dice = rng_next(&t->rng) % 100;
+    int slot = next_slot(&t->rng);
+    uint64_t start, end;
+
+    if (dice < read_pct) {
+      void *addr = (void *) (slot_start(slot) + rng_next(&t->rng) % SLOT_STRIDE);
+      op = OP_LOOKUP;
+      start = latency_now();
+      void *found = lookup(addr);
+      end = latency_now();
+      if (found) t->hits++;
+    } else if (dice < read_pct + insert_pct) {
+      op = OP_INSERT;
+      start = latency_now();
+      insert_slot(slot);
+      end = latency_now();
+    } else {
+      op = OP_DELETE;
+      start = latency_now();
+      delete_slot(slot);
+      end = latency_now();
+    }
+
+    t->ops[op]++;
+    latency_hist_record(&t->lat[op], end - start);
+  }
+
+  return NULL;
+}
+
+
+static void
+report
+(
+ const char *label,
+ latency_hist_t *h,
+ double secs
+)
+{
+  printf("%-8s %12lu %14.0f %9lu %9lu %9lu %9lu\n", label, h->count,
+	 h->count / secs,
+	 latency_hist_percentile(h, 0.50),
+	 latency_hist_percentile(h, 0.99),
+	 latency_hist_percentile(h, 0.999),
+	 h->max);
+}
+
+
+static void
+run_bench
+(
+ int num_secs,
+ int num_threads,
+ int prefill_pct,
+ int max_height
+)
+{
+  int i, op;
+
+  cskl_init();
+
+  interval_t* lsentinel = interval_new(0,0);
+  interval_t* rsentinel = interval_new(UINTPTR_MAX, UINTPTR_MAX);
+
+  cs = cskl_new(lsentinel, rsentinel, max_height, interval_compare,
+		interval_inrange, malloc);
+  idx = interval_index_new(malloc, free);
+
+  if (key_dist == KEYS_ZIPF) zipf_init();
+
+  uint64_t rng = 0x9E3779B97F4A7C15UL;
+  for (i = 0; i < num_slots; i++) {
+    if ((long) (rng_next(&rng) % 100) < prefill_pct) insert_slot(i);
+  }
+
+  pthread_t *tid = alloca(num_threads * sizeof(pthread_t));
+  bench_thread_t *threads =
+    (bench_thread_t *) calloc(num_threads, sizeof(bench_thread_t));
+
+  pthread_barrier_init(&barrier, NULL, num_threads + 1);
+  finished = 0;
+
+  for (i = 0; i < num_threads; i++) {
+    threads[i].id = i;
+    threads[i].rng = 0x9E3779B97F4A7C15UL * (i + 1);
+    if (0 != pthread_create(&tid[i], NULL, bench_thread, &threads[i])) {
+      fprintf(stderr, "Error creating thread %d\n", i);
+      exit(-1);
+    }
+  }
+
+  pthread_barrier_wait(&barrier);
+  uint64_t t0 = latency_now();
+  sleep(num_secs);
+  finished = 1;
+
+  for (i = 0; i < num_threads; i++) {
+    if (0 != pthread_join(tid[i], NULL)) {
+      fprintf(stderr, "Error finishing thread %d\n", i);
+      exit(-1);
+    }
+  }
+  double secs = (latency_now() - t0) / 1e9;
+
+  latency_hist_t *lat = (latency_hist_t *) alloca(NUM_OPS * sizeof(latency_hist_t));
+  latency_hist_t total;
+  long hits = 0;
+
+  latency_hist_init(&total);
+  for (op = 0; op < NUM_OPS; op++) {
+    latency_hist_init(&lat[op]);
+    for (i = 0; i < num_threads; i++) {
+      latency_hist_merge(&lat[op], &threads[i].lat[op]);
+    }
+    latency_hist_merge(&total, &lat[op]);
+  }
+  for (i = 0; i < num_threads; i++) {
+    hits += threads[i].hits;
+  }
+
+  printf("%s: threads %d  mix r/i/d %d/%d/%d  slots %d %s  "
+	 "height %d  time %.2f s\n",
+	 (map_kind == MAP_INDEX) ? "interval-index" : "cskiplist",
+	 num_threads, read_pct, insert_pct, delete_pct, num_slots,
+	 (key_dist == KEYS_ZIPF) ? "zipf" : "uniform", max_height, secs);
+  printf("%-8s %12s %14s %9s %9s %9s %9s\n", "op", "count", "ops/sec",
+	 "p50(ns)", "p99(ns)", "p999(ns)", "max(ns)");
+  for (op = 0; op < NUM_OPS; op++) {
+    report(op_name[op], &lat[op], secs);
+  }
+  report("total", &total, secs);
+  printf("lookup hit rate: %.3f\n",
+	 lat[OP_LOOKUP].count ? (double) hits / lat[OP_LOOKUP].count : 0.0);
+
+  pthread_barrier_destroy(&barrier);
+  graveyard_empty();
+  free(threads);
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+int
+main
+(
+ int argc,
+ char **argv
+)
+{
+  int num_secs = 5;
+  int num_threads = 4;
+  int prefill_pct = 50;
+  int max_height = MAX_HEIGHT;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "m:t:s:r:i:d:n:k:z:p:h:")) != -1) {
+    switch (ch) {
+    case 'm':
+      if (strcmp(optarg, "index") == 0) map_kind = MAP_INDEX;
+      else if (strcmp(optarg, "cskiplist") == 0) map_kind = MAP_CSKIPLIST;
+      else goto usage;
+      break;
+    case 't':
+      num_threads = atoi(optarg);
+      break;
+    case 's':
+      num_secs = atoi(optarg);
+      break;
+    case 'r':
+      read_pct = atoi(optarg);
+      break;
+    case 'i':
+      insert_pct = atoi(optarg);
+      break;
+    case 'd':
+      delete_pct = atoi(optarg);
+      break;
+    case 'n':
+      num_slots = atoi(optarg);
+      break;
+    case 'k':
+      if (strcmp(optarg, "zipf") == 0) key_dist = KEYS_ZIPF;
+      else if (strcmp(optarg, "uniform") == 0) key_dist = KEYS_UNIFORM;
+      else goto usage;
+      break;
+    case 'z':
+      zipf_theta = atof(optarg);
+      break;
+    case 'p':
+      prefill_pct = atoi(optarg);
+      break;
+    case 'h':
+      max_height = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+
+  if (read_pct + insert_pct + delete_pct != 100 || num_threads < 1 ||
+      num_slots < 1 || max_height < 1) {
+    fprintf(stderr, "read%% + insert%% + delete%% must be 100, and threads, "
+	    "slots and height must be positive\n");
+    goto usage;
+  }
+
+  run_bench(num_secs, num_threads, prefill_pct, max_height);
+
+  return 0;
+
+ usage:
+  fprintf(stderr, "Usage: %s [-m cskiplist|index] [-t threads] "
+	  "[-s seconds] [-r read%%] [-i insert%%] [-d delete%%] [-n slots] "
+	  "[-k uniform|zipf] [-z theta] [-p prefill%%] [-h max_height]\n",
+	  argv[0]);
+  return 1;
+}
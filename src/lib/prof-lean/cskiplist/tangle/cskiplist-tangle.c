@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <omp.h>
 
 
@@ -13,6 +14,10 @@
 //******************************************************************************
 
 #include <cskiplist.h>
+#include <cskiplist-batch.h>
+#include <interval-index.h>
+
+#include "interval.h"
 
 
 
@@ -22,17 +27,9 @@
 
 #define STRMAX     8096
 #define MAX_HEIGHT 4
+#define DUMP_MAX   100
 
-
-
-//******************************************************************************
-// types
-//******************************************************************************
-
-typedef struct {
-  void *start;
-  void *end;
-} interval_t;
+#define MODULE_BASE 0x10000000L
 
 
 
@@ -40,92 +37,154 @@ typedef struct {
 // private operations
 //******************************************************************************
 
-static interval_t *
-interval_new
+// fill list with intervals of length 8 every 10 bytes in [s, s+len),
+// one at a time with cskl_insert or as one sorted run with
+// cskl_insert_batch. returns the time spent inserting, in seconds.
+static double
+build_test
 (
-  long start_l, 
-  long end_l
+ cskiplist_t *list, 
+ int len, 
+ char* s, 
+ int reversed,
+ int batched
 )
 {
-  interval_t *result = (interval_t *) malloc(sizeof(interval_t));
+  int verbose = (len <= DUMP_MAX);
 
-  result->start = (void *) start_l;
-  result->end = (void *) end_l;
+  if (verbose) {
+    printf("Filling list of length %d ...\n", len);
 
-  return result;
-}
+    printf("before ...\n");
+    cskl_dump(list, interval_cskiplist_node_tostr);
+  }
 
+  int n = 0;
+  void **run = (void **) malloc((len / 10 + 1) * sizeof(void *));
 
-static int
-interval_inrange
-(
- void *interval_v, 
- void *address
-)
-{
-  interval_t *interval = (interval_t *) interval_v;
+  ptrdiff_t i;
+  for (i = len; i > 0; i = i -10) {
+    ptrdiff_t lo = reversed ? i: len - i;
+    run[n++] = interval_new((uintptr_t)(s+lo), (uintptr_t)(s+lo+8));
+  }
+
+  // a batch must be in increasing order
+  if (batched && reversed) {
+    for (i = 0; i < n / 2; i++) {
+      void *tmp = run[i];
+      run[i] = run[n - 1 - i];
+      run[n - 1 - i] = tmp;
+    }
+  }
+
+  double start = omp_get_wtime();
+  if (batched) {
+    cskl_insert_batch(list, run, n, NULL, malloc);
+  } else {
+    for (i = 0; i < n; i++) {
+      cskl_insert(list, run[i], malloc);
+    }
+  }
+  double elapsed = omp_get_wtime() - start;
 
-  return ((address >= interval->start) && (address < interval->end));
+  free(run);
+  
+  if (verbose) {
+    printf("after ...\n");
+    cskl_dump(list, interval_cskiplist_node_tostr);
+  }
+
+  return elapsed;
 }
-   
 
+
+// load modules of segments intervals each into one list
+// with cskl_insert and into another with cskl_insert_batch, then
+// compare the time and the contents of the two lists
 static int
-interval_compare
+batch_test
 (
- void* lhs_v, 
- void* rhs_v
+ int modules,
+ int segments
 )
 {
-  interval_t* lhs = (interval_t*) lhs_v;
-  interval_t* rhs = (interval_t*) rhs_v;
-
-  if (lhs->start < rhs->start) return -1;
+  interval_t* lsentinel = interval_new(0,0);
+  interval_t* rsentinel = interval_new(UINTPTR_MAX, UINTPTR_MAX);
 
-  if (lhs->start == rhs->start) return 0;
+  cskiplist_t *single = 
+    cskl_new(lsentinel, rsentinel, MAX_HEIGHT, interval_compare, 
+	     interval_inrange, malloc);
+  cskiplist_t *batch = 
+    cskl_new(lsentinel, rsentinel, MAX_HEIGHT, interval_compare, 
+	     interval_inrange, malloc);
 
-  return 1;
-}
+  int len = 10 * segments;
+  double single_time = 0.0, batch_time = 0.0;
+  int m;
+
+  // interleave module placement so later modules land between
+  // earlier ones, as mappings do in a real address space
+  for (m = 0; m < modules; m++) {
+    long slot = (m * 7919L) % modules;
+    char *s = (char *) (MODULE_BASE + slot * (len + 10));
+    int reversed = m & 1;
+    single_time += build_test(single, len, s, reversed, 0);
+    batch_time += build_test(batch, len, s, reversed, 1);
+  }
 
+  cskl_check_dump(single, interval_cskiplist_node_tostr);
+  cskl_check_dump(batch, interval_cskiplist_node_tostr);
+
+  int mismatches = 0;
+  long a, end = MODULE_BASE + (long) modules * (len + 10);
+  for (a = MODULE_BASE; a < end; a++) {
+    interval_t *x = (interval_t *) cskl_inrange_find(single, (void *) a);
+    interval_t *y = (interval_t *) cskl_inrange_find(batch, (void *) a);
+    if ((x == NULL) != (y == NULL) || (x && x->start != y->start)) {
+      mismatches++;
+    }
+  }
 
-static void
-interval_cskiplist_node_tostr
-(
- void* node_val, 
- int node_height, 
- int max_height,
- char str[], 
- int max_cskl_str_len
-)
-{
-  interval_t *interval = (interval_t *) node_val;
-  sprintf(str," [0x%016lx, 0x%016lx)\n", interval->start, interval->end);
+  printf("%d modules x %d segments\n", modules, segments);
+  printf("cskl_insert:       %10.6f s  (%.1f ns/segment)\n", single_time,
+	 1e9 * single_time / ((double) modules * segments));
+  printf("cskl_insert_batch: %10.6f s  (%.1f ns/segment)\n", batch_time,
+	 1e9 * batch_time / ((double) modules * segments));
+  printf("speedup: %.2f  mismatches: %d\n",
+	 batch_time > 0 ? single_time / batch_time : 0.0, mismatches);
 
+  return mismatches;
 }
 
 
-static void
-build_test
+// probe every address in [lo, hi) in both maps and report any address
+// where the skiplist and the flat index disagree
+static int
+compare_test
 (
- cskiplist_t *list, 
- int len, 
- char* s, 
- int reversed 
+ cskiplist_t *list,
+ interval_index_t *idx,
+ long lo,
+ long hi
 )
 {
-  printf("Filling list of length %d ...\n", len);
+  int mismatches = 0;
+  long a;
+
+  for (a = lo; a < hi; a++) {
+    void *in_list = cskl_inrange_find(list, (void *) a);
+    void *in_idx = interval_index_inrange_find(idx, (void *) a);
+    if (in_list != in_idx) {
+      printf("mismatch at 0x%lx: cskiplist %p, interval-index %p\n",
+	     a, in_list, in_idx);
+      mismatches++;
+    }
+  }
 
-  printf("before ...\n");
-  cskl_dump(list, interval_cskiplist_node_tostr);
+  printf("compared %ld addresses against %ld intervals: %d mismatches\n",
+	 hi - lo, (long) interval_index_size(idx), mismatches);
 
-  ptrdiff_t i;
-  for (i = len; i > 0; i = i -10) {
-    ptrdiff_t lo = reversed ? i: len - i;
-    interval_t *e = interval_new((uintptr_t)(s+lo), (uintptr_t)(s+lo+8));
-    cskl_insert(list, e, malloc);
-  }
-  
-  printf("after ...\n");
-  cskl_dump(list, interval_cskiplist_node_tostr);
+  return mismatches;
 }
 
 
@@ -142,6 +201,13 @@ main
 )
 {
   cskl_init();
+
+  // cskiplist-tangle batch [modules [segments]]
+  if (argc > 1 && strcmp(argv[1], "batch") == 0) {
+    int modules = (argc > 2) ? atoi(argv[2]) : 100;
+    int segments = (argc > 3) ? atoi(argv[3]) : 200;
+    return batch_test(modules, segments) != 0;
+  }
   
   interval_t* lsentinel = interval_new(0,0);
   interval_t* rsentinel = interval_new(UINTPTR_MAX, UINTPTR_MAX);
@@ -150,6 +216,8 @@ main
     cskl_new(lsentinel, rsentinel, MAX_HEIGHT, interval_compare, 
 	     interval_inrange, malloc);
 
+  interval_index_t *idx = interval_index_new(malloc, free);
+
 #if 1
 #pragma omp parallel 
 {
@@ -158,14 +226,17 @@ main
 	int hi = lo + 5;
         interval_t *e = interval_new(lo, hi);
         cskl_insert(cs, e, malloc);
+        interval_index_insert(idx, e->start, e->end, e);
 }
 
   cskl_dump(cs, interval_cskiplist_node_tostr);
 
   cskl_check_dump(cs, interval_cskiplist_node_tostr);
+
+  compare_test(cs, idx, 0, 20 + 10 * omp_get_max_threads());
 #else
 
-  build_test(cs, 100, 0, 4);
+  build_test(cs, 100, 0, 4, 0);
 
   cskl_check_dump(cs, interval_cskiplist_node_tostr);
 
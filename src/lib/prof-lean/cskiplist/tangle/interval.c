@@ -0,0 +1,83 @@
+//******************************************************************************
+// global include files
+//******************************************************************************
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+
+//******************************************************************************
+// local include files
+//******************************************************************************
+
+#include "interval.h"
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+interval_t *
+interval_new
+(
+  long start_l, 
+  long end_l
+)
+{
+  interval_t *result = (interval_t *) malloc(sizeof(interval_t));
+
+  result->start = (void *) start_l;
+  result->end = (void *) end_l;
+
+  return result;
+}
+
+
+int
+interval_inrange
+(
+ void *interval_v, 
+ void *address
+)
+{
+  interval_t *interval = (interval_t *) interval_v;
+
+  return ((address >= interval->start) && (address < interval->end));
+}
+   
+
+int
+interval_compare
+(
+ void* lhs_v, 
+ void* rhs_v
+)
+{
+  interval_t* lhs = (interval_t*) lhs_v;
+  interval_t* rhs = (interval_t*) rhs_v;
+
+  if (lhs->start < rhs->start) return -1;
+
+  if (lhs->start == rhs->start) return 0;
+
+  return 1;
+}
+
+
+void
+interval_cskiplist_node_tostr
+(
+ void* node_val, 
+ int node_height, 
+ int max_height,
+ char str[], 
+ int max_cskl_str_len
+)
+{
+  interval_t *interval = (interval_t *) node_val;
+  sprintf(str," [0x%016lx, 0x%016lx)\n", (unsigned long) interval->start,
+	  (unsigned long) interval->end);
+
+}
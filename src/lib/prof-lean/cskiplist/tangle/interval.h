@@ -0,0 +1,69 @@
+//******************************************************************************
+// file: interval.h
+//
+// purpose:
+//   [start, end) address intervals and the cskiplist callbacks used to
+//   order and search them, shared by the tangle test and benchmarks.
+//******************************************************************************
+
+#ifndef __interval_h__
+#define __interval_h__
+
+//******************************************************************************
+// global include files
+//******************************************************************************
+
+#include <stdint.h>
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  void *start;
+  void *end;
+} interval_t;
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+interval_t *
+interval_new
+(
+  long start_l, 
+  long end_l
+);
+
+
+int
+interval_inrange
+(
+ void *interval_v, 
+ void *address
+);
+
+
+int
+interval_compare
+(
+ void* lhs_v, 
+ void* rhs_v
+);
+
+
+void
+interval_cskiplist_node_tostr
+(
+ void* node_val, 
+ int node_height, 
+ int max_height,
+ char str[], 
+ int max_cskl_str_len
+);
+
+#endif
@@ -0,0 +1,248 @@
+//******************************************************************************
+// file: pool-bench.c
+//
+// purpose:
+//   compare cskiplist insert throughput and memory footprint when the
+//   nodes and intervals come from malloc or from the prof-lean pool
+//   allocator. each thread inserts its own run of intervals into one
+//   shared list, the way a burst of dlopens adds load modules.
+//
+//   the default max height grows with the total number of inserts
+//   (about log2 of the list size), so the list doesn't degenerate into
+//   long linear walks at the default -n.
+//
+// usage:
+//   pool-bench [-a malloc|pool] [-t threads] [-n inserts_per_thread]
+//              [-h max_height]
+//******************************************************************************
+
+//******************************************************************************
+// global include files
+//******************************************************************************
+
+#include <alloca.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//******************************************************************************
+// local include files
+//******************************************************************************
+
+#include <cskiplist.h>
+#include <pool-alloc.h>
+
+#include "interval.h"
+#include "latency.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define MAX_HEIGHT      4
+
+#define SLOT_BASE       0x10000000L
+#define SLOT_STRIDE     4096
+#define SLOT_LEN        2048
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  int id;
+  long count;
+  uint64_t start;
+  uint64_t end;
+} bench_thread_t;
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static pthread_barrier_t barrier;
+
+static cskiplist_t *cs;
+
+static mem_alloc m_alloc = malloc;
+static int num_threads = 4;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+// smallest height h >= MAX_HEIGHT with 2^h >= total
+static int
+default_height
+(
+ long total
+)
+{
+  int height = MAX_HEIGHT;
+
+  while (height < 30 && (1L << height) < total) height++;
+  return height;
+}
+
+
+static long
+resident_bytes
+(
+ void
+)
+{
+  long size = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+
+  if (f) {
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2) resident = 0;
+    fclose(f);
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+
+static void *
+insert_thread
+(
+ void *arg
+)
+{
+  bench_thread_t *t = (bench_thread_t *) arg;
+  long i;
+
+  pthread_barrier_wait(&barrier);
+  t->start = latency_now();
+
+  // interleave the threads' slots so they insert into the same region
+  for (i = 0; i < t->count; i++) {
+    long lo = SLOT_BASE + (i * num_threads + t->id) * SLOT_STRIDE;
+    interval_t *e = (interval_t *) m_alloc(sizeof(interval_t));
+    e->start = (void *) lo;
+    e->end = (void *) (lo + SLOT_LEN);
+    cskl_insert(cs, e, m_alloc);
+  }
+
+  t->end = latency_now();
+  return NULL;
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+int
+main
+(
+ int argc,
+ char **argv
+)
+{
+  int use_pool = 0;
+  long count = 100000;
+  int max_height = 0;
+  int ch, i;
+
+  while ((ch = getopt(argc, argv, "a:t:n:h:")) != -1) {
+    switch (ch) {
+    case 'a':
+      if (strcmp(optarg, "pool") == 0) use_pool = 1;
+      else if (strcmp(optarg, "malloc") == 0) use_pool = 0;
+      else goto usage;
+      break;
+    case 't':
+      num_threads = atoi(optarg);
+      break;
+    case 'n':
+      count = atol(optarg);
+      break;
+    case 'h':
+      max_height = atoi(optarg);
+      if (max_height < 1) goto usage;
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (num_threads < 1 || count < 1) goto usage;
+  if (max_height == 0) max_height = default_height(count * num_threads);
+
+  if (use_pool) m_alloc = pool_alloc;
+
+  cskl_init();
+
+  interval_t* lsentinel = interval_new(0,0);
+  interval_t* rsentinel = interval_new(UINTPTR_MAX, UINTPTR_MAX);
+
+  cs = cskl_new(lsentinel, rsentinel, max_height, interval_compare,
+		interval_inrange, malloc);
+
+  pthread_t *tid = alloca(num_threads * sizeof(pthread_t));
+  bench_thread_t *threads = alloca(num_threads * sizeof(bench_thread_t));
+
+  pthread_barrier_init(&barrier, NULL, num_threads + 1);
+
+  for (i = 0; i < num_threads; i++) {
+    threads[i].id = i;
+    threads[i].count = count;
+    if (0 != pthread_create(&tid[i], NULL, insert_thread, &threads[i])) {
+      fprintf(stderr, "Error creating thread %d\n", i);
+      exit(-1);
+    }
+  }
+
+  long rss0 = resident_bytes();
+  pthread_barrier_wait(&barrier);
+
+  for (i = 0; i < num_threads; i++) {
+    if (0 != pthread_join(tid[i], NULL)) {
+      fprintf(stderr, "Error finishing thread %d\n", i);
+      exit(-1);
+    }
+  }
+
+  // elapsed from the first thread's start to the last thread's finish
+  uint64_t t0 = threads[0].start, t1 = threads[0].end;
+  for (i = 1; i < num_threads; i++) {
+    if (threads[i].start < t0) t0 = threads[i].start;
+    if (threads[i].end > t1) t1 = threads[i].end;
+  }
+  double secs = (t1 - t0) / 1e9;
+  long rss1 = resident_bytes();
+  long total = count * num_threads;
+
+  printf("pool-bench: %s  threads %d  inserts %ld  height %d\n",
+	 use_pool ? "pool" : "malloc", num_threads, total, max_height);
+  printf("time: %.3f s  inserts/sec: %.0f  ns/insert: %.1f\n",
+	 secs, total / secs, secs * 1e9 / total);
+  printf("rss growth: %ld KB  (%.1f bytes/insert)\n",
+	 (rss1 - rss0) / 1024, (double) (rss1 - rss0) / total);
+  if (use_pool) {
+    printf("pool mapped: %ld KB\n", (long) pool_mapped_bytes() / 1024);
+  }
+
+  pthread_barrier_destroy(&barrier);
+
+  return 0;
+
+ usage:
+  fprintf(stderr, "Usage: %s [-a malloc|pool] [-t threads] "
+	  "[-n inserts_per_thread] [-h max_height]\n", argv[0]);
+  return 1;
+}
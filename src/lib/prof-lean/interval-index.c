@@ -0,0 +1,403 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: interval-index.c
+//
+// purpose:
+//   sorted-array interval index with lock-free readers. see
+//   interval-index.h.
+//
+//   reclamation uses a two-phase reader count. a reader registers in
+//   the counter for the current epoch parity, re-checks the epoch and
+//   only then loads the snapshot. a writer publishes the new snapshot,
+//   advances the epoch and waits for the old parity's counters to
+//   drain; after that no reader can hold the old snapshot. counters are
+//   spread over cache-line-sized slots so readers on different threads
+//   do not share a line.
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdint.h>
+#include <string.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "interval-index.h"
+#include "spinlock.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define CACHE_LINE        64
+#define READER_SLOTS      64
+
+#define ROUND_UP(n, a)    (((n) + (a) - 1) & ~((size_t) (a) - 1))
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  void *block;
+  size_t count;
+  uintptr_t *start;
+  uintptr_t *end;
+  void **val;
+} snapshot_t;
+
+typedef struct {
+  volatile long active[2];
+} __attribute__((aligned(CACHE_LINE))) reader_slot_t;
+
+struct interval_index_s {
+  snapshot_t * volatile current;
+  volatile long epoch;
+  spinlock_t writer_lock;
+  interval_index_alloc_fn m_alloc;
+  interval_index_free_fn m_free;
+  reader_slot_t readers[READER_SLOTS];
+};
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static volatile int next_reader_slot;
+static __thread int my_reader_slot = -1;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static reader_slot_t *
+reader_slot
+(
+ interval_index_t *idx
+)
+{
+  if (my_reader_slot < 0) {
+    my_reader_slot = 
+      __sync_fetch_and_add(&next_reader_slot, 1) % READER_SLOTS;
+  }
+  return &idx->readers[my_reader_slot];
+}
+
+
+static snapshot_t *
+snapshot_new
+(
+ interval_index_t *idx,
+ size_t count
+)
+{
+  size_t array = ROUND_UP((count ? count : 1) * sizeof(uintptr_t), CACHE_LINE);
+  size_t header = ROUND_UP(sizeof(snapshot_t), CACHE_LINE);
+  char *block = (char *) idx->m_alloc(CACHE_LINE + header + 3 * array);
+
+  if (block == NULL) return NULL;
+
+  char *base = (char *) ROUND_UP((uintptr_t) block, CACHE_LINE);
+  snapshot_t *s = (snapshot_t *) base;
+
+  s->block = block;
+  s->count = count;
+  s->start = (uintptr_t *) (base + header);
+  s->end = (uintptr_t *) (base + header + array);
+  s->val = (void **) (base + header + 2 * array);
+
+  return s;
+}
+
+
+// index of the last interval whose start is <= address, or -1
+static long
+snapshot_search
+(
+ snapshot_t *s,
+ uintptr_t address
+)
+{
+  const uintptr_t *base = s->start;
+  size_t n = s->count;
+
+  if (n == 0 || address < base[0]) return -1;
+
+  while (n > 1) {
+    size_t half = n / 2;
+    base = (base[half] <= address) ? base + half : base;
+    n -= half;
+  }
+  return base - s->start;
+}
+
+
+// publish next in place of the current snapshot and free the old one
+// once no reader can still be using it. the writer lock is held.
+static void
+snapshot_publish
+(
+ interval_index_t *idx,
+ snapshot_t *next
+)
+{
+  snapshot_t *old = idx->current;
+  int i;
+
+  idx->current = next;
+  __sync_synchronize();
+
+  long epoch = idx->epoch;
+  idx->epoch = epoch + 1;
+  __sync_synchronize();
+
+  for (i = 0; i < READER_SLOTS; i++) {
+    while (idx->readers[i].active[epoch & 1] != 0);
+  }
+
+  idx->m_free(old->block);
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+interval_index_t *
+interval_index_new
+(
+ interval_index_alloc_fn m_alloc,
+ interval_index_free_fn m_free
+)
+{
+  char *block = (char *) m_alloc(sizeof(interval_index_t) + 2 * CACHE_LINE);
+
+  if (block == NULL) return NULL;
+
+  // the reader slots must be line aligned; the index is never freed
+  // through this pointer, so keep the raw block in a hidden word.
+  interval_index_t *idx = (interval_index_t *) 
+    ROUND_UP((uintptr_t) block + sizeof(void *), CACHE_LINE);
+  ((void **) idx)[-1] = block;
+
+  memset(idx, 0, sizeof(*idx));
+  idx->m_alloc = m_alloc;
+  idx->m_free = m_free;
+  spinlock_init(&idx->writer_lock);
+
+  idx->current = snapshot_new(idx, 0);
+  if (idx->current == NULL) {
+    m_free(block);
+    return NULL;
+  }
+
+  return idx;
+}
+
+
+void
+interval_index_destroy
+(
+ interval_index_t *idx
+)
+{
+  idx->m_free(idx->current->block);
+  idx->m_free(((void **) idx)[-1]);
+}
+
+
+bool
+interval_index_insert
+(
+ interval_index_t *idx,
+ void *start,
+ void *end,
+ void *val
+)
+{
+  uintptr_t lo = (uintptr_t) start;
+  bool inserted = false;
+
+  spinlock_lock(&idx->writer_lock);
+
+  snapshot_t *cur = idx->current;
+  long pos = snapshot_search(cur, lo);
+
+  if (pos < 0 || cur->start[pos] != lo) {
+    snapshot_t *next = snapshot_new(idx, cur->count + 1);
+    if (next) {
+      size_t before = pos + 1;
+      size_t after = cur->count - before;
+
+      memcpy(next->start, cur->start, before * sizeof(uintptr_t));
+      memcpy(next->end, cur->end, before * sizeof(uintptr_t));
+      memcpy(next->val, cur->val, before * sizeof(void *));
+
+      next->start[before] = lo;
+      next->end[before] = (uintptr_t) end;
+      next->val[before] = val;
+
+      memcpy(next->start + before + 1, cur->start + before, 
+	     after * sizeof(uintptr_t));
+      memcpy(next->end + before + 1, cur->end + before,
+	     after * sizeof(uintptr_t));
+      memcpy(next->val + before + 1, cur->val + before,
+	     after * sizeof(void *));
+
+      snapshot_publish(idx, next);
+      inserted = true;
+    }
+  }
+
+  spinlock_unlock(&idx->writer_lock);
+
+  return inserted;
+}
+
+
+bool
+interval_index_delete_bulk
+(
+ interval_index_t *idx,
+ void *lo,
+ void *hi
+)
+{
+  bool deleted = false;
+
+  spinlock_lock(&idx->writer_lock);
+
+  snapshot_t *cur = idx->current;
+
+  // [first, last) is the run of intervals with start in [lo, hi]
+  long first = snapshot_search(cur, (uintptr_t) lo - 1) + 1;
+  if ((uintptr_t) lo == 0) first = 0;
+  long last = snapshot_search(cur, (uintptr_t) hi) + 1;
+
+  if (last > first) {
+    snapshot_t *next = snapshot_new(idx, cur->count - (last - first));
+    if (next) {
+      size_t after = cur->count - last;
+
+      memcpy(next->start, cur->start, first * sizeof(uintptr_t));
+      memcpy(next->end, cur->end, first * sizeof(uintptr_t));
+      memcpy(next->val, cur->val, first * sizeof(void *));
+
+      memcpy(next->start + first, cur->start + last, 
+	     after * sizeof(uintptr_t));
+      memcpy(next->end + first, cur->end + last, after * sizeof(uintptr_t));
+      memcpy(next->val + first, cur->val + last, after * sizeof(void *));
+
+      snapshot_publish(idx, next);
+      deleted = true;
+    }
+  }
+
+  spinlock_unlock(&idx->writer_lock);
+
+  return deleted;
+}
+
+
+void *
+interval_index_inrange_find
+(
+ interval_index_t *idx,
+ void *address
+)
+{
+  reader_slot_t *slot = reader_slot(idx);
+  uintptr_t addr = (uintptr_t) address;
+  void *result = NULL;
+  long epoch;
+
+  for (;;) {
+    epoch = idx->epoch;
+    __sync_fetch_and_add(&slot->active[epoch & 1], 1);
+    if (idx->epoch == epoch) break;
+    __sync_fetch_and_sub(&slot->active[epoch & 1], 1);
+  }
+
+  snapshot_t *s = idx->current;
+  long pos = snapshot_search(s, addr);
+  if (pos >= 0 && addr < s->end[pos]) {
+    result = s->val[pos];
+  }
+
+  __sync_fetch_and_sub(&slot->active[epoch & 1], 1);
+
+  return result;
+}
+
+
+size_t
+interval_index_size
+(
+ interval_index_t *idx
+)
+{
+  spinlock_lock(&idx->writer_lock);
+  size_t count = idx->current->count;
+  spinlock_unlock(&idx->writer_lock);
+
+  return count;
+}
@@ -0,0 +1,148 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+// ******************************************************* EndRiceCopyright *
+
+//******************************************************************************
+// file: interval-index.h
+//
+// purpose:
+//   a read-optimized map from addresses to [start, end) intervals, for
+//   use in place of a cskiplist when inserts are rare and lookups happen
+//   on every sample.
+//
+//   the intervals live in a sorted, contiguous, cache-line-aligned
+//   snapshot. readers binary search the current snapshot without locks
+//   and without allocating, so lookups are safe in a signal handler.
+//   writers are serialized; each update builds a fresh snapshot,
+//   publishes it, waits for readers still using the old snapshot to
+//   leave, and then frees the old one.
+//
+//   a writer must not run in a signal handler that interrupted a
+//   lookup on the same thread: it would wait for that lookup forever.
+//******************************************************************************
+
+#ifndef __interval_index_h__
+#define __interval_index_h__
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct interval_index_s interval_index_t;
+
+typedef void *(*interval_index_alloc_fn)(size_t size);
+typedef void (*interval_index_free_fn)(void *ptr);
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+// create an empty index whose snapshots are allocated and freed with
+// m_alloc and m_free
+interval_index_t *
+interval_index_new
+(
+ interval_index_alloc_fn m_alloc,
+ interval_index_free_fn m_free
+);
+
+
+void
+interval_index_destroy
+(
+ interval_index_t *idx
+);
+
+
+// add [start, end) -> val. returns false, and leaves the index
+// unchanged, if an interval with the same start is already present.
+bool
+interval_index_insert
+(
+ interval_index_t *idx,
+ void *start,
+ void *end,
+ void *val
+);
+
+
+// remove all intervals whose start lies in [lo, hi]. returns true if
+// any interval was removed.
+bool
+interval_index_delete_bulk
+(
+ interval_index_t *idx,
+ void *lo,
+ void *hi
+);
+
+
+// return the val of the interval containing address, or NULL
+void *
+interval_index_inrange_find
+(
+ interval_index_t *idx,
+ void *address
+);
+
+
+size_t
+interval_index_size
+(
+ interval_index_t *idx
+);
+
+#endif
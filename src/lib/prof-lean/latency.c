@@ -0,0 +1,84 @@
+//******************************************************************************
+// global include files
+//******************************************************************************
+
+#define _GNU_SOURCE
+
+#include <string.h>
+
+
+
+//******************************************************************************
+// local include files
+//******************************************************************************
+
+#include "latency.h"
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+void
+latency_hist_init
+(
+ latency_hist_t *h
+)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+
+void
+latency_hist_merge
+(
+ latency_hist_t *dst, 
+ const latency_hist_t *src
+)
+{
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    dst->bucket[i] += src->bucket[i];
+  }
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+
+uint64_t
+latency_hist_percentile
+(
+ const latency_hist_t *h,
+ double p
+)
+{
+  if (h->count == 0) return 0;
+
+  uint64_t rank = (uint64_t) (p * h->count);
+  if (rank >= h->count) rank = h->count - 1;
+
+  uint64_t seen = 0;
+  int i;
+  for (i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += h->bucket[i];
+    if (seen > rank) return latency_hist_bucket_low(i);
+  }
+  return h->max;
+}
+
+
+uint64_t
+latency_hist_bucket_low
+(
+ int index
+)
+{
+  if (index < LATENCY_SUB) return index;
+
+  int msb = (index >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+  uint64_t sub = index & (LATENCY_SUB - 1);
+
+  return (LATENCY_SUB + sub) << (msb - LATENCY_SUB_BITS);
+}
@@ -0,0 +1,120 @@
+//******************************************************************************
+// file: latency.h
+//
+// purpose:
+//   log-linear latency histograms for the benchmarks (cskiplist, the
+//   lock tests and dlstress). each power of two is split into 16
+//   sub-buckets, so a reported percentile is within ~6% of the true
+//   value. histograms are per-thread and are merged after the threads
+//   join. values are usually nanoseconds, but any unit works (the lock
+//   tests record cycles).
+//******************************************************************************
+
+#ifndef __latency_h__
+#define __latency_h__
+
+//******************************************************************************
+// global include files
+//******************************************************************************
+
+#include <stdint.h>
+#include <time.h>
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define LATENCY_SUB_BITS  4
+#define LATENCY_SUB       (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS   (64 << LATENCY_SUB_BITS)
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t bucket[LATENCY_BUCKETS];
+} latency_hist_t;
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+static inline uint64_t
+latency_now
+(
+ void
+)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+
+static inline void
+latency_hist_record
+(
+ latency_hist_t *h,
+ uint64_t ns
+)
+{
+  int index;
+
+  if (ns < LATENCY_SUB) {
+    index = ns;
+  } else {
+    int msb = 63 - __builtin_clzl(ns);
+    int shift = msb - LATENCY_SUB_BITS;
+    index = ((msb - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) + 
+      ((ns >> shift) & (LATENCY_SUB - 1));
+  }
+
+  h->bucket[index]++;
+  h->count++;
+  h->sum += ns;
+  if (ns > h->max) h->max = ns;
+}
+
+
+void
+latency_hist_init
+(
+ latency_hist_t *h
+);
+
+
+void
+latency_hist_merge
+(
+ latency_hist_t *dst, 
+ const latency_hist_t *src
+);
+
+
+// value below which fraction p of the recorded samples fall
+uint64_t
+latency_hist_percentile
+(
+ const latency_hist_t *h,
+ double p
+);
+
+
+// smallest value that falls in bucket index
+uint64_t
+latency_hist_bucket_low
+(
+ int index
+);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ *  Support for the lock benchmarks.  See lock-bench.h.
+ */
+
+#define _GNU_SOURCE
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "lock-bench.h"
+#include "cpu-socket.h"
+
+#define MAX_CPUS  4096
+
+static int num_cpus;
+static int num_sockets;
+static int cpu_list[MAX_CPUS];
+static int scatter_list[MAX_CPUS];
+static int socket_of[MAX_CPUS];
+
+static int json_rows;
+static int csv_header_done;
+static int csv_num_keys;
+static const char *csv_key[MAX_EXTRAS];
+
+/*
+ *  Cycle counter rate, measured once against CLOCK_MONOTONIC.
+ */
+double
+bench_cycles_per_ns(void)
+{
+  static double rate = 0.0;
+  if (rate == 0.0) {
+    struct timespec t0, t1, nap = { 0, 20000000 };
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    uint64_t c0 = bench_cycles();
+    nanosleep(&nap, NULL);
+    uint64_t c1 = bench_cycles();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    rate = (c1 - c0) / ns;
+    if (rate <= 0.0)
+      rate = 1.0;
+  }
+  return rate;
+}
+
+double
+bench_cycles_to_ns(uint64_t cycles)
+{
+  return cycles / bench_cycles_per_ns();
+}
+
+/*
+ *  Jain's fairness index: 1.0 when every thread got the same share,
+ *  1/n when one thread got everything.
+ */
+double
+bench_jain_index(const long *x, int n)
+{
+  double sum = 0.0, sumsq = 0.0;
+  int i;
+  for (i = 0; i < n; i++) {
+    sum += x[i];
+    sumsq += (double) x[i] * x[i];
+  }
+  return (sumsq > 0.0) ? (sum * sum) / (n * sumsq) : 1.0;
+}
+
+/*
+ *  Fill in the per-thread operation statistics of a result.
+ */
+void
+bench_summarize(bench_result_t *r, const long *ops, int n)
+{
+  double mean = 0.0, var = 0.0;
+  int i;
+
+  r->threads = n;
+  r->total_ops = 0;
+  r->min_ops = (n > 0) ? ops[0] : 0;
+  r->max_ops = 0;
+  for (i = 0; i < n; i++) {
+    r->total_ops += ops[i];
+    if (ops[i] < r->min_ops)
+      r->min_ops = ops[i];
+    if (ops[i] > r->max_ops)
+      r->max_ops = ops[i];
+  }
+  if (n > 0)
+    mean = (double) r->total_ops / n;
+  for (i = 0; i < n; i++)
+    var += (ops[i] - mean) * (ops[i] - mean);
+  r->mean_ops = mean;
+  r->stddev_ops = (n > 1) ? sqrt(var / (n - 1)) : 0.0;
+  r->jain = bench_jain_index(ops, n);
+}
+
+int
+bench_parse_format(const char *str, bench_format_t *fmt)
+{
+  if (strcmp(str, "text") == 0)
+    *fmt = FORMAT_TEXT;
+  else if (strcmp(str, "csv") == 0)
+    *fmt = FORMAT_CSV;
+  else if (strcmp(str, "json") == 0)
+    *fmt = FORMAT_JSON;
+  else
+    return -1;
+  return 0;
+}
+
+int
+bench_parse_pin(const char *str, pin_policy_t *pin)
+{
+  if (strcmp(str, "none") == 0)
+    *pin = PIN_NONE;
+  else if (strcmp(str, "compact") == 0)
+    *pin = PIN_COMPACT;
+  else if (strcmp(str, "scatter") == 0)
+    *pin = PIN_SCATTER;
+  else
+    return -1;
+  return 0;
+}
+
+const char *
+bench_pin_name(pin_policy_t pin)
+{
+  switch (pin) {
+  case PIN_COMPACT:
+    return "compact";
+  case PIN_SCATTER:
+    return "scatter";
+  default:
+    return "none";
+  }
+}
+
+/*
+ *  Read the CPUs we may run on and the socket of each from sysfs.
+ *  Compact order fills one socket before the next; scatter order
+ *  deals CPUs round-robin across the sockets.
+ */
+void
+bench_topology_init(void)
+{
+  cpu_set_t set;
+  int cpu, s, k, n;
+
+  if (num_cpus > 0)
+    return;
+
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+  }
+
+  num_sockets = 1;
+  for (cpu = 0; cpu < CPU_SETSIZE && num_cpus < MAX_CPUS; cpu++) {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+    int socket = cpu_socket_read(cpu);
+    socket_of[cpu] = socket;
+    if (socket + 1 > num_sockets)
+      num_sockets = socket + 1;
+    cpu_list[num_cpus++] = cpu;
+  }
+
+  n = 0;
+  for (k = 0; n < num_cpus; k++) {
+    for (s = 0; s < num_sockets; s++) {
+      int seen = 0;
+      for (cpu = 0; cpu < num_cpus; cpu++) {
+	if (socket_of[cpu_list[cpu]] != s)
+	  continue;
+	if (seen++ == k) {
+	  scatter_list[n++] = cpu_list[cpu];
+	  break;
+	}
+      }
+    }
+  }
+}
+
+int
+bench_num_sockets(void)
+{
+  bench_topology_init();
+  return num_sockets;
+}
+
+int
+bench_cpu_socket(int cpu)
+{
+  bench_topology_init();
+  return (cpu >= 0 && cpu < MAX_CPUS) ? socket_of[cpu] : 0;
+}
+
+/*
+ *  Returns: the CPU for thread number 'thread' under 'pin', or -1 for
+ *  no pinning.
+ */
+int
+bench_thread_cpu(int thread, pin_policy_t pin)
+{
+  bench_topology_init();
+  switch (pin) {
+  case PIN_COMPACT:
+    return cpu_list[thread % num_cpus];
+  case PIN_SCATTER:
+    return scatter_list[thread % num_cpus];
+  default:
+    return -1;
+  }
+}
+
+int
+bench_pin_self(int cpu)
+{
+  cpu_set_t set;
+  if (cpu < 0)
+    return 0;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+int
+bench_current_socket(void)
+{
+  int cpu = sched_getcpu();
+  return (cpu < 0) ? 0 : bench_cpu_socket(cpu);
+}
+
+/*
+ *  Deliver SIGPROF to handler every usec of process CPU time, as the
+ *  profiler's itimer does.  Call after the worker threads are created:
+ *  the calling thread blocks SIGPROF so that its sleep is not cut short
+ *  and samples land on the workers.
+ */
+void
+bench_sampler_start(long usec, void (*handler)(int))
+{
+  struct sigaction sa;
+  struct itimerval it;
+  sigset_t set;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  it.it_interval.tv_sec = usec / 1000000;
+  it.it_interval.tv_usec = usec % 1000000;
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_PROF, &it, NULL);
+}
+
+void
+bench_sampler_stop(void)
+{
+  struct itimerval it;
+  sigset_t set;
+
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGPROF);
+  pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+void
+bench_result_init(bench_result_t *r, const char *test, const char *lock,
+		  const char *role)
+{
+  memset(r, 0, sizeof(*r));
+  r->test = test;
+  r->lock = lock;
+  r->role = role;
+}
+
+void
+bench_result_extra(bench_result_t *r, const char *key, double val)
+{
+  if (r->num_extras < MAX_EXTRAS) {
+    r->extra_key[r->num_extras] = key;
+    r->extra_val[r->num_extras] = val;
+    r->num_extras++;
+  }
+}
+
+/*
+ *  Returns: 1 if the row has the same extra keys as the last CSV
+ *  header.
+ */
+static int
+csv_keys_match(const bench_result_t *r)
+{
+  int i;
+  if (r->num_extras != csv_num_keys)
+    return 0;
+  for (i = 0; i < r->num_extras; i++)
+    if (strcmp(r->extra_key[i], csv_key[i]) != 0)
+      return 0;
+  return 1;
+}
+
+void
+bench_report_begin(bench_format_t fmt)
+{
+  json_rows = 0;
+  csv_header_done = 0;
+  csv_num_keys = 0;
+  if (fmt == FORMAT_JSON)
+    printf("[\n");
+}
+
+void
+bench_report(bench_format_t fmt, const bench_result_t *r)
+{
+  const bench_hist_t *h = r->hist;
+  double ops_per_sec = (r->secs > 0.0) ? r->total_ops / r->secs : 0.0;
+  double lat_mean = (h->count > 0) ? bench_cycles_to_ns(h->sum) / h->count : 0.0;
+  double p50 = bench_cycles_to_ns(bench_hist_percentile(h, 0.50));
+  double p90 = bench_cycles_to_ns(bench_hist_percentile(h, 0.90));
+  double p99 = bench_cycles_to_ns(bench_hist_percentile(h, 0.99));
+  double p999 = bench_cycles_to_ns(bench_hist_percentile(h, 0.999));
+  double lat_max = bench_cycles_to_ns(h->max);
+  int i;
+
+  switch (fmt) {
+  case FORMAT_TEXT:
+    printf("ops/sec: %.0f\n", ops_per_sec);
+    printf("fairness (jain): %.5f\n", r->jain);
+    printf("acquire latency (ns): mean %.1f  p50 %.0f  p90 %.0f  p99 %.0f"
+	   "  p99.9 %.0f  max %.0f\n", lat_mean, p50, p90, p99, p999, lat_max);
+    for (i = 0; i < r->num_extras; i++)
+      printf("%s: %g\n", r->extra_key[i], r->extra_val[i]);
+    break;
+
+  case FORMAT_CSV:
+    // a new header whenever the extra columns change, for example a
+    // cohort row with handoff counts after an MCS row
+    if (!csv_header_done || !csv_keys_match(r)) {
+      printf("test,lock,role,threads,cs_len,think,pin,secs,total_ops,ops_per_sec,"
+	     "min_ops,max_ops,mean_ops,stddev_ops,jain,lat_mean_ns,lat_p50_ns,"
+	     "lat_p90_ns,lat_p99_ns,lat_p999_ns,lat_max_ns");
+      for (i = 0; i < r->num_extras; i++)
+	printf(",%s", r->extra_key[i]);
+      printf("\n");
+      for (i = 0; i < r->num_extras; i++)
+	csv_key[i] = r->extra_key[i];
+      csv_num_keys = r->num_extras;
+      csv_header_done = 1;
+    }
+    printf("%s,%s,%s,%d,%ld,%ld,%s,%.3f,%ld,%.0f,%ld,%ld,%.2f,%.2f,%.5f,"
+	   "%.1f,%.0f,%.0f,%.0f,%.0f,%.0f",
+	   r->test, r->lock, r->role, r->threads, r->cs_len, r->think,
+	   bench_pin_name(r->pin), r->secs, r->total_ops, ops_per_sec,
+	   r->min_ops, r->max_ops, r->mean_ops, r->stddev_ops, r->jain,
+	   lat_mean, p50, p90, p99, p999, lat_max);
+    for (i = 0; i < r->num_extras; i++)
+      printf(",%g", r->extra_val[i]);
+    printf("\n");
+    break;
+
+  case FORMAT_JSON:
+    printf("%s  {\"test\": \"%s\", \"lock\": \"%s\", \"role\": \"%s\", "
+	   "\"threads\": %d, \"cs_len\": %ld, \"think\": %ld, \"pin\": \"%s\",\n"
+	   "   \"secs\": %.3f, \"total_ops\": %ld, \"ops_per_sec\": %.0f, "
+	   "\"min_ops\": %ld, \"max_ops\": %ld, \"mean_ops\": %.2f, "
+	   "\"stddev_ops\": %.2f, \"jain\": %.5f,\n"
+	   "   \"latency_ns\": {\"mean\": %.1f, \"p50\": %.0f, \"p90\": %.0f, "
+	   "\"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f},\n",
+	   (json_rows > 0) ? ",\n" : "",
+	   r->test, r->lock, r->role, r->threads, r->cs_len, r->think,
+	   bench_pin_name(r->pin), r->secs, r->total_ops, ops_per_sec,
+	   r->min_ops, r->max_ops, r->mean_ops, r->stddev_ops, r->jain,
+	   lat_mean, p50, p90, p99, p999, lat_max);
+    for (i = 0; i < r->num_extras; i++)
+      printf("   \"%s\": %g,\n", r->extra_key[i], r->extra_val[i]);
+    printf("   \"latency_hist_ns\": [");
+    int first = 1;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+      if (h->bucket[i] == 0)
+	continue;
+      printf("%s[%.0f, %lu]", first ? "" : ", ",
+	     bench_cycles_to_ns(latency_hist_bucket_low(i)), (unsigned long) h->bucket[i]);
+      first = 0;
+    }
+    printf("]}");
+    json_rows++;
+    break;
+  }
+  fflush(stdout);
+}
+
+void
+bench_report_end(bench_format_t fmt)
+{
+  if (fmt == FORMAT_JSON)
+    printf("\n]\n");
+}
@@ -0,0 +1,132 @@
+/*
+ *  Support for the lock benchmarks: cycle timing, latency histograms,
+ *  fairness, CPU topology and pinning, a SIGPROF sampler, and
+ *  text/CSV/JSON reports.
+ *
+ *  Latencies are kept in cycles in the log-linear histograms from
+ *  latency.h (16 sub-buckets per power of two, so percentiles are
+ *  within ~6%) and converted to nanoseconds when reported.
+ */
+
+#ifndef _LOCK_BENCH_H_
+#define _LOCK_BENCH_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "latency.h"
+
+#define MAX_EXTRAS  12
+
+typedef enum { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON } bench_format_t;
+typedef enum { PIN_NONE, PIN_COMPACT, PIN_SCATTER } pin_policy_t;
+
+typedef latency_hist_t bench_hist_t;
+
+/*
+ *  One row of results: one lock, one role (all threads, readers or
+ *  writers).  Tests may attach extra named values such as handoff or
+ *  dropped-sample counts.
+ */
+typedef struct {
+  const char *test;
+  const char *lock;
+  const char *role;
+  int threads;
+  long cs_len;
+  long think;
+  pin_policy_t pin;
+  double secs;
+  long total_ops;
+  long min_ops;
+  long max_ops;
+  double mean_ops;
+  double stddev_ops;
+  double jain;
+  bench_hist_t *hist;
+  int num_extras;
+  const char *extra_key[MAX_EXTRAS];
+  double extra_val[MAX_EXTRAS];
+} bench_result_t;
+
+static inline uint64_t
+bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint32_t lo, hi;
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64_t) hi << 32) | lo;
+#elif defined(__powerpc64__)
+  uint64_t tb;
+  __asm__ __volatile__ ("mftb %0" : "=r" (tb));
+  return tb;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+#endif
+}
+
+static inline void
+bench_hist_add(bench_hist_t *h, uint64_t v)
+{
+  latency_hist_record(h, v);
+}
+
+static inline void
+bench_hist_init(bench_hist_t *h)
+{
+  latency_hist_init(h);
+}
+
+static inline void
+bench_hist_merge(bench_hist_t *dst, const bench_hist_t *src)
+{
+  latency_hist_merge(dst, src);
+}
+
+static inline uint64_t
+bench_hist_percentile(const bench_hist_t *h, double p)
+{
+  return latency_hist_percentile(h, p);
+}
+
+/*
+ *  Burn about n units of local work (think time).
+ */
+static inline void
+bench_work(long n)
+{
+  volatile unsigned long x = 1;
+  long i;
+  for (i = 0; i < n; i++)
+    x = x * 6364136223846793005UL + 1;
+}
+
+double   bench_cycles_per_ns(void);
+double   bench_cycles_to_ns(uint64_t cycles);
+
+double   bench_jain_index(const long *x, int n);
+void     bench_summarize(bench_result_t *r, const long *ops, int n);
+
+int      bench_parse_format(const char *str, bench_format_t *fmt);
+int      bench_parse_pin(const char *str, pin_policy_t *pin);
+const char *bench_pin_name(pin_policy_t pin);
+
+void     bench_topology_init(void);
+int      bench_num_sockets(void);
+int      bench_cpu_socket(int cpu);
+int      bench_thread_cpu(int thread, pin_policy_t pin);
+int      bench_pin_self(int cpu);
+int      bench_current_socket(void);
+
+void     bench_sampler_start(long usec, void (*handler)(int));
+void     bench_sampler_stop(void);
+
+void     bench_result_init(bench_result_t *r, const char *test,
+			   const char *lock, const char *role);
+void     bench_result_extra(bench_result_t *r, const char *key, double val);
+void     bench_report_begin(bench_format_t fmt);
+void     bench_report(bench_format_t fmt, const bench_result_t *r);
+void     bench_report_end(bench_format_t fmt);
+
+#endif
@@ -1,215 +1,563 @@
+#define _GNU_SOURCE
 #include <alloca.h>
 #include <math.h>
+#include <signal.h>
 #include <getopt.h>
-#define __USE_XOPEN2K
 #include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include "mcs-lock.h"
 #include "spinlock.h"
+#include "cohort-lock.h"
+#include "lock-bench.h"
+
+/*
+ *  Each thread loops: acquire, critical section, release, think.  The
+ *  critical section bumps total_sum twice with cs_len units of work on
+ *  shared data in between, so a thread that sees an odd total has
+ *  caught another thread inside the critical section.  Think time is
+ *  think units of thread-local work.
+ *
+ *  With -x, the critical section also records which thread and socket
+ *  last held the lock, and each result reports how many acquisitions
+ *  moved the lock to another thread and how many moved it to another
+ *  socket.  Compare "-l mcs,cohort -x" on a multi-socket machine.
+ *
+ *  With -i usec, each lock is run twice: once plain and once with a
+ *  SIGPROF itimer firing every usec of CPU time.  The handler does what
+ *  a profiler's sample handler must do: trylock, and drop the sample if
+ *  the lock is busy, e.g. because the interrupted thread holds it.  The
+ *  results report samples taken and dropped, handler latency, and the
+ *  throughput lost against the plain run.
+ */
+
+typedef struct {
+  int index;
+  int socket;
+  long ops;
+  long odds;
+  long samples;
+  long dropped;
+  bench_hist_t hist;
+  bench_hist_t shist;
+} thread_data_t;
+
+typedef struct {
+  const char *name;
+  const char *msg;
+  void (*init)(void);
+  void (*fini)(void);
+  void *(*test)(void *);
+  int (*sample)(void);
+} lock_test_t;
 
 static volatile int finished;
-static volatile int total_sum;
-static int *thread_sum;
-static int *thread_odds;
+static volatile long total_sum;
+static volatile long cs_data[8];
+static thread_data_t *thread_data;
 static pthread_barrier_t barrier;
 static pthread_mutex_t mutex;
 static pthread_spinlock_t spinlock;
 static mcs_lock_t m_c_s_lock;
 static spinlock_t spin_lock;
+static cohort_lock_t c_lock;
 
-static void *
-sync_add_test(void *ndx)
+static long sample_usec = 0;
+static lock_test_t *sample_test;
+static __thread thread_data_t *my_td;
+
+static int handoff_mode = 0;
+static int last_thread;
+static int last_socket;
+static long handoffs;
+static long cross_socket;
+
+static long cs_len = 0;
+static long think = 0;
+static pin_policy_t pin = PIN_NONE;
+static bench_format_t format = FORMAT_TEXT;
+
+static void
+thread_begin(thread_data_t *td)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
+  bench_pin_self(bench_thread_cpu(td->index, pin));
+  td->socket = bench_current_socket();
+  td->samples = 0;
+  td->dropped = 0;
+  bench_hist_init(&td->hist);
+  bench_hist_init(&td->shist);
+  my_td = td;
   pthread_barrier_wait(&barrier);
+}
+
+/*
+ *  Called with the lock held.  Unpinned threads may migrate, so look
+ *  up their socket each time.
+ */
+static inline void
+record_handoff(thread_data_t *td)
+{
+  int socket = (pin == PIN_NONE) ? bench_current_socket() : td->socket;
+  if (last_thread != td->index) {
+    if (last_thread >= 0)
+      handoffs++;
+    if (last_socket >= 0 && last_socket != socket)
+      cross_socket++;
+    last_thread = td->index;
+  }
+  last_socket = socket;
+}
+
+static inline void
+critical_section(thread_data_t *td, long *num_odds)
+{
+  long i;
+  if (handoff_mode)
+    record_handoff(td);
+  if (total_sum & 1)
+    ++*num_odds;
+  ++total_sum;
+  for (i = 0; i < cs_len; i++)
+    cs_data[i & 7]++;
+  ++total_sum;
+}
+
+static void *
+sync_add_test(void *arg)
+{
+  thread_data_t *td = arg;
+  long sum = 0;
+  long num_odds = 0;
+  thread_begin(td);
   while (!finished) {
     if (total_sum & 1)
       ++num_odds;
+    uint64_t t0 = bench_cycles();
     __sync_add_and_fetch(&total_sum, 2);
+    bench_hist_add(&td->hist, bench_cycles() - t0);
     ++sum;
+    bench_work(think);
   }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
+  td->ops = sum;
+  td->odds = num_odds;
   return NULL;
 }
 
 static void *
-pthread_mutex_test(void *ndx)
+pthread_mutex_test(void *arg)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
+  thread_data_t *td = arg;
+  long sum = 0;
+  long num_odds = 0;
+  thread_begin(td);
   while (!finished) {
+    uint64_t t0 = bench_cycles();
     pthread_mutex_lock(&mutex);
-    if (total_sum & 1)
-      ++num_odds;
-    ++total_sum;
-    ++total_sum;
+    bench_hist_add(&td->hist, bench_cycles() - t0);
+    critical_section(td, &num_odds);
     pthread_mutex_unlock(&mutex);
     ++sum;
+    bench_work(think);
   }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
+  td->ops = sum;
+  td->odds = num_odds;
   return NULL;
 }
 
 static void *
-pthread_spin_test(void *ndx)
+pthread_spin_test(void *arg)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
+  thread_data_t *td = arg;
+  long sum = 0;
+  long num_odds = 0;
+  thread_begin(td);
   while (!finished) {
+    uint64_t t0 = bench_cycles();
     pthread_spin_lock(&spinlock);
-    if (total_sum & 1)
-      ++num_odds;
-    ++total_sum;
-    ++total_sum;
+    bench_hist_add(&td->hist, bench_cycles() - t0);
+    critical_section(td, &num_odds);
     pthread_spin_unlock(&spinlock);
     ++sum;
+    bench_work(think);
   }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
+  td->ops = sum;
+  td->odds = num_odds;
   return NULL;
 }
 
 static void *
-pthread_mcs_test(void *ndx)
+pthread_mcs_test(void *arg)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
+  thread_data_t *td = arg;
+  long sum = 0;
+  long num_odds = 0;
+  thread_begin(td);
   while (!finished) {
     mcs_node_t me;
+    uint64_t t0 = bench_cycles();
     mcs_lock(&m_c_s_lock, &me);
-    if (total_sum & 1)
-      ++num_odds;
-    ++total_sum;
-    ++total_sum;
+    bench_hist_add(&td->hist, bench_cycles() - t0);
+    critical_section(td, &num_odds);
     mcs_unlock(&m_c_s_lock, &me);
     ++sum;
+    bench_work(think);
   }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
+  td->ops = sum;
+  td->odds = num_odds;
   return NULL;
 }
 
 static void *
-our_spinlock_test(void *ndx)
+our_spinlock_test(void *arg)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
+  thread_data_t *td = arg;
+  long sum = 0;
+  long num_odds = 0;
+  thread_begin(td);
   while (!finished) {
+    uint64_t t0 = bench_cycles();
     spinlock_lock(&spin_lock);
-    if (total_sum & 1)
-      ++num_odds;
-    ++total_sum;
-    ++total_sum;
+    bench_hist_add(&td->hist, bench_cycles() - t0);
+    critical_section(td, &num_odds);
     spinlock_unlock(&spin_lock);
     ++sum;
+    bench_work(think);
+  }
+  td->ops = sum;
+  td->odds = num_odds;
+  return NULL;
+}
+
+static void *
+cohort_test(void *arg)
+{
+  thread_data_t *td = arg;
+  long sum = 0;
+  long num_odds = 0;
+  thread_begin(td);
+  while (!finished) {
+    cohort_node_t me;
+    uint64_t t0 = bench_cycles();
+    cohort_lock(&c_lock, &me);
+    bench_hist_add(&td->hist, bench_cycles() - t0);
+    critical_section(td, &num_odds);
+    cohort_unlock(&c_lock, &me);
+    ++sum;
+    bench_work(think);
   }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
+  td->ops = sum;
+  td->odds = num_odds;
   return NULL;
 }
 
+/*
+ *  Sample handler bodies: take the lock only if it is free, bump
+ *  total_sum under it, and report whether the sample was taken.
+ */
+static inline void
+sample_section(void)
+{
+  ++total_sum;
+  ++total_sum;
+}
+
+static int
+sync_add_sample(void)
+{
+  __sync_add_and_fetch(&total_sum, 2);
+  return 1;
+}
+
+static int
+mutex_sample(void)
+{
+  if (pthread_mutex_trylock(&mutex) != 0)
+    return 0;
+  sample_section();
+  pthread_mutex_unlock(&mutex);
+  return 1;
+}
+
+static int
+pspin_sample(void)
+{
+  if (pthread_spin_trylock(&spinlock) != 0)
+    return 0;
+  sample_section();
+  pthread_spin_unlock(&spinlock);
+  return 1;
+}
+
+static int
+mcs_sample(void)
+{
+  mcs_node_t me;
+  if (!mcs_trylock(&m_c_s_lock, &me))
+    return 0;
+  sample_section();
+  mcs_unlock(&m_c_s_lock, &me);
+  return 1;
+}
+
+static int
+our_spin_sample(void)
+{
+  if (!spinlock_trylock(&spin_lock))
+    return 0;
+  sample_section();
+  spinlock_unlock(&spin_lock);
+  return 1;
+}
+
+static int
+cohort_sample(void)
+{
+  cohort_node_t me;
+  if (!cohort_trylock(&c_lock, &me))
+    return 0;
+  sample_section();
+  cohort_unlock(&c_lock, &me);
+  return 1;
+}
+
 static void
-addtest(int num_secs, int num_threads, const char msg[], void *(*adder)(void *))
+sample_handler(int sig)
+{
+  thread_data_t *td = my_td;
+  if (td == NULL)
+    return;
+  uint64_t t0 = bench_cycles();
+  td->samples++;
+  if (!sample_test->sample())
+    td->dropped++;
+  bench_hist_add(&td->shist, bench_cycles() - t0);
+}
+
+static void mutex_init(void)   { pthread_mutex_init(&mutex, NULL); }
+static void mutex_fini(void)   { pthread_mutex_destroy(&mutex); }
+static void pspin_init(void)   { pthread_spin_init(&spinlock, PTHREAD_PROCESS_PRIVATE); }
+static void pspin_fini(void)   { pthread_spin_destroy(&spinlock); }
+static void mcs_lock_init(void) { mcs_init(&m_c_s_lock); }
+static void our_spin_init(void) { spinlock_init(&spin_lock); }
+static void cohort_lock_init(void) { cohort_init(&c_lock); }
+
+static lock_test_t lock_tests[] = {
+  { "sync_add", "Results for sync_add test:", NULL, NULL, sync_add_test,
+    sync_add_sample },
+  { "mutex", "Results for pthread_mutex test", mutex_init, mutex_fini, pthread_mutex_test,
+    mutex_sample },
+  { "spin", "Results for pthread_spin_lock test", pspin_init, pspin_fini, pthread_spin_test,
+    pspin_sample },
+  { "mcs", "Results for pthread_mcs test", mcs_lock_init, NULL, pthread_mcs_test,
+    mcs_sample },
+  { "spinlock", "Results for our spinlock test", our_spin_init, NULL, our_spinlock_test,
+    our_spin_sample },
+  { "cohort", "Results for cohort lock test", cohort_lock_init, NULL, cohort_test,
+    cohort_sample },
+  { NULL, NULL, NULL, NULL, NULL, NULL },
+};
+
+/*
+ *  Run lt on num_threads threads for num_secs, with the sampler on if
+ *  sampling.  Returns: elapsed seconds.
+ */
+static double
+run_threads(int num_secs, int num_threads, lock_test_t *lt, int sampling)
 {
   int i;
-  int maxOps = 0, minOps = INT_MAX;
-  double meanOps = 0., dMeanOps = 0., varOps = 0., dVarOps = 0.;
   pthread_t *adder_thread = alloca(num_threads * sizeof(adder_thread[0]));
-  int *tsums = alloca(num_threads * sizeof(tsums[0]));
-  thread_sum = &tsums[0];
-  int *todds = alloca(num_threads * sizeof(todds[0]));
-  thread_odds = todds;
+  struct timespec t0, t1;
 
   finished = 0;
   total_sum = 0;
+  last_thread = -1;
+  last_socket = -1;
+  handoffs = 0;
+  cross_socket = 0;
   for (i = 0; i < num_threads; ++i) {
-    if (0 != pthread_create(&adder_thread[i], NULL, adder, (void *)(intptr_t)i)) {
+    thread_data[i].index = i;
+    if (0 != pthread_create(&adder_thread[i], NULL, lt->test, &thread_data[i])) {
       fprintf(stderr, "Error creating thread %d\n", i);
       exit(-1);
     }
   }
 
   pthread_barrier_wait(&barrier);
+  if (sampling) {
+    sample_test = lt;
+    bench_sampler_start(sample_usec, sample_handler);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
   sleep(num_secs);
   finished = 1;
 
-  puts(msg);
   for (i = 0; i < num_threads; ++i) {
     if (0 != pthread_join(adder_thread[i], NULL)) {
       fprintf(stderr, "Error finishing thread %d\n", i);
       exit(-1);
     }
-    printf("ops, odds counts for reader thread %d: %d %d\n", i, thread_sum[i], thread_odds[i]);
-    if (thread_sum[i] > maxOps)
-      maxOps = thread_sum[i];
-    if (thread_sum[i] < minOps)
-      minOps = thread_sum[i];
-
-    /* update avg, variance */ {
-      double oldMean = meanOps;
-      double oldVar = varOps;
-      double d = ((thread_sum[i] - meanOps) - dMeanOps) / (i + 1);
-      double t = d + dMeanOps;
-      meanOps = oldMean + t;
-      dMeanOps = (oldMean - meanOps) + t;
-      d = ((d*d*(i*(i+1)) - varOps) - dVarOps) / (i + 1);
-      t = d + dVarOps;
-      varOps = oldVar + t;
-      dVarOps = (oldVar - varOps) + t;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (sampling)
+    bench_sampler_stop();
+
+  return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void
+addtest(int num_secs, int num_threads, lock_test_t *lt)
+{
+  int i;
+  long *ops = alloca(num_threads * sizeof(ops[0]));
+  bench_hist_t *hist = malloc(sizeof(bench_hist_t));
+  bench_hist_t *shist = NULL;
+  bench_result_t result;
+  double base_rate = 0.0;
+  double secs;
+  long samples = 0, dropped = 0;
+
+  if (sample_usec > 0) {
+    long base_ops = 0;
+    secs = run_threads(num_secs, num_threads, lt, 0);
+    for (i = 0; i < num_threads; ++i)
+      base_ops += thread_data[i].ops;
+    base_rate = base_ops / secs;
+    if (lt->fini)
+      lt->fini();
+    if (lt->init)
+      lt->init();
+  }
+  secs = run_threads(num_secs, num_threads, lt, sample_usec > 0);
+
+  bench_hist_init(hist);
+  for (i = 0; i < num_threads; ++i) {
+    ops[i] = thread_data[i].ops;
+    bench_hist_merge(hist, &thread_data[i].hist);
+  }
+
+  bench_result_init(&result, "lock-test", lt->name, "all");
+  bench_summarize(&result, ops, num_threads);
+  result.cs_len = cs_len;
+  result.think = think;
+  result.pin = pin;
+  result.secs = secs;
+  result.hist = hist;
+  if (handoff_mode) {
+    bench_result_extra(&result, "handoffs", handoffs);
+    bench_result_extra(&result, "cross_socket", cross_socket);
+    bench_result_extra(&result, "cross_socket_pct",
+		       handoffs ? 100.0 * cross_socket / handoffs : 0.0);
+  }
+  if (sample_usec > 0) {
+    shist = malloc(sizeof(bench_hist_t));
+    bench_hist_init(shist);
+    for (i = 0; i < num_threads; ++i) {
+      samples += thread_data[i].samples;
+      dropped += thread_data[i].dropped;
+      bench_hist_merge(shist, &thread_data[i].shist);
     }
+    bench_result_extra(&result, "samples", samples);
+    bench_result_extra(&result, "dropped", dropped);
+    bench_result_extra(&result, "dropped_pct",
+		       samples ? 100.0 * dropped / samples : 0.0);
+    bench_result_extra(&result, "handler_p99_ns",
+		       bench_cycles_to_ns(bench_hist_percentile(shist, 0.99)));
+    bench_result_extra(&result, "handler_max_ns", bench_cycles_to_ns(shist->max));
+    bench_result_extra(&result, "tput_loss_pct", base_rate > 0.0 ?
+		       100.0 * (1.0 - result.total_ops / secs / base_rate) : 0.0);
+  }
+
+  if (format == FORMAT_TEXT) {
+    puts(lt->msg);
+    for (i = 0; i < num_threads; ++i)
+      printf("ops, odds counts for reader thread %d: %ld %ld\n", i,
+	     thread_data[i].ops, thread_data[i].odds);
+    printf("min ops: %ld\n", result.min_ops);
+    printf("max ops: %ld\n", result.max_ops);
+    printf("avg ops: %10.5f\n", result.mean_ops);
+    printf("stddev ops: %10.5f\n", result.stddev_ops);
+    printf("total ops: %ld\n", total_sum / 2);
+    if (handoff_mode)
+      printf("handoffs: %ld  cross-socket: %ld  (%d sockets)\n",
+	     handoffs, cross_socket, bench_num_sockets());
+    if (sample_usec > 0)
+      printf("samples: %ld  dropped: %ld  unsampled ops/sec: %.0f\n",
+	     samples, dropped, base_rate);
   }
-  printf("min ops: %d\n", minOps);
-  printf("max ops: %d\n", maxOps);
-  printf("avg ops: %10.5f\n", meanOps);
-  printf("stddev ops: %10.5f\n", sqrt(varOps/(num_threads - 1)));
-  printf("total ops: %d\n", total_sum / 2);
+  bench_report(format, &result);
+  free(shist);
+  free(hist);
 }
 
 static int
-compute(int num_secs, int num_threads)
+selected(const char *locks, const char *name)
 {
-  pthread_barrier_init(&barrier, NULL, num_threads+1);
-  addtest(num_secs, num_threads, "Results for sync_add test:", sync_add_test);
+  char buf[200];
+  char *tok, *save;
 
-  pthread_mutex_init(&mutex, NULL);
-  addtest(num_secs, num_threads, "Results for pthread_mutex test", pthread_mutex_test);
-  pthread_mutex_destroy(&mutex);
+  if (locks == NULL)
+    return 1;
+  strncpy(buf, locks, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if (strcmp(tok, name) == 0)
+      return 1;
+  }
+  return 0;
+}
 
-  pthread_spin_init(&spinlock, PTHREAD_PROCESS_PRIVATE);
-  addtest(num_secs, num_threads, "Results for pthread_spin_lock test", pthread_spin_test);
-  pthread_spin_destroy(&spinlock);
+static int
+compute(int num_secs, int num_threads, const char *locks)
+{
+  lock_test_t *lt;
 
-  mcs_init(&m_c_s_lock);
-  addtest(num_secs, num_threads, "Results for pthread_mcs test", pthread_mcs_test);
+  thread_data = calloc(num_threads, sizeof(thread_data_t));
+  pthread_barrier_init(&barrier, NULL, num_threads+1);
+  bench_report_begin(format);
 
-  spinlock_init(&spin_lock);
-  addtest(num_secs, num_threads, "Results for our spinlock test", our_spinlock_test);
+  for (lt = lock_tests; lt->name != NULL; lt++) {
+    if (!selected(locks, lt->name))
+      continue;
+    if (lt->init)
+      lt->init();
+    addtest(num_secs, num_threads, lt);
+    if (lt->fini)
+      lt->fini();
+  }
 
+  bench_report_end(format);
   pthread_barrier_destroy(&barrier);
+  free(thread_data);
   return 0;
 }
 
+static void
+usage(void)
+{
+  lock_test_t *lt;
+  fprintf(stderr, "Usage: <cmd> [-s num_seconds] [-t num_threads] [-c cs_len] [-w think]\n"
+	  "       [-p none|compact|scatter] [-f text|csv|json] [-l lock,...] [-x]\n"
+	  "       [-i usec]\n"
+	  "  -x  count lock handoffs between threads and between sockets\n"
+	  "  -i  also run with a SIGPROF handler every usec that trylocks the\n"
+	  "      same lock and drops the sample if it is busy\n"
+	  "locks:");
+  for (lt = lock_tests; lt->name != NULL; lt++)
+    fprintf(stderr, " %s", lt->name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
 int main(int argc, char *argv[])
 {
   int num_secs = 10;
   int num_threads = 2;
+  const char *locks = NULL;
   int ch;
-  while ((ch = getopt(argc, argv, "s:t:")) != -1) {
+  while ((ch = getopt(argc, argv, "s:t:c:w:p:f:l:xi:")) != -1) {
     switch (ch) {
     case 's':
       num_secs = atoi(optarg);
@@ -217,10 +565,34 @@ int main(int argc, char *argv[])
     case 't':
       num_threads = atoi(optarg);
       break;
+    case 'c':
+      cs_len = atol(optarg);
+      break;
+    case 'w':
+      think = atol(optarg);
+      break;
+    case 'p':
+      if (bench_parse_pin(optarg, &pin) != 0)
+	usage();
+      break;
+    case 'f':
+      if (bench_parse_format(optarg, &format) != 0)
+	usage();
+      break;
+    case 'l':
+      locks = optarg;
+      break;
+    case 'x':
+      handoff_mode = 1;
+      break;
+    case 'i':
+      sample_usec = atol(optarg);
+      break;
     default:
-      fprintf(stderr, "Usage: <cmd> [-s num_seconds] [-t num_threads]\n");
-      exit(1);
+      usage();
     }
   }
-  return compute(num_secs, num_threads);
+  if (num_threads < 1)
+    usage();
+  return compute(num_secs, num_threads, locks);
 }
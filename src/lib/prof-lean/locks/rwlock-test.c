@@ -1,187 +1,389 @@
+#define _GNU_SOURCE
 #include <alloca.h>
 #include <math.h>
 #include <getopt.h>
-#define __USE_XOPEN2K
 #include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include "pfq-rwlock.h"
+#include "bigreader-rwlock.h"
+#include "lock-bench.h"
+
+/*
+ *  Default mode: num_readers threads only read and num_writers threads
+ *  only write, for each lock in turn.
+ *
+ *  Sweep mode (-S pct,...): every thread mixes reads and writes, writing
+ *  with the given probability, and each lock is run at each write
+ *  percentage so the crossover points between the designs show up in
+ *  one table.
+ *
+ *  Each acquire is timed with the cycle counter, and read and write
+ *  acquires go into separate histograms.  So a result shows, for
+ *  example, how long a dlopen-like writer waits behind a flood of
+ *  readers (the writers' p99 and max), apart from the readers' cost.
+ *
+ *  With -i usec (default mode only), each lock is run plain and then
+ *  with a SIGPROF itimer every usec of CPU time whose handler takes the
+ *  read side, as a sample handler looking up a load module would.  The
+ *  handler drops the sample if its thread was interrupted inside or
+ *  waiting for the lock, and otherwise uses a read trylock where the
+ *  lock has one (pthread, bigreader) and drops on failure; pfq has no
+ *  trylock, so its handler waits.  Both rows then report samples,
+ *  drops, handler latency and throughput lost against the plain run.
+ */
+
+typedef struct {
+  int index;
+  uint32_t write_thresh;
+  uint32_t seed;
+  long ops;
+  long odds;
+  long writes;
+  long samples;
+  long dropped;
+  volatile int in_lock;
+  bench_hist_t rhist;
+  bench_hist_t whist;
+  bench_hist_t shist;
+} thread_data_t;
+
+typedef struct {
+  const char *name;
+  const char *msg;
+  void (*init)(void);
+  void (*fini)(void);
+  void *(*reader)(void *);
+  void *(*writer)(void *);
+  void *(*mixed)(void *);
+  int (*sample)(void);
+} rwlock_test_t;
 
 static volatile int finished;
 static volatile unsigned long int total_sum;
-static int *thread_sum;
-static int *thread_odds;
+static thread_data_t *thread_data;
 static pthread_barrier_t barrier;
 static pthread_rwlock_t rw_lock;
 static pfq_rwlock_t pfq_lock;
+static bigreader_rwlock_t br_lock;
+
+static double run_secs;
+static pin_policy_t pin = PIN_NONE;
+static bench_format_t format = FORMAT_TEXT;
+
+static long sample_usec = 0;
+static rwlock_test_t *sample_test;
+static __thread thread_data_t *my_td;
+static long samples, dropped;
+static double base_rate, sampled_rate;
+static bench_hist_t *shist;
+
+static inline uint32_t
+next_random(uint32_t *seed)
+{
+  uint32_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *seed = x;
+}
 
-static void *
-pthread_rwlock_reader(void *ndx)
+static void
+thread_begin(thread_data_t *td)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
+  bench_pin_self(bench_thread_cpu(td->index, pin));
+  td->samples = 0;
+  td->dropped = 0;
+  td->in_lock = 0;
+  bench_hist_init(&td->rhist);
+  bench_hist_init(&td->whist);
+  bench_hist_init(&td->shist);
+  my_td = td;
   pthread_barrier_wait(&barrier);
-  while (!finished) {
-    pthread_rwlock_rdlock(&rw_lock);
-    if (total_sum & 1)
-      ++num_odds;
-    pthread_rwlock_unlock(&rw_lock);
-    ++sum;
-  }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
-  return NULL;
 }
 
+/*
+ *  Uniform wrappers so that one set of thread bodies serves every lock.
+ *  All queue-based writers use an mcs_node_t; pthread ignores it.
+ */
+static inline void prw_read_lock(void) { pthread_rwlock_rdlock(&rw_lock); }
+static inline void prw_read_unlock(void) { pthread_rwlock_unlock(&rw_lock); }
+static inline void prw_write_lock(mcs_node_t *me) { pthread_rwlock_wrlock(&rw_lock); }
+static inline void prw_write_unlock(mcs_node_t *me) { pthread_rwlock_unlock(&rw_lock); }
+
+static inline void pfq_read_lock(void) { pfq_rwlock_read_lock(&pfq_lock); }
+static inline void pfq_read_unlock(void) { pfq_rwlock_read_unlock(&pfq_lock); }
+static inline void pfq_write_lock(mcs_node_t *me) { pfq_rwlock_write_lock(&pfq_lock, me); }
+static inline void pfq_write_unlock(mcs_node_t *me) { pfq_rwlock_write_unlock(&pfq_lock, me); }
+
+static inline void br_read_lock(void) { bigreader_rwlock_read_lock(&br_lock); }
+static inline void br_read_unlock(void) { bigreader_rwlock_read_unlock(&br_lock); }
+static inline void br_write_lock(mcs_node_t *me) { bigreader_rwlock_write_lock(&br_lock, me); }
+static inline void br_write_unlock(mcs_node_t *me) { bigreader_rwlock_write_unlock(&br_lock, me); }
+
+#define READ_SECTION(lk, td, num_odds)				\
+  do {								\
+    td->in_lock = 1;						\
+    uint64_t t0 = bench_cycles();				\
+    lk##_read_lock();						\
+    bench_hist_add(&td->rhist, bench_cycles() - t0);		\
+    if (total_sum & 1)						\
+      ++num_odds;						\
+    lk##_read_unlock();						\
+    td->in_lock = 0;						\
+  } while (0)
+
+#define WRITE_SECTION(lk, td, num_odds)				\
+  do {								\
+    mcs_node_t me;						\
+    td->in_lock = 1;						\
+    uint64_t t0 = bench_cycles();				\
+    lk##_write_lock(&me);					\
+    bench_hist_add(&td->whist, bench_cycles() - t0);		\
+    if (total_sum & 1)						\
+      ++num_odds;						\
+    ++total_sum;						\
+    ++total_sum;						\
+    lk##_write_unlock(&me);					\
+    td->in_lock = 0;						\
+  } while (0)
+
+#define RWLOCK_THREADS(lk)					\
+static void *							\
+lk##_reader(void *arg)						\
+{								\
+  thread_data_t *td = arg;					\
+  long sum = 0;							\
+  long num_odds = 0;						\
+  thread_begin(td);						\
+  while (!finished) {						\
+    READ_SECTION(lk, td, num_odds);				\
+    ++sum;							\
+  }								\
+  td->ops = sum;						\
+  td->odds = num_odds;						\
+  return NULL;							\
+}								\
+								\
+static void *							\
+lk##_writer(void *arg)						\
+{								\
+  thread_data_t *td = arg;					\
+  long sum = 0;							\
+  long num_odds = 0;						\
+  thread_begin(td);						\
+  while (!finished) {						\
+    WRITE_SECTION(lk, td, num_odds);				\
+    ++sum;							\
+  }								\
+  td->ops = sum;						\
+  td->odds = num_odds;						\
+  td->writes = sum;						\
+  return NULL;							\
+}								\
+								\
+static void *							\
+lk##_mixed(void *arg)						\
+{								\
+  thread_data_t *td = arg;					\
+  long sum = 0;							\
+  long writes = 0;						\
+  long num_odds = 0;						\
+  thread_begin(td);						\
+  while (!finished) {						\
+    if (next_random(&td->seed) < td->write_thresh) {		\
+      WRITE_SECTION(lk, td, num_odds);				\
+      ++writes;							\
+    }								\
+    else							\
+      READ_SECTION(lk, td, num_odds);				\
+    ++sum;							\
+  }								\
+  td->ops = sum;						\
+  td->odds = num_odds;						\
+  td->writes = writes;						\
+  return NULL;							\
+}
+
+RWLOCK_THREADS(prw)
+RWLOCK_THREADS(pfq)
+RWLOCK_THREADS(br)
+
+static void prw_init(void) { pthread_rwlock_init(&rw_lock, NULL); }
+static void prw_fini(void) { pthread_rwlock_destroy(&rw_lock); }
+static void pfq_init(void) { pfq_rwlock_init(&pfq_lock); }
+static void br_init(void) { bigreader_rwlock_init(&br_lock); }
 
-static void *
-pthread_rwlock_writer(void *ndx)
+/*
+ *  Sample handler bodies: read total_sum under the read side.  Returns
+ *  0 if the sample was dropped.
+ */
+static int
+prw_sample(void)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
-  while (!finished) {
-    pthread_rwlock_wrlock(&rw_lock);
-    if (total_sum & 1)
-      ++num_odds;
-    ++total_sum;
-    ++total_sum;
-    pthread_rwlock_unlock(&rw_lock);
-    ++sum;
-  }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
-  return NULL;
-}
-
-static void *
-pthread_pfq_reader(void *ndx)
+  if (pthread_rwlock_tryrdlock(&rw_lock) != 0)
+    return 0;
+  (void) total_sum;
+  pthread_rwlock_unlock(&rw_lock);
+  return 1;
+}
+
+static int
+pfq_sample(void)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
-  while (!finished) {
-    pfq_rwlock_read_lock(&pfq_lock);
-    if (total_sum & 1)
-      ++num_odds;
-    pfq_rwlock_read_unlock(&pfq_lock);
-    ++sum;
-  }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
-  return NULL;
+  pfq_rwlock_read_lock(&pfq_lock);
+  (void) total_sum;
+  pfq_rwlock_read_unlock(&pfq_lock);
+  return 1;
 }
 
+static int
+br_sample(void)
+{
+  if (!bigreader_rwlock_read_trylock(&br_lock))
+    return 0;
+  (void) total_sum;
+  bigreader_rwlock_read_unlock(&br_lock);
+  return 1;
+}
 
-static void *
-pthread_pfq_writer(void *ndx)
+static void
+sample_handler(int sig)
 {
-  int i = (int)(intptr_t)ndx;
-  int sum = 0;
-  int num_odds = 0;
-  pthread_barrier_wait(&barrier);
-  while (!finished) {
-    pfq_rwlock_node_t me;
-    pfq_rwlock_write_lock(&pfq_lock, &me);
-    if (total_sum & 1)
-      ++num_odds;
-    ++total_sum;
-    ++total_sum;
-    pfq_rwlock_write_unlock(&pfq_lock, &me);
-    ++sum;
-  }
-  thread_sum[i] = sum;
-  thread_odds[i] = num_odds;
-  return NULL;
+  thread_data_t *td = my_td;
+  if (td == NULL)
+    return;
+  uint64_t t0 = bench_cycles();
+  td->samples++;
+  if (td->in_lock || !sample_test->sample())
+    td->dropped++;
+  bench_hist_add(&td->shist, bench_cycles() - t0);
 }
 
+static rwlock_test_t rwlock_tests[] = {
+  { "pthread", "Results for pthread_rwlock test", prw_init, prw_fini,
+    prw_reader, prw_writer, prw_mixed, prw_sample },
+  { "pfq", "Results for pthread_pfq test", pfq_init, NULL,
+    pfq_reader, pfq_writer, pfq_mixed, pfq_sample },
+  { "bigreader", "Results for bigreader_rwlock test", br_init, NULL,
+    br_reader, br_writer, br_mixed, br_sample },
+  { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL },
+};
+
+/*
+ *  Start one thread per entry of roles ('r', 'w' or 'm'), run for
+ *  num_secs, with the sampler on if sampling, and join them.
+ */
 static void
-addtest(int num_secs, int num_readers, int num_writers, const char msg[], void *(*reader)(void *), void *(*writer)(void *))
+run_threads(int num_secs, int num_threads, const char *roles, rwlock_test_t *rt,
+	    int sampling)
 {
   int i;
-  int maxOps = 0, minOps = INT_MAX;
-  double meanOps = 0., dMeanOps = 0., varOps = 0., dVarOps = 0.;
-  pthread_t *thread = alloca((num_readers+num_writers) * sizeof(thread[0]));
-  int *tsums = alloca((num_readers+num_writers) * sizeof(tsums[0]));
-  thread_sum = &tsums[0];
-  int *todds = alloca((num_readers+num_writers) * sizeof(todds[0]));
-  thread_odds = todds;
+  pthread_t *thread = alloca(num_threads * sizeof(thread[0]));
+  struct timespec t0, t1;
 
   finished = 0;
   total_sum = 0;
-  for (i = 0; i < num_readers; ++i) {
-    if (0 != pthread_create(&thread[i], NULL, reader, (void *)(intptr_t)i)) {
-      fprintf(stderr, "Error creating reader thread %d\n", i);
-      exit(-1);
-    }
-  }
-  for (i = 0; i < num_writers; ++i) {
-    if (0 != pthread_create(&thread[num_readers+i], NULL, writer, (void *)(intptr_t)(num_readers+i))) {
-      fprintf(stderr, "Error creating writer thread %d\n", i);
+  for (i = 0; i < num_threads; ++i) {
+    void *(*fn)(void *) =
+      (roles[i] == 'r') ? rt->reader : (roles[i] == 'w') ? rt->writer : rt->mixed;
+    thread_data[i].index = i;
+    thread_data[i].ops = 0;
+    thread_data[i].odds = 0;
+    thread_data[i].writes = 0;
+    if (0 != pthread_create(&thread[i], NULL, fn, &thread_data[i])) {
+      fprintf(stderr, "Error creating thread %d\n", i);
       exit(-1);
     }
   }
 
   pthread_barrier_wait(&barrier);
+  if (sampling) {
+    sample_test = rt;
+    bench_sampler_start(sample_usec, sample_handler);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t0);
   sleep(num_secs);
   finished = 1;
 
-  puts(msg);
-  printf("Readers:\n");
-  for (i = 0; i < num_readers + num_writers; ++i) {
+  for (i = 0; i < num_threads; ++i) {
     if (0 != pthread_join(thread[i], NULL)) {
       fprintf(stderr, "Error finishing thread %d\n", i);
       exit(-1);
     }
   }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  if (sampling)
+    bench_sampler_stop();
+  run_secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
 
-  maxOps = 0, minOps = INT_MAX;
-  meanOps = 0., dMeanOps = 0., varOps = 0., dVarOps = 0.;
-  for (i = 0; i < num_readers; ++i) {
-    printf("ops, odds counts for reader thread %d: %d %d\n", i, thread_sum[i], thread_odds[i]);
-    if (thread_sum[i] > maxOps)
-      maxOps = thread_sum[i];
-    if (thread_sum[i] < minOps)
-      minOps = thread_sum[i];
+/*
+ *  Report the reads or the writes of threads [first, first+n) as one
+ *  result row.
+ */
+static void
+report_role(rwlock_test_t *rt, const char *role, int first, int n,
+	    int writes, double write_pct)
+{
+  int i;
+  long *ops = alloca((n > 0 ? n : 1) * sizeof(ops[0]));
+  bench_hist_t *hist = malloc(sizeof(bench_hist_t));
+  bench_result_t result;
 
-    /* update avg, variance */ {
-      double oldMean = meanOps;
-      double oldVar = varOps;
-      double d = ((thread_sum[i] - meanOps) - dMeanOps) / (i + 1);
-      double t = d + dMeanOps;
-      meanOps = oldMean + t;
-      dMeanOps = (oldMean - meanOps) + t;
-      d = ((d*d*(i*(i+1)) - varOps) - dVarOps) / (i + 1);
-      t = d + dVarOps;
-      varOps = oldVar + t;
-      dVarOps = (oldVar - varOps) + t;
-    }
+  bench_hist_init(hist);
+  for (i = 0; i < n; ++i) {
+    thread_data_t *td = &thread_data[first+i];
+    ops[i] = writes ? td->writes : td->ops - td->writes;
+    bench_hist_merge(hist, writes ? &td->whist : &td->rhist);
   }
-  printf("min ops: %d\n", minOps);
-  printf("max ops: %d\n", maxOps);
-  printf("avg ops: %10.5f\n", meanOps);
-  printf("stddev ops: %10.5f\n", sqrt(varOps/(num_readers - 1)));
-
-  printf("Writers:\n");
-  maxOps = 0, minOps = INT_MAX;
-  meanOps = 0., dMeanOps = 0., varOps = 0., dVarOps = 0.;
-  for (i = 0; i < num_writers; ++i) {
-    printf("ops, odds counts for writer thread %d: %d %d\n", i,
-	   thread_sum[num_readers+i], thread_odds[num_readers+i]);
-    if (thread_sum[i] > maxOps)
-      maxOps = thread_sum[i];
-    if (thread_sum[i] < minOps)
-      minOps = thread_sum[i];
+
+  bench_result_init(&result, "rwlock-test", rt->name, role);
+  bench_summarize(&result, ops, n);
+  result.pin = pin;
+  result.secs = run_secs;
+  result.hist = hist;
+  bench_result_extra(&result, "write_pct", write_pct);
+  if (sample_usec > 0) {
+    bench_result_extra(&result, "samples", samples);
+    bench_result_extra(&result, "dropped", dropped);
+    bench_result_extra(&result, "dropped_pct",
+		       samples ? 100.0 * dropped / samples : 0.0);
+    bench_result_extra(&result, "handler_p99_ns",
+		       bench_cycles_to_ns(bench_hist_percentile(shist, 0.99)));
+    bench_result_extra(&result, "handler_max_ns", bench_cycles_to_ns(shist->max));
+    bench_result_extra(&result, "tput_loss_pct", base_rate > 0.0 ?
+		       100.0 * (1.0 - sampled_rate / base_rate) : 0.0);
+  }
+  bench_report(format, &result);
+  free(hist);
+}
+
+static void
+print_stats(const char *role, int first, int n)
+{
+  int i;
+  long maxOps = 0, minOps = LONG_MAX;
+  double meanOps = 0., dMeanOps = 0., varOps = 0., dVarOps = 0.;
+
+  for (i = 0; i < n; ++i) {
+    long ops = thread_data[first+i].ops;
+    printf("ops, odds counts for %s thread %d: %ld %ld\n", role, i, ops,
+	   thread_data[first+i].odds);
+    if (ops > maxOps)
+      maxOps = ops;
+    if (ops < minOps)
+      minOps = ops;
 
     /* update avg, variance */ {
       double oldMean = meanOps;
       double oldVar = varOps;
-      double d = ((thread_sum[i] - meanOps) - dMeanOps) / (i + 1);
+      double d = ((ops - meanOps) - dMeanOps) / (i + 1);
       double t = d + dMeanOps;
       meanOps = oldMean + t;
       dMeanOps = (oldMean - meanOps) + t;
@@ -191,36 +393,214 @@ addtest(int num_secs, int num_readers, int num_writers, const char msg[], void *
       dVarOps = (oldVar - varOps) + t;
     }
   }
-  printf("min ops: %d\n", minOps);
-  printf("max ops: %d\n", maxOps);
+  printf("min ops: %ld\n", (n > 0) ? minOps : 0);
+  printf("max ops: %ld\n", maxOps);
   printf("avg ops: %10.5f\n", meanOps);
-  printf("stddev ops: %10.5f\n", sqrt(varOps/(num_readers - 1)));
-  printf("total ops: %lu\n", total_sum / 2);
+  printf("stddev ops: %10.5f\n", (n > 1) ? sqrt(varOps/(n - 1)) : 0.);
+}
+
+static void
+addtest(int num_secs, int num_readers, int num_writers, rwlock_test_t *rt)
+{
+  int num_threads = num_readers + num_writers;
+  char *roles = alloca(num_threads);
+
+  memset(roles, 'r', num_readers);
+  memset(roles + num_readers, 'w', num_writers);
+
+  double write_pct = 0.;
+  long reads = 0, writes = 0;
+  int i;
+
+  if (sample_usec > 0) {
+    run_threads(num_secs, num_threads, roles, rt, 0);
+    for (i = 0; i < num_threads; ++i)
+      reads += thread_data[i].ops;
+    base_rate = reads / run_secs;
+    reads = 0;
+    if (rt->fini)
+      rt->fini();
+    if (rt->init)
+      rt->init();
+  }
+  run_threads(num_secs, num_threads, roles, rt, sample_usec > 0);
+
+  samples = 0;
+  dropped = 0;
+  if (sample_usec > 0) {
+    shist = malloc(sizeof(bench_hist_t));
+    bench_hist_init(shist);
+  }
+  for (i = 0; i < num_threads; ++i) {
+    reads += thread_data[i].ops - thread_data[i].writes;
+    writes += thread_data[i].writes;
+    samples += thread_data[i].samples;
+    dropped += thread_data[i].dropped;
+    if (shist)
+      bench_hist_merge(shist, &thread_data[i].shist);
+  }
+  if (reads + writes > 0)
+    write_pct = 100. * writes / (reads + writes);
+  sampled_rate = (reads + writes) / run_secs;
+
+  if (format == FORMAT_TEXT) {
+    puts(rt->msg);
+    printf("Readers:\n");
+    print_stats("reader", 0, num_readers);
+  }
+  if (num_readers > 0)
+    report_role(rt, "readers", 0, num_readers, 0, write_pct);
+  if (format == FORMAT_TEXT) {
+    printf("Writers:\n");
+    print_stats("writer", num_readers, num_writers);
+  }
+  if (num_writers > 0)
+    report_role(rt, "writers", num_readers, num_writers, 1, write_pct);
+  if (format == FORMAT_TEXT) {
+    printf("total ops: %lu\n", total_sum / 2);
+    if (sample_usec > 0)
+      printf("samples: %ld  dropped: %ld  unsampled ops/sec: %.0f\n",
+	     samples, dropped, base_rate);
+  }
+  free(shist);
+  shist = NULL;
+}
+
+static void
+sweeptest(int num_secs, int num_threads, double write_pct, rwlock_test_t *rt)
+{
+  int i;
+  long ops = 0, writes = 0;
+  char *roles = alloca(num_threads);
+
+  memset(roles, 'm', num_threads);
+  for (i = 0; i < num_threads; ++i) {
+    thread_data[i].write_thresh = (uint32_t) (write_pct / 100. * UINT32_MAX);
+    thread_data[i].seed = 2463534242u + 7919u * i;
+  }
+  run_threads(num_secs, num_threads, roles, rt, 0);
+
+  if (format != FORMAT_TEXT) {
+    report_role(rt, "readers", 0, num_threads, 0, write_pct);
+    report_role(rt, "writers", 0, num_threads, 1, write_pct);
+    return;
+  }
+
+  bench_hist_t *rhist = malloc(sizeof(bench_hist_t));
+  bench_hist_t *whist = malloc(sizeof(bench_hist_t));
+  bench_hist_init(rhist);
+  bench_hist_init(whist);
+  for (i = 0; i < num_threads; ++i) {
+    ops += thread_data[i].ops;
+    writes += thread_data[i].writes;
+    bench_hist_merge(rhist, &thread_data[i].rhist);
+    bench_hist_merge(whist, &thread_data[i].whist);
+  }
+  printf("%-10s %8g %8d %14.0f %14.0f %14.0f %10.0f %10.0f %12.0f\n",
+	 rt->name, write_pct, num_threads, ops / run_secs,
+	 (ops - writes) / run_secs, writes / run_secs,
+	 bench_cycles_to_ns(bench_hist_percentile(rhist, 0.99)),
+	 bench_cycles_to_ns(bench_hist_percentile(whist, 0.99)),
+	 bench_cycles_to_ns(whist->max));
+  free(rhist);
+  free(whist);
+}
+
+static int
+selected(const char *locks, const char *name)
+{
+  char buf[200];
+  char *tok, *save;
+
+  if (locks == NULL)
+    return 1;
+  strncpy(buf, locks, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if (strcmp(tok, name) == 0)
+      return 1;
+  }
+  return 0;
 }
 
 static int
-compute(int num_secs, int num_readers, int num_writers)
+compute(int num_secs, int num_readers, int num_writers, const char *locks,
+	const char *sweep)
 {
-  pthread_barrier_init(&barrier, NULL, num_readers+num_writers+1);
+  int num_threads = num_readers + num_writers;
+  rwlock_test_t *rt;
 
-  pthread_rwlock_init(&rw_lock, NULL);
-  addtest(num_secs, num_readers, num_writers, "Results for pthread_rwlock test", pthread_rwlock_reader, pthread_rwlock_writer);
-  pthread_rwlock_destroy(&rw_lock);
+  thread_data = calloc(num_threads, sizeof(thread_data_t));
+  pthread_barrier_init(&barrier, NULL, num_threads+1);
+  bench_report_begin(format);
 
-  pfq_rwlock_init(&pfq_lock);
-  addtest(num_secs, num_readers, num_writers, "Results for pthread_pfq test", pthread_pfq_reader, pthread_pfq_writer);
+  if (sweep != NULL) {
+    char buf[200];
+    char *tok, *save;
 
+    if (format == FORMAT_TEXT)
+      printf("%-10s %8s %8s %14s %14s %14s %10s %10s %12s\n", "lock", "write%",
+	     "threads", "ops/sec", "reads/sec", "writes/sec", "rd_p99_ns",
+	     "wr_p99_ns", "wr_max_ns");
+    strncpy(buf, sweep, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+      for (rt = rwlock_tests; rt->name != NULL; rt++) {
+	if (!selected(locks, rt->name))
+	  continue;
+	if (rt->init)
+	  rt->init();
+	sweeptest(num_secs, num_threads, atof(tok), rt);
+	if (rt->fini)
+	  rt->fini();
+      }
+    }
+  }
+  else {
+    for (rt = rwlock_tests; rt->name != NULL; rt++) {
+      if (!selected(locks, rt->name))
+	continue;
+      if (rt->init)
+	rt->init();
+      addtest(num_secs, num_readers, num_writers, rt);
+      if (rt->fini)
+	rt->fini();
+    }
+  }
+
+  bench_report_end(format);
   pthread_barrier_destroy(&barrier);
+  free(thread_data);
   return 0;
 }
 
+static void
+usage(void)
+{
+  rwlock_test_t *rt;
+  fprintf(stderr, "Usage: <cmd> [-s num_seconds] [-r num_readers] [-w num_writers]\n"
+	  "       [-p none|compact|scatter] [-f text|csv|json] [-l lock,...]\n"
+	  "       [-S write_pct,...] [-i usec]\n"
+	  "  -S  sweep: all r+w threads mix reads and writes, writing with each\n"
+	  "      given percentage in turn (e.g. -S 0,0.1,1,10,50)\n"
+	  "  -i  also run with a SIGPROF handler every usec that takes the\n"
+	  "      read side, dropping the sample where it cannot\n"
+	  "locks:");
+  for (rt = rwlock_tests; rt->name != NULL; rt++)
+    fprintf(stderr, " %s", rt->name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
 int main(int argc, char *argv[])
 {
   int num_secs = 10;
   int num_readers = 2;
   int num_writers = 1;
+  const char *locks = NULL;
+  const char *sweep = NULL;
   int ch;
-  while ((ch = getopt(argc, argv, "s:r:w:")) != -1) {
+  while ((ch = getopt(argc, argv, "s:r:w:p:f:l:S:i:")) != -1) {
     switch (ch) {
     case 's':
       num_secs = atoi(optarg);
@@ -231,10 +611,28 @@ int main(int argc, char *argv[])
     case 'w':
       num_writers = atoi(optarg);
       break;
+    case 'p':
+      if (bench_parse_pin(optarg, &pin) != 0)
+	usage();
+      break;
+    case 'f':
+      if (bench_parse_format(optarg, &format) != 0)
+	usage();
+      break;
+    case 'l':
+      locks = optarg;
+      break;
+    case 'S':
+      sweep = optarg;
+      break;
+    case 'i':
+      sample_usec = atol(optarg);
+      break;
     default:
-      fprintf(stderr, "Usage: <cmd> [-s num_seconds] [-r num_readers]] [-w num_writers]\n");
-      exit(1);
+      usage();
     }
   }
-  return compute(num_secs, num_readers, num_writers);
+  if (num_readers < 0 || num_writers < 0 || num_readers + num_writers < 1)
+    usage();
+  return compute(num_secs, num_readers, num_writers, locks, sweep);
 }
@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+#include <alloca.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "pfq-rwlock.h"
+#include "seqlock.h"
+#include "lock-bench.h"
+
+/*
+ *  A read-mostly table guarded three ways: by a seqlock, a pfq_rwlock
+ *  and a pthread_rwlock.  Every thread mixes reads and writes, writing
+ *  with probability write_pct (default 0.1%, as for a load map that
+ *  changes on dlopen and is read on every sample).
+ *
+ *  A write sets every word of the table to the same new value; a read
+ *  copies the table and counts it as torn if the words differ, so any
+ *  torn count is a bug in the lock.  Read latency covers the whole read
+ *  including seqlock retries; the retries are also counted.
+ */
+
+#define TABLE_LEN  8
+
+typedef struct {
+  int index;
+  uint32_t write_thresh;
+  uint32_t seed;
+  long ops;
+  long writes;
+  long retries;
+  long torn;
+  bench_hist_t rhist;
+  bench_hist_t whist;
+} thread_data_t;
+
+typedef struct {
+  const char *name;
+  void (*init)(void);
+  void (*fini)(void);
+  void *(*test)(void *);
+} seqlock_test_t;
+
+static volatile int finished;
+static volatile long table[TABLE_LEN];
+static thread_data_t *thread_data;
+static pthread_barrier_t barrier;
+static pthread_rwlock_t rw_lock;
+static pfq_rwlock_t pfq_lock;
+static seqlock_t seq_lock;
+
+static double write_pct = 0.1;
+static pin_policy_t pin = PIN_NONE;
+static bench_format_t format = FORMAT_TEXT;
+
+static inline uint32_t
+next_random(uint32_t *seed)
+{
+  uint32_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *seed = x;
+}
+
+static inline void
+copy_table(long *copy)
+{
+  int i;
+  for (i = 0; i < TABLE_LEN; i++)
+    copy[i] = table[i];
+}
+
+static inline void
+check_copy(thread_data_t *td, const long *copy)
+{
+  int i;
+  for (i = 1; i < TABLE_LEN; i++) {
+    if (copy[i] != copy[0]) {
+      td->torn++;
+      return;
+    }
+  }
+}
+
+static inline void
+fill_table(void)
+{
+  int i;
+  long v = table[0] + 1;
+  for (i = 0; i < TABLE_LEN; i++)
+    table[i] = v;
+}
+
+static inline void
+seq_read(thread_data_t *td, long *copy)
+{
+  unsigned long s = seqlock_read_begin(&seq_lock);
+  copy_table(copy);
+  while (seqlock_read_retry(&seq_lock, s)) {
+    td->retries++;
+    s = seqlock_read_begin(&seq_lock);
+    copy_table(copy);
+  }
+}
+
+static inline void
+seq_write(void)
+{
+  seqlock_write_begin(&seq_lock);
+  fill_table();
+  seqlock_write_end(&seq_lock);
+}
+
+static inline void
+pfq_read(thread_data_t *td, long *copy)
+{
+  pfq_rwlock_read_lock(&pfq_lock);
+  copy_table(copy);
+  pfq_rwlock_read_unlock(&pfq_lock);
+}
+
+static inline void
+pfq_write(void)
+{
+  pfq_rwlock_node_t me;
+  pfq_rwlock_write_lock(&pfq_lock, &me);
+  fill_table();
+  pfq_rwlock_write_unlock(&pfq_lock, &me);
+}
+
+static inline void
+prw_read(thread_data_t *td, long *copy)
+{
+  pthread_rwlock_rdlock(&rw_lock);
+  copy_table(copy);
+  pthread_rwlock_unlock(&rw_lock);
+}
+
+static inline void
+prw_write(void)
+{
+  pthread_rwlock_wrlock(&rw_lock);
+  fill_table();
+  pthread_rwlock_unlock(&rw_lock);
+}
+
+#define SEQLOCK_THREAD(lk)					\
+static void *							\
+lk##_test(void *arg)						\
+{								\
+  thread_data_t *td = arg;					\
+  long sum = 0;							\
+  long writes = 0;						\
+  long copy[TABLE_LEN];						\
+  bench_pin_self(bench_thread_cpu(td->index, pin));		\
+  bench_hist_init(&td->rhist);					\
+  bench_hist_init(&td->whist);					\
+  pthread_barrier_wait(&barrier);				\
+  while (!finished) {						\
+    uint64_t t0 = bench_cycles();				\
+    if (next_random(&td->seed) < td->write_thresh) {		\
+      lk##_write();						\
+      bench_hist_add(&td->whist, bench_cycles() - t0);		\
+      ++writes;							\
+    }								\
+    else {							\
+      lk##_read(td, copy);					\
+      bench_hist_add(&td->rhist, bench_cycles() - t0);		\
+      check_copy(td, copy);					\
+    }								\
+    ++sum;							\
+  }								\
+  td->ops = sum;						\
+  td->writes = writes;						\
+  return NULL;							\
+}
+
+SEQLOCK_THREAD(seq)
+SEQLOCK_THREAD(pfq)
+SEQLOCK_THREAD(prw)
+
+static void seq_init(void) { seqlock_init(&seq_lock); }
+static void pfq_init(void) { pfq_rwlock_init(&pfq_lock); }
+static void prw_init(void) { pthread_rwlock_init(&rw_lock, NULL); }
+static void prw_fini(void) { pthread_rwlock_destroy(&rw_lock); }
+
+static seqlock_test_t seqlock_tests[] = {
+  { "seqlock", seq_init, NULL, seq_test },
+  { "pfq", pfq_init, NULL, pfq_test },
+  { "pthread", prw_init, prw_fini, prw_test },
+  { NULL, NULL, NULL, NULL },
+};
+
+static void
+report_role(seqlock_test_t *st, const char *role, int num_threads, int writes,
+	    double secs)
+{
+  int i;
+  long *ops = alloca(num_threads * sizeof(ops[0]));
+  bench_hist_t *hist = malloc(sizeof(bench_hist_t));
+  long retries = 0, torn = 0;
+  bench_result_t result;
+
+  bench_hist_init(hist);
+  for (i = 0; i < num_threads; ++i) {
+    thread_data_t *td = &thread_data[i];
+    ops[i] = writes ? td->writes : td->ops - td->writes;
+    retries += td->retries;
+    torn += td->torn;
+    bench_hist_merge(hist, writes ? &td->whist : &td->rhist);
+  }
+
+  bench_result_init(&result, "seqlock-test", st->name, role);
+  bench_summarize(&result, ops, num_threads);
+  result.pin = pin;
+  result.secs = secs;
+  result.hist = hist;
+  bench_result_extra(&result, "write_pct", write_pct);
+  bench_result_extra(&result, "retries", writes ? 0 : retries);
+  bench_result_extra(&result, "torn", writes ? 0 : torn);
+  if (format == FORMAT_TEXT)
+    printf("Results for %s test, %s:\n", st->name, role);
+  bench_report(format, &result);
+  free(hist);
+}
+
+static void
+addtest(int num_secs, int num_threads, seqlock_test_t *st)
+{
+  int i;
+  pthread_t *thread = alloca(num_threads * sizeof(thread[0]));
+  struct timespec t0, t1;
+
+  finished = 0;
+  memset((void *) table, 0, sizeof(table));
+  for (i = 0; i < num_threads; ++i) {
+    thread_data_t *td = &thread_data[i];
+    td->index = i;
+    td->write_thresh = (uint32_t) (write_pct / 100. * UINT32_MAX);
+    td->seed = 2463534242u + 7919u * i;
+    td->ops = td->writes = td->retries = td->torn = 0;
+    if (0 != pthread_create(&thread[i], NULL, st->test, td)) {
+      fprintf(stderr, "Error creating thread %d\n", i);
+      exit(-1);
+    }
+  }
+
+  pthread_barrier_wait(&barrier);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  sleep(num_secs);
+  finished = 1;
+
+  for (i = 0; i < num_threads; ++i) {
+    if (0 != pthread_join(thread[i], NULL)) {
+      fprintf(stderr, "Error finishing thread %d\n", i);
+      exit(-1);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  report_role(st, "readers", num_threads, 0, secs);
+  report_role(st, "writers", num_threads, 1, secs);
+}
+
+static int
+selected(const char *locks, const char *name)
+{
+  char buf[200];
+  char *tok, *save;
+
+  if (locks == NULL)
+    return 1;
+  strncpy(buf, locks, sizeof(buf) - 1);
+  buf[sizeof(buf) - 1] = 0;
+  for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+    if (strcmp(tok, name) == 0)
+      return 1;
+  }
+  return 0;
+}
+
+static void
+usage(void)
+{
+  seqlock_test_t *st;
+  fprintf(stderr, "Usage: <cmd> [-s num_seconds] [-t num_threads] [-W write_pct]\n"
+	  "       [-p none|compact|scatter] [-f text|csv|json] [-l lock,...]\n"
+	  "locks:");
+  for (st = seqlock_tests; st->name != NULL; st++)
+    fprintf(stderr, " %s", st->name);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  int num_secs = 10;
+  int num_threads = 4;
+  const char *locks = NULL;
+  seqlock_test_t *st;
+  int ch;
+  while ((ch = getopt(argc, argv, "s:t:W:p:f:l:")) != -1) {
+    switch (ch) {
+    case 's':
+      num_secs = atoi(optarg);
+      break;
+    case 't':
+      num_threads = atoi(optarg);
+      break;
+    case 'W':
+      write_pct = atof(optarg);
+      break;
+    case 'p':
+      if (bench_parse_pin(optarg, &pin) != 0)
+	usage();
+      break;
+    case 'f':
+      if (bench_parse_format(optarg, &format) != 0)
+	usage();
+      break;
+    case 'l':
+      locks = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (num_threads < 1 || write_pct < 0. || write_pct > 100.)
+    usage();
+
+  thread_data = calloc(num_threads, sizeof(thread_data_t));
+  pthread_barrier_init(&barrier, NULL, num_threads+1);
+  bench_report_begin(format);
+
+  for (st = seqlock_tests; st->name != NULL; st++) {
+    if (!selected(locks, st->name))
+      continue;
+    if (st->init)
+      st->init();
+    addtest(num_secs, num_threads, st);
+    if (st->fini)
+      st->fini();
+  }
+
+  bench_report_end(format);
+  pthread_barrier_destroy(&barrier);
+  free(thread_data);
+  return 0;
+}
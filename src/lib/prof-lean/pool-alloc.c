@@ -0,0 +1,361 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: pool-alloc.c
+//
+// purpose:
+//   mmap-backed, size-class-segregated, per-thread pool allocator. see
+//   pool-alloc.h.
+//
+//   chunks are aligned to their size, so the chunk header, and with it
+//   the size class, is found by masking a block address.
+//
+//   each thread and class has a bump-allocated chunk, an owned free list
+//   that is only popped, and a returned list that pool_free pushes onto.
+//   every update is a single atomic operation, which keeps the lists
+//   consistent if a signal handler on the same thread allocates or frees
+//   in the middle of an update. the returned list is spliced into the
+//   owned list only by the outermost allocation on a thread, so a
+//   handler can never put a block back at the head of the owned list
+//   while an interrupted pop still holds it, which rules out ABA.
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "pool-alloc.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define CHUNK_SIZE       (1UL << 20)
+#define CHUNK_HEADER     64
+
+#define SMALL_STEP       16
+#define SMALL_MAX        256
+#define NUM_SMALL        (SMALL_MAX / SMALL_STEP)
+#define NUM_CLASSES      (NUM_SMALL + 6)
+#define CLASS_MAX        (SMALL_MAX << 6)
+#define CLASS_LARGE      NUM_CLASSES
+
+#define TLS_MODEL        __attribute__((tls_model("initial-exec")))
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct block_s {
+  struct block_s *next;
+} block_t;
+
+typedef struct {
+  int size_class;
+  size_t mapped;
+  volatile size_t used;
+} chunk_t;
+
+typedef struct {
+  chunk_t * volatile current;
+  block_t * volatile owned;
+  block_t * volatile returned;
+} pool_class_t;
+
+typedef struct {
+  volatile int depth;
+  pool_class_t size_class[NUM_CLASSES];
+} pool_thread_t;
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static __thread pool_thread_t pool_self TLS_MODEL;
+
+static volatile size_t mapped_bytes;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static int
+size_to_class
+(
+ size_t size
+)
+{
+  if (size <= SMALL_MAX) {
+    return (size == 0) ? 0 : (size - 1) / SMALL_STEP;
+  }
+
+  int c = NUM_SMALL;
+  size_t s = SMALL_MAX << 1;
+  while (s < size) {
+    s <<= 1;
+    c++;
+  }
+  return c;
+}
+
+
+static size_t
+class_to_size
+(
+ int c
+)
+{
+  if (c < NUM_SMALL) return (c + 1) * SMALL_STEP;
+  return ((size_t) SMALL_MAX) << (c - NUM_SMALL + 1);
+}
+
+
+// map len bytes aligned to CHUNK_SIZE, trimming the excess
+static chunk_t *
+chunk_map
+(
+ int size_class,
+ size_t len
+)
+{
+  size_t span = len + CHUNK_SIZE;
+  char *raw = (char *) mmap(NULL, span, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (raw == MAP_FAILED) return NULL;
+
+  char *base = (char *) (((uintptr_t) raw + CHUNK_SIZE - 1) & ~(CHUNK_SIZE - 1));
+  if (base > raw) munmap(raw, base - raw);
+  if (raw + span > base + len) munmap(base + len, raw + span - (base + len));
+
+  chunk_t *chunk = (chunk_t *) base;
+  chunk->size_class = size_class;
+  chunk->mapped = len;
+  chunk->used = CHUNK_HEADER;
+
+  __sync_fetch_and_add(&mapped_bytes, len);
+
+  return chunk;
+}
+
+
+static void
+chunk_unmap
+(
+ chunk_t *chunk
+)
+{
+  __sync_fetch_and_sub(&mapped_bytes, chunk->mapped);
+  munmap(chunk, chunk->mapped);
+}
+
+
+static void *
+alloc_large
+(
+ size_t size
+)
+{
+  size_t len = (CHUNK_HEADER + size + 4095) & ~4095UL;
+  chunk_t *chunk = chunk_map(CLASS_LARGE, len);
+
+  return chunk ? (char *) chunk + CHUNK_HEADER : NULL;
+}
+
+
+static void *
+alloc_pop
+(
+ pool_class_t *pc
+)
+{
+  block_t *b;
+
+  for (;;) {
+    b = pc->owned;
+    if (b == NULL) return NULL;
+    if (__sync_bool_compare_and_swap(&pc->owned, b, b->next)) return b;
+  }
+}
+
+
+// outermost allocation only: move the returned list to the owned list
+// and take its first block
+static void *
+alloc_refill
+(
+ pool_class_t *pc
+)
+{
+  block_t *list = __sync_lock_test_and_set(&pc->returned, NULL);
+
+  if (list == NULL) return NULL;
+
+  if (list->next != NULL &&
+      !__sync_bool_compare_and_swap(&pc->owned, NULL, list->next)) {
+    // a handler left blocks on the owned list; hand the rest back
+    block_t *b = list->next;
+    while (b) {
+      block_t *next = b->next;
+      pool_free(b);
+      b = next;
+    }
+  }
+  return list;
+}
+
+
+static void *
+alloc_bump
+(
+ pool_class_t *pc,
+ int c
+)
+{
+  size_t size = class_to_size(c);
+
+  for (;;) {
+    chunk_t *chunk = pc->current;
+    if (chunk) {
+      size_t offset = __sync_fetch_and_add(&chunk->used, size);
+      if (offset + size <= CHUNK_SIZE) return (char *) chunk + offset;
+    }
+
+    chunk_t *fresh = chunk_map(c, CHUNK_SIZE);
+    if (fresh == NULL) return NULL;
+
+    // a handler may have installed a chunk meanwhile; use theirs
+    if (!__sync_bool_compare_and_swap(&pc->current, chunk, fresh)) {
+      chunk_unmap(fresh);
+    }
+  }
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+void *
+pool_alloc
+(
+ size_t size
+)
+{
+  if (size > CLASS_MAX) return alloc_large(size);
+
+  int c = size_to_class(size);
+  pool_class_t *pc = &pool_self.size_class[c];
+  void *b;
+
+  pool_self.depth++;
+
+  b = alloc_pop(pc);
+  if (b == NULL && pool_self.depth == 1) {
+    b = alloc_refill(pc);
+  }
+
+  pool_self.depth--;
+
+  if (b == NULL) {
+    b = alloc_bump(pc, c);
+  }
+
+  return b;
+}
+
+
+void
+pool_free
+(
+ void *ptr
+)
+{
+  if (ptr == NULL) return;
+
+  chunk_t *chunk = (chunk_t *) ((uintptr_t) ptr & ~(CHUNK_SIZE - 1));
+
+  if (chunk->size_class == CLASS_LARGE) {
+    chunk_unmap(chunk);
+    return;
+  }
+
+  pool_class_t *pc = &pool_self.size_class[chunk->size_class];
+  block_t *b = (block_t *) ptr;
+  block_t *head;
+
+  do {
+    head = pc->returned;
+    b->next = head;
+  } while (!__sync_bool_compare_and_swap(&pc->returned, head, b));
+}
+
+
+size_t
+pool_mapped_bytes
+(
+ void
+)
+{
+  return mapped_bytes;
+}
@@ -0,0 +1,102 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: pool-alloc.h
+//
+// purpose:
+//   an async-signal-safe allocator for small fixed-size objects such as
+//   cskiplist nodes. memory comes from mmap in 1MB chunks, segregated by
+//   size class, and each thread allocates from and frees into its own
+//   per-class lists, so there are no locks and no shared state on the
+//   fast path.
+//
+//   pool_alloc and pool_free have the shapes of the mem_alloc and
+//   mem_free parameters taken by cskl_new, cskl_insert and the bulk
+//   deletes, and may be called from a signal handler, including one
+//   that interrupted pool_alloc or pool_free on the same thread.
+//
+//   a block freed by a thread other than the one that allocated it
+//   joins the freeing thread's lists. memory cached by a thread is not
+//   returned to the system when the thread exits.
+//******************************************************************************
+
+#ifndef __pool_alloc_h__
+#define __pool_alloc_h__
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stddef.h>
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+void *
+pool_alloc
+(
+ size_t size
+);
+
+
+void
+pool_free
+(
+ void *ptr
+);
+
+
+// total bytes currently mapped by the pool across all threads
+size_t
+pool_mapped_bytes
+(
+ void
+);
+
+#endif
@@ -0,0 +1,185 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+
+//******************************************************************************
+// file: seqlock.h
+//
+// purpose:
+//   a sequence lock for tables that are read on every sample and
+//   written only on rare events such as dlopen or thread creation.
+//
+//   a writer makes the sequence number odd, updates the data, and makes
+//   it even again. a reader notes the sequence number, copies what it
+//   needs, and retries if the number was odd or has changed. readers
+//   only load: they take no atomic read-modify-write and never write a
+//   shared cache line, so any number of them proceed without contention,
+//   including from signal handlers.
+//
+//   readers may see a torn copy before the retry check fails, so they
+//   must only copy data inside the read section (through volatile or
+//   relaxed atomic loads), never follow pointers out of it or act on
+//   it until seqlock_read_retry returns false.
+//
+//   a signal handler that might interrupt a writer on its own thread
+//   must use seqlock_read_trybegin and drop the sample on failure;
+//   seqlock_read_begin would spin forever.
+//******************************************************************************
+
+#ifndef __seqlock_h__
+#define __seqlock_h__
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  atomic_ulong seq;
+} seqlock_t;
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+static inline void
+seqlock_init
+(
+ seqlock_t *l
+)
+{
+  atomic_init(&l->seq, 0);
+}
+
+
+// wait until no write is in progress; returns the sequence number to
+// pass to seqlock_read_retry
+static inline unsigned long
+seqlock_read_begin
+(
+ seqlock_t *l
+)
+{
+  unsigned long s;
+
+  while ((s = atomic_load_explicit(&l->seq, memory_order_acquire)) & 1);
+
+  return s;
+}
+
+
+// as seqlock_read_begin, but return false rather than wait if a write
+// is in progress
+static inline bool
+seqlock_read_trybegin
+(
+ seqlock_t *l,
+ unsigned long *seq
+)
+{
+  *seq = atomic_load_explicit(&l->seq, memory_order_acquire);
+
+  return (*seq & 1) == 0;
+}
+
+
+// true if a write overlapped the read section begun with seq, so the
+// copy must be discarded and the read repeated
+static inline bool
+seqlock_read_retry
+(
+ seqlock_t *l,
+ unsigned long seq
+)
+{
+  atomic_thread_fence(memory_order_acquire);
+
+  return atomic_load_explicit(&l->seq, memory_order_relaxed) != seq;
+}
+
+
+// writers exclude one another by moving the sequence number from even
+// to odd
+static inline void
+seqlock_write_begin
+(
+ seqlock_t *l
+)
+{
+  unsigned long s;
+
+  for (;;) {
+    s = atomic_load_explicit(&l->seq, memory_order_relaxed);
+    if ((s & 1) == 0 &&
+	atomic_compare_exchange_weak_explicit(&l->seq, &s, s + 1,
+					      memory_order_acquire,
+					      memory_order_relaxed)) break;
+  }
+
+  // order the odd sequence number before the data stores that follow
+  atomic_thread_fence(memory_order_release);
+}
+
+
+static inline void
+seqlock_write_end
+(
+ seqlock_t *l
+)
+{
+  atomic_store_explicit(&l->seq, atomic_load_explicit(&l->seq,
+			memory_order_relaxed) + 1, memory_order_release);
+}
+
+#endif
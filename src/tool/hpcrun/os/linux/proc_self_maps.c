@@ -0,0 +1,625 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+// ******************************************************* EndRiceCopyright *
+
+//******************************************************************************
+// file: proc_self_maps.c
+//
+// purpose:
+//   cached /proc/self/maps segment index. see proc_self_maps.h.
+//
+//   the maps file is read with open and read into a caller-supplied
+//   buffer and parsed by hand, one segment at a time, with no stdio
+//   and no malloc, so proc_self_maps_segment_stream works in a signal
+//   handler and before malloc is usable. a partial line at the end of
+//   a read moves to the front of the buffer for the next read; a line
+//   longer than the whole buffer keeps its fields and gets its path
+//   truncated.
+//
+//   the cache is filled by the same parser in one pass. the segments
+//   live in one growable array, sorted by start address, and their
+//   paths in one growable string pool. the cache remembers
+//   the dl_iterate_phdr load and unload counters from when it was
+//   parsed; each query reads the counters (dl_iterate_phdr stops after
+//   the first object) and re-parses only if they moved.
+//
+//   a mutex serializes queries and re-parses. it is recursive so that
+//   an iterate callback may itself do a lookup.
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "proc_self_maps.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define MAPS_FILE        "/proc/self/maps"
+#define MAPS_BUFFER_LEN  (64 * 1024)
+
+#define INITIAL_SEGMENTS 256
+#define INITIAL_PATHS    (16 * 1024)
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  int valid;
+  unsigned long long adds;
+  unsigned long long subs;
+} dl_generation_t;
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static proc_self_maps_segment_t *segments = NULL;
+static size_t num_segments = 0;
+static size_t max_segments = 0;
+
+static char *paths = NULL;
+static size_t paths_len = 0;
+static size_t paths_max = 0;
+
+static char maps_buffer[MAPS_BUFFER_LEN];
+
+static int cache_valid = 0;
+static dl_generation_t cache_generation;
+static unsigned long parse_count = 0;
+
+static pthread_mutex_t maps_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static int
+dl_generation_callback
+(
+ struct dl_phdr_info *info,
+ size_t size,
+ void *arg
+)
+{
+  dl_generation_t *gen = (dl_generation_t *) arg;
+
+  // dlpi_adds and dlpi_subs are only present if size covers them
+  if (size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+    gen->valid = 1;
+    gen->adds = info->dlpi_adds;
+    gen->subs = info->dlpi_subs;
+  }
+
+  // the counters are the same for every object, stop after the first
+  return 1;
+}
+
+
+static void
+dl_generation
+(
+ dl_generation_t *gen
+)
+{
+  gen->valid = 0;
+  gen->adds = 0;
+  gen->subs = 0;
+  dl_iterate_phdr(dl_generation_callback, gen);
+}
+
+
+// append path to the string pool. returns its offset, or -1 if out
+// of memory.
+static long
+path_append
+(
+ const char *path,
+ size_t len
+)
+{
+  if (paths_len + len + 1 > paths_max) {
+    size_t new_max = (paths_max > 0) ? paths_max : INITIAL_PATHS;
+    while (paths_len + len + 1 > new_max) new_max *= 2;
+
+    char *new_paths = (char *) realloc(paths, new_max);
+    if (new_paths == NULL) return -1;
+    paths = new_paths;
+    paths_max = new_max;
+  }
+
+  long offset = paths_len;
+  memcpy(paths + paths_len, path, len);
+  paths[paths_len + len] = 0;
+  paths_len += len + 1;
+
+  return offset;
+}
+
+
+static proc_self_maps_segment_t *
+segment_append
+(
+ void
+)
+{
+  if (num_segments >= max_segments) {
+    size_t new_max = (max_segments > 0) ? 2 * max_segments : INITIAL_SEGMENTS;
+    proc_self_maps_segment_t *new_segments = (proc_self_maps_segment_t *)
+      realloc(segments, new_max * sizeof(proc_self_maps_segment_t));
+
+    if (new_segments == NULL) return NULL;
+    segments = new_segments;
+    max_segments = new_max;
+  }
+
+  return &segments[num_segments++];
+}
+
+
+static int
+segment_compare
+(
+ const void *a,
+ const void *b
+)
+{
+  const proc_self_maps_segment_t *s1 = (const proc_self_maps_segment_t *) a;
+  const proc_self_maps_segment_t *s2 = (const proc_self_maps_segment_t *) b;
+
+  if (s1->start < s2->start) return -1;
+  if (s1->start > s2->start) return 1;
+  return 0;
+}
+
+
+// parse a hex number at *p and advance *p past it
+static uint64_t
+parse_hex
+(
+ const char **p,
+ const char *end
+)
+{
+  uint64_t val = 0;
+
+  for (; *p < end; (*p)++) {
+    char c = **p;
+    if (c >= '0' && c <= '9') val = (val << 4) | (c - '0');
+    else if (c >= 'a' && c <= 'f') val = (val << 4) | (c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F') val = (val << 4) | (c - 'A' + 10);
+    else break;
+  }
+  return val;
+}
+
+
+static uint64_t
+parse_dec
+(
+ const char **p,
+ const char *end
+)
+{
+  uint64_t val = 0;
+
+  for (; *p < end && **p >= '0' && **p <= '9'; (*p)++) {
+    val = 10 * val + (**p - '0');
+  }
+  return val;
+}
+
+
+// copy the next space-delimited field into dst (truncated to len - 1)
+static void
+parse_field
+(
+ const char **p,
+ const char *end,
+ char *dst,
+ size_t len
+)
+{
+  size_t n = 0;
+
+  for (; *p < end && **p != ' ' && **p != '\n'; (*p)++) {
+    if (n + 1 < len) dst[n++] = **p;
+  }
+  dst[n] = 0;
+}
+
+
+static void
+skip_spaces
+(
+ const char **p,
+ const char *end
+)
+{
+  while (*p < end && **p == ' ') (*p)++;
+}
+
+
+// parse the maps line [line, end) into s. the path is terminated in
+// place, so end must be writable and inside the buffer. returns 1 on
+// success.
+static int
+segment_parse
+(
+ char *line,
+ char *end,
+ proc_self_maps_segment_t *s
+)
+{
+  const char *p = line;
+
+  s->start = (void *) (uintptr_t) parse_hex(&p, end);
+  if (p >= end || *p != '-') return 0;
+  p++;
+  s->end = (void *) (uintptr_t) parse_hex(&p, end);
+
+  skip_spaces(&p, end);
+  parse_field(&p, end, s->perms, sizeof(s->perms));
+  skip_spaces(&p, end);
+  s->offset = parse_hex(&p, end);
+  skip_spaces(&p, end);
+  parse_field(&p, end, s->device, sizeof(s->device));
+  skip_spaces(&p, end);
+  s->inode = parse_dec(&p, end);
+  skip_spaces(&p, end);
+
+  // strip trailing spaces from the path
+  char *path_end = end;
+  while (path_end > p && path_end[-1] == ' ') path_end--;
+  *path_end = 0;
+  s->path = p;
+
+  return 1;
+}
+
+
+// add one streamed segment to the cache, copying its path into the
+// pool. the pool offset is kept in s->path until the pool stops
+// moving.
+static int
+cache_add
+(
+ proc_self_maps_segment_t *s,
+ void *arg
+)
+{
+  proc_self_maps_segment_t *e = segment_append();
+  if (e == NULL) return 1;
+
+  long path_offset = path_append(s->path, strlen(s->path));
+  if (path_offset < 0) {
+    num_segments--;
+    return 1;
+  }
+
+  *e = *s;
+  e->path = (const char *) path_offset;
+
+  return 0;
+}
+
+
+// re-read the maps file into the cache. returns 1 on success.
+static int
+maps_parse
+(
+ void
+)
+{
+  num_segments = 0;
+  paths_len = 0;
+
+  // -1 is a read error and 1 is cache_add out of memory; either way
+  // the array is partial
+  if (proc_self_maps_segment_stream(maps_buffer, sizeof(maps_buffer),
+				    cache_add, NULL) != 0) {
+    num_segments = 0;
+    return 0;
+  }
+
+  int sorted = 1;
+  for (size_t i = 0; i < num_segments; i++) {
+    segments[i].path = paths + (uintptr_t) segments[i].path;
+    if (i > 0 && segments[i].start < segments[i - 1].start) sorted = 0;
+  }
+
+  // the kernel lists the maps in order, but don't rely on it
+  if (! sorted) {
+    qsort(segments, num_segments, sizeof(proc_self_maps_segment_t),
+	  segment_compare);
+  }
+
+  parse_count++;
+
+  return 1;
+}
+
+
+// re-parse if the cache is invalid or the loader counters moved. the
+// lock is held.
+static void
+cache_refresh
+(
+ void
+)
+{
+  dl_generation_t gen;
+
+  dl_generation(&gen);
+
+  if (cache_valid && gen.valid
+      && gen.adds == cache_generation.adds
+      && gen.subs == cache_generation.subs) {
+    return;
+  }
+
+  if (maps_parse()) {
+    cache_valid = 1;
+    cache_generation = gen;
+  } else {
+    cache_valid = 0;
+  }
+}
+
+
+// index of the segment containing address, or -1. the lock is held.
+static long
+cache_search
+(
+ uintptr_t address
+)
+{
+  size_t lo = 0;
+  size_t hi = num_segments;
+
+  // last segment with start <= address
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if ((uintptr_t) segments[mid].start <= address) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  if (lo == 0 || address >= (uintptr_t) segments[lo - 1].end) return -1;
+
+  return lo - 1;
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+int
+proc_self_maps_segment_stream
+(
+ char *buf,
+ size_t len,
+ proc_self_maps_segment_callback_t cb,
+ void *arg
+)
+{
+  proc_self_maps_segment_t s;
+  size_t fill = 0;     // bytes in buf
+  int skipping = 0;    // discarding the rest of an over-long line
+  int at_eof = 0;
+  int ret = 0;
+
+  if (buf == NULL || len < PROC_SELF_MAPS_MIN_BUFFER) return -1;
+
+  int fd;
+  do {
+    fd = open(MAPS_FILE, O_RDONLY);
+  } while (fd < 0 && errno == EINTR);
+  if (fd < 0) return -1;
+
+  while (ret == 0 && ! at_eof) {
+    // leave one byte to terminate an unterminated last line
+    ssize_t n = read(fd, buf + fill, len - 1 - fill);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ret = -1;
+      break;
+    }
+    if (n == 0) {
+      at_eof = 1;
+      if (fill == 0 || skipping) break;
+      buf[fill++] = '\n';
+    }
+    fill += n;
+
+    char *line = buf;
+    char *end = buf + fill;
+
+    for (;;) {
+      char *nl = memchr(line, '\n', end - line);
+
+      if (nl == NULL) break;
+      if (skipping) {
+	skipping = 0;
+      } else if (segment_parse(line, nl, &s)) {
+	ret = cb(&s, arg);
+	if (ret != 0) break;
+      }
+      line = nl + 1;
+    }
+    if (ret != 0) break;
+
+    // move the partial line to the front. a line that fills the
+    // whole buffer is parsed with its path cut short and the rest of
+    // it is skipped.
+    fill = end - line;
+    if (line > buf) {
+      memmove(buf, line, fill);
+    } else if (fill == len - 1) {
+      if (! skipping && segment_parse(buf, buf + fill, &s)) {
+	ret = cb(&s, arg);
+      }
+      skipping = 1;
+      fill = 0;
+    }
+  }
+
+  int saved_errno = errno;
+  close(fd);
+  errno = saved_errno;
+
+  return ret;
+}
+
+
+int
+proc_self_maps_segment_iterate
+(
+ proc_self_maps_segment_callback_t cb,
+ void *arg
+)
+{
+  int ret = 0;
+
+  pthread_mutex_lock(&maps_lock);
+  cache_refresh();
+
+  // num_segments is re-read each time, in case cb caused a re-parse
+  for (size_t i = 0; i < num_segments; i++) {
+    proc_self_maps_segment_t s = segments[i];
+    ret = cb(&s, arg);
+    if (ret != 0) break;
+  }
+
+  pthread_mutex_unlock(&maps_lock);
+
+  return ret;
+}
+
+
+int
+proc_self_maps_address_to_segment
+(
+ const void *addr,
+ proc_self_maps_segment_t *s
+)
+{
+  pthread_mutex_lock(&maps_lock);
+  cache_refresh();
+
+  long i = cache_search((uintptr_t) addr);
+  if (i >= 0) *s = segments[i];
+
+  pthread_mutex_unlock(&maps_lock);
+
+  return (i >= 0);
+}
+
+
+void
+proc_self_maps_invalidate
+(
+ void
+)
+{
+  pthread_mutex_lock(&maps_lock);
+  cache_valid = 0;
+  pthread_mutex_unlock(&maps_lock);
+}
+
+
+unsigned long
+proc_self_maps_parse_count
+(
+ void
+)
+{
+  return parse_count;
+}
+
+
+void
+proc_self_maps_segment_print
+(
+ proc_self_maps_segment_t *s
+)
+{
+  printf("%p-%p %s %08llx %s %llu %s\n", s->start, s->end, s->perms,
+	 (unsigned long long) s->offset, s->device,
+	 (unsigned long long) s->inode, s->path);
+}
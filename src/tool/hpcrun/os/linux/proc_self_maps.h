@@ -0,0 +1,181 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+// ******************************************************* EndRiceCopyright *
+
+//******************************************************************************
+// file: proc_self_maps.h
+//
+// purpose:
+//   address to segment queries against /proc/self/maps.
+//
+//   the maps file is parsed once into a sorted, contiguous array of
+//   segments, and lookups binary search the array. the array is
+//   re-parsed only when the dl_iterate_phdr load and unload counters
+//   (dlpi_adds, dlpi_subs) change, i.e., after a dlopen or dlclose.
+//   mappings made without the loader (mmap of anonymous memory, new
+//   thread stacks) are not seen until the next load or unload, or an
+//   explicit proc_self_maps_invalidate.
+//
+//   path pointers in returned segments point into the cache and stay
+//   valid only until the next re-parse.
+//
+//   proc_self_maps_segment_stream bypasses the cache: it parses the
+//   maps file in one pass with open and read into a caller-supplied
+//   buffer, with no stdio and no heap use, so it is safe in a signal
+//   handler and at early init.
+//******************************************************************************
+
+#ifndef __proc_self_maps_h__
+#define __proc_self_maps_h__
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define PROC_SELF_MAPS_PERMS_LEN   8
+#define PROC_SELF_MAPS_DEVICE_LEN  16
+
+// smallest buffer for proc_self_maps_segment_stream. 4K or more
+// avoids truncating long paths.
+#define PROC_SELF_MAPS_MIN_BUFFER  256
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct proc_self_maps_segment_s {
+  void *start;
+  void *end;
+  char perms[PROC_SELF_MAPS_PERMS_LEN];
+  uint64_t offset;
+  char device[PROC_SELF_MAPS_DEVICE_LEN];
+  uint64_t inode;
+  const char *path;   // "" for anonymous mappings
+} proc_self_maps_segment_t;
+
+// return non-zero to stop the iteration
+typedef int (*proc_self_maps_segment_callback_t)
+(
+ proc_self_maps_segment_t *s,
+ void *arg
+);
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+// read /proc/self/maps into buf (len bytes, at least
+// PROC_SELF_MAPS_MIN_BUFFER) and call cb on each segment as it is
+// parsed, in file order. s->path points into buf and is valid only
+// during the callback; a path that doesn't fit in buf is truncated.
+// async-signal-safe if cb is. returns the non-zero value that stopped
+// the iteration, 0 at the end of the file, or -1 if the file can't be
+// read.
+int
+proc_self_maps_segment_stream
+(
+ char *buf,
+ size_t len,
+ proc_self_maps_segment_callback_t cb,
+ void *arg
+);
+
+
+// call cb on each segment in address order. returns the non-zero
+// value that stopped the iteration, else 0.
+int
+proc_self_maps_segment_iterate
+(
+ proc_self_maps_segment_callback_t cb,
+ void *arg
+);
+
+
+// fill in s with the segment containing addr. returns 1 if found, 0
+// if addr is not mapped (s is unchanged).
+int
+proc_self_maps_address_to_segment
+(
+ const void *addr,
+ proc_self_maps_segment_t *s
+);
+
+
+// force a re-parse on the next query
+void
+proc_self_maps_invalidate
+(
+ void
+);
+
+
+// number of times the maps file has been parsed
+unsigned long
+proc_self_maps_parse_count
+(
+ void
+);
+
+
+void
+proc_self_maps_segment_print
+(
+ proc_self_maps_segment_t *s
+);
+
+#endif
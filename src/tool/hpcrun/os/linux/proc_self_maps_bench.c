@@ -0,0 +1,317 @@
+// -*-Mode: C++;-*- // technically C99
+
+// * BeginRiceCopyright *****************************************************
+//
+// $HeadURL$
+// $Id$
+//
+// --------------------------------------------------------------------------
+// Part of HPCToolkit (hpctoolkit.org)
+//
+// Information about sources of support for research and development of
+// HPCToolkit is at 'hpctoolkit.org' and in 'README.Acknowledgments'.
+// --------------------------------------------------------------------------
+//
+// Copyright ((c)) 2002-2018, Rice University
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+//   notice, this list of conditions and the following disclaimer.
+//
+// * Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the
+//   documentation and/or other materials provided with the distribution.
+//
+// * Neither the name of Rice University (RICE) nor the names of its
+//   contributors may be used to endorse or promote products derived from
+//   this software without specific prior written permission.
+//
+// This software is provided by RICE and contributors "as is" and any
+// express or implied warranties, including, but not limited to, the
+// implied warranties of merchantability and fitness for a particular
+// purpose are disclaimed. In no event shall RICE or contributors be
+// liable for any direct, indirect, incidental, special, exemplary, or
+// consequential damages (including, but not limited to, procurement of
+// substitute goods or services; loss of use, data, or profits; or
+// business interruption) however caused and on any theory of liability,
+// whether in contract, strict liability, or tort (including negligence
+// or otherwise) arising in any way out of the use of this software, even
+// if advised of the possibility of such damage.
+//
+// ******************************************************* EndRiceCopyright *
+
+
+//******************************************************************************
+// Benchmark the /proc/self/maps parsers: the stdio parser the cache
+// used before (fopen, fgets and sscanf per line) against the
+// read()-based proc_self_maps_segment_stream, with a large and a
+// minimum-size buffer.
+//
+// With -m, first split an anonymous region into that many mappings
+// (alternating page protections, so the kernel can't merge them) to
+// imitate a large Python or Julia process.  The default is 50000; the
+// kernel limit is vm.max_map_count.
+//
+// Each parser must see the same segments (count and checksum).  The
+// stream parser is also run once from a signal handler.
+//
+// Usage: ./proc_self_maps_bench [-m mappings] [-n reps]
+//******************************************************************************
+
+//******************************************************************************
+// global includes
+//******************************************************************************
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <err.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+//******************************************************************************
+// local includes
+//******************************************************************************
+
+#include "proc_self_maps.h"
+
+
+
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define DEFAULT_MAPPINGS  50000
+#define DEFAULT_REPS      10
+
+#define LARGE_BUFFER      (64 * 1024)
+#define LINE_LEN          (4096 + 256)
+
+
+
+//******************************************************************************
+// types
+//******************************************************************************
+
+typedef struct {
+  long count;
+  uint64_t sum;
+} result_t;
+
+
+
+//******************************************************************************
+// local data
+//******************************************************************************
+
+static char large_buffer[LARGE_BUFFER];
+static char small_buffer[PROC_SELF_MAPS_MIN_BUFFER];
+
+static result_t handler_result;
+static int handler_ret;
+
+
+
+//******************************************************************************
+// private operations
+//******************************************************************************
+
+static double
+now_nsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+
+static void
+result_add(result_t *r, proc_self_maps_segment_t *s)
+{
+  const char *p;
+  uint64_t h = (uintptr_t) s->start ^ ((uintptr_t) s->end << 1) ^ s->offset ^ s->inode;
+
+  for (p = s->path; *p; p++) h = h * 31 + *p;
+  for (p = s->perms; *p; p++) h = h * 31 + *p;
+
+  r->count++;
+  r->sum += h;
+}
+
+
+static int
+stream_callback(proc_self_maps_segment_t *s, void *arg)
+{
+  result_add((result_t *) arg, s);
+  return 0;
+}
+
+
+// the stdio parser from before the stream parser
+static int
+stdio_parse(result_t *r)
+{
+  static char line[LINE_LEN];
+  char path[LINE_LEN];
+  unsigned long start, end;
+  unsigned long long offset, inode;
+  proc_self_maps_segment_t s;
+  int pos;
+
+  FILE *fp = fopen("/proc/self/maps", "r");
+  if (fp == NULL) return -1;
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    pos = 0;
+    if (sscanf(line, "%lx-%lx %7s %llx %15s %llu %n", &start, &end,
+	       s.perms, &offset, s.device, &inode, &pos) < 6) {
+      continue;
+    }
+    size_t len = strlen(line + pos);
+    while (len > 0 && (line[pos + len - 1] == '\n' || line[pos + len - 1] == ' ')) len--;
+    memcpy(path, line + pos, len);
+    path[len] = 0;
+
+    s.start = (void *) start;
+    s.end = (void *) end;
+    s.offset = offset;
+    s.inode = inode;
+    s.path = path;
+    result_add(r, &s);
+  }
+  fclose(fp);
+
+  return 0;
+}
+
+
+static int
+stream_parse(char *buf, size_t len, result_t *r)
+{
+  return proc_self_maps_segment_stream(buf, len, stream_callback, r);
+}
+
+
+static void
+signal_handler(int sig)
+{
+  memset(&handler_result, 0, sizeof(handler_result));
+  handler_ret = stream_parse(large_buffer, sizeof(large_buffer), &handler_result);
+}
+
+
+static void
+make_mappings(long num)
+{
+  long pagesize = sysconf(_SC_PAGESIZE);
+  long i;
+
+  if (num <= 0) return;
+
+  char *region = mmap(NULL, num * pagesize, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED) {
+    err(1, "mmap of %ld pages failed", num);
+  }
+
+  for (i = 1; i < num; i += 2) {
+    if (mprotect(region + i * pagesize, pagesize, PROT_READ) != 0) {
+      err(1, "mprotect failed after %ld mappings (see vm.max_map_count)", i);
+    }
+  }
+}
+
+
+static void
+report(const char *name, result_t *r, double nsec, int reps, result_t *ref)
+{
+  double per = nsec / reps;
+
+  printf("%-14s segments: %7ld  %9.1f usec/parse  %6.1f ns/segment  %s\n",
+	 name, r->count, per / 1000, (r->count > 0) ? per / r->count : 0.0,
+	 (r->count == ref->count && r->sum == ref->sum) ? "ok" : "MISMATCH");
+}
+
+
+
+//******************************************************************************
+// interface operations
+//******************************************************************************
+
+int
+main(int argc, char **argv)
+{
+  long num_mappings = DEFAULT_MAPPINGS;
+  int reps = DEFAULT_REPS;
+  result_t ref, r;
+  double t0, t1;
+  int ch, i;
+
+  while ((ch = getopt(argc, argv, "m:n:")) != -1) {
+    switch (ch) {
+    case 'm':
+      num_mappings = atol(optarg);
+      break;
+    case 'n':
+      reps = atoi(optarg);
+      break;
+    default:
+      errx(1, "usage: proc_self_maps_bench [-m mappings] [-n reps]");
+    }
+  }
+  if (reps < 1) reps = 1;
+
+  make_mappings(num_mappings);
+
+  memset(&ref, 0, sizeof(ref));
+  if (stdio_parse(&ref) != 0) {
+    err(1, "unable to read /proc/self/maps");
+  }
+  printf("mappings: %ld  reps: %d\n", ref.count, reps);
+
+  t0 = now_nsec();
+  for (i = 0; i < reps; i++) {
+    memset(&r, 0, sizeof(r));
+    stdio_parse(&r);
+  }
+  t1 = now_nsec();
+  report("stdio", &r, t1 - t0, reps, &ref);
+  double stdio_nsec = t1 - t0;
+
+  t0 = now_nsec();
+  for (i = 0; i < reps; i++) {
+    memset(&r, 0, sizeof(r));
+    stream_parse(large_buffer, sizeof(large_buffer), &r);
+  }
+  t1 = now_nsec();
+  report("stream 64K", &r, t1 - t0, reps, &ref);
+  printf("speedup: %.2fx\n", stdio_nsec / (t1 - t0));
+
+  t0 = now_nsec();
+  for (i = 0; i < reps; i++) {
+    memset(&r, 0, sizeof(r));
+    stream_parse(small_buffer, sizeof(small_buffer), &r);
+  }
+  t1 = now_nsec();
+  report("stream 256", &r, t1 - t0, reps, &ref);
+
+  signal(SIGUSR1, signal_handler);
+  raise(SIGUSR1);
+  printf("in signal handler: ret: %d  segments: %ld  %s\n", handler_ret,
+	 handler_result.count,
+	 (handler_result.count == ref.count && handler_result.sum == ref.sum)
+	 ? "ok" : "MISMATCH");
+
+  return 0;
+}
@@ -49,9 +49,14 @@
 // global includes
 //******************************************************************************
 
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 
@@ -64,6 +69,18 @@
 
 
 
+//******************************************************************************
+// macros
+//******************************************************************************
+
+#define DEFAULT_LOOKUPS           1000000
+#define DEFAULT_UNCACHED_LOOKUPS  10000
+
+#define TIMING_LIB   "libm.so.6"
+#define TIMING_SYM   "cos"
+
+
+
 //******************************************************************************
 // types
 //******************************************************************************
@@ -81,6 +98,9 @@ typedef struct proc_self_maps_seg_s {
 
 static proc_self_maps_seg_t *head;
 
+static proc_self_maps_segment_t *all_segments;
+static size_t num_all_segments;
+
 
 
 //******************************************************************************
@@ -114,6 +134,186 @@ callback(proc_self_maps_segment_t *s, void *arg)
 }
 
 
+static int 
+collect(proc_self_maps_segment_t *s, void *arg)
+{
+  all_segments = realloc(all_segments, 
+			 (num_all_segments + 1) * sizeof(*all_segments));
+  all_segments[num_all_segments++] = *s;
+  return 0;
+}
+
+
+static double
+now_nsec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1e9 * ts.tv_sec + ts.tv_nsec;
+}
+
+
+// the lookup before the cache: scan /proc/self/maps on every query
+static int
+uncached_address_to_segment(const void *addr, void **start, void **end)
+{
+  char line[4096 + 256];
+  unsigned long lo, hi;
+  int found = 0;
+
+  FILE *fp = fopen("/proc/self/maps", "r");
+  if (fp == NULL) return 0;
+
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "%lx-%lx", &lo, &hi) == 2 
+	&& lo <= (uintptr_t) addr && (uintptr_t) addr < hi) {
+      *start = (void *) lo;
+      *end = (void *) hi;
+      found = 1;
+      break;
+    }
+  }
+  fclose(fp);
+
+  return found;
+}
+
+
+// n random addresses, each inside a random segment
+static void **
+random_addresses(long n)
+{
+  void **addrs = malloc(n * sizeof(void *));
+  unsigned long seed = 12345;
+  long i;
+
+  for (i = 0; i < n; i++) {
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    proc_self_maps_segment_t *s = &all_segments[(seed >> 33) % num_all_segments];
+    uintptr_t len = (uintptr_t) s->end - (uintptr_t) s->start;
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    addrs[i] = (char *) s->start + (seed >> 33) % len;
+  }
+
+  return addrs;
+}
+
+
+// time random lookups with and without the cache, and check that
+// they agree and that the cached lookups don't re-parse
+//
+// returns: the number of failed checks
+static int
+time_lookups(long num_lookups, long num_uncached)
+{
+  proc_self_maps_segment_t s;
+  void *start, *end;
+  long i, found = 0, mismatch = 0;
+
+  proc_self_maps_segment_iterate(collect, 0);
+  void **addrs = random_addresses(num_lookups);
+  if (num_uncached > num_lookups) num_uncached = num_lookups;
+
+  double t0 = now_nsec();
+  for (i = 0; i < num_uncached; i++) {
+    found += uncached_address_to_segment(addrs[i], &start, &end);
+  }
+  double t1 = now_nsec();
+  double uncached = (num_uncached > 0) ? (t1 - t0) / num_uncached : 0;
+
+  printf("uncached: %ld lookups  found: %ld  %.1f ns/lookup\n", 
+	 num_uncached, found, uncached);
+
+  unsigned long parses = proc_self_maps_parse_count();
+  found = 0;
+  t0 = now_nsec();
+  for (i = 0; i < num_lookups; i++) {
+    found += proc_self_maps_address_to_segment(addrs[i], &s);
+  }
+  t1 = now_nsec();
+  double cached = (t1 - t0) / num_lookups;
+  parses = proc_self_maps_parse_count() - parses;
+
+  printf("cached:   %ld lookups  found: %ld  %.1f ns/lookup  parses: %lu\n",
+	 num_lookups, found, cached, parses);
+  if (cached > 0) {
+    printf("speedup:  %.1fx\n", uncached / cached);
+  }
+
+  // the address array itself is a new anonymous mapping that the
+  // cache doesn't know about, so re-parse before comparing
+  proc_self_maps_invalidate();
+  for (i = 0; i < num_uncached; i++) {
+    int f1 = uncached_address_to_segment(addrs[i], &start, &end);
+    int f2 = proc_self_maps_address_to_segment(addrs[i], &s);
+    if (f1 != f2 || (f1 && (start != s.start || end != s.end))) mismatch++;
+  }
+  printf("mismatches: %ld of %ld\n", mismatch, num_uncached);
+
+  free(addrs);
+
+  int failures = 0;
+  if (parses != 0) {
+    printf("FAIL: cached lookups re-parsed with no dlopen or dlclose\n");
+    failures++;
+  }
+  if (mismatch != 0) {
+    printf("FAIL: cached and uncached lookups disagree\n");
+    failures++;
+  }
+  return failures;
+}
+
+
+// a dlopen and dlclose must each cause one re-parse, and the new
+// library must be found
+//
+// returns: the number of failed checks
+static int
+check_generation()
+{
+  int failures = 0;
+  proc_self_maps_segment_t s;
+  unsigned long parses = proc_self_maps_parse_count();
+
+  void *handle = dlopen(TIMING_LIB, RTLD_NOW);
+  if (handle == NULL) {
+    printf("dlopen %s failed, skipping generation check\n", TIMING_LIB);
+    return 0;
+  }
+  void *addr = dlsym(handle, TIMING_SYM);
+
+  int found = proc_self_maps_address_to_segment(addr, &s);
+  proc_self_maps_address_to_segment(addr, &s);
+  parses = proc_self_maps_parse_count() - parses;
+  printf("after dlopen:  parses: %lu  lookup %p --> ", parses, addr);
+  if (found) proc_self_maps_segment_print(&s);
+  else printf("not found\n");
+
+  if (parses != 1) {
+    printf("FAIL: expected 1 re-parse after dlopen\n");
+    failures++;
+  }
+  if (!found) {
+    printf("FAIL: %s not found after dlopen\n", TIMING_SYM);
+    failures++;
+  }
+
+  parses = proc_self_maps_parse_count();
+  dlclose(handle);
+  proc_self_maps_address_to_segment(addr, &s);
+  proc_self_maps_address_to_segment(addr, &s);
+  parses = proc_self_maps_parse_count() - parses;
+  printf("after dlclose: parses: %lu\n", parses);
+
+  if (parses != 1) {
+    printf("FAIL: expected 1 re-parse after dlclose\n");
+    failures++;
+  }
+  return failures;
+}
+
+
 
 //******************************************************************************
 // interface operations
@@ -122,6 +322,12 @@ callback(proc_self_maps_segment_t *s, void *arg)
 int
 main(int argc, char **argv)
 {
+  long num_lookups = (argc > 1) ? atol(argv[1]) : DEFAULT_LOOKUPS;
+  long num_uncached = (argc > 2) ? atol(argv[2]) : DEFAULT_UNCACHED_LOOKUPS;
+
+  if (num_lookups < 1) num_lookups = DEFAULT_LOOKUPS;
+  if (num_uncached < 0) num_uncached = DEFAULT_UNCACHED_LOOKUPS;
+
   printf("dump /proc/self/maps\n");
 
   char cmd[1024];
@@ -132,14 +338,31 @@ main(int argc, char **argv)
   proc_self_maps_segment_iterate(callback, 0);
 
   printf("\nlooking up segments in reverse order\n");
+  int failures = 0;
   proc_self_maps_segment_t *e;
   for(e = pop(); e; e = pop()) {
     proc_self_maps_segment_t s;
     char *addr = 1 + (char *) e->start; 
-    proc_self_maps_address_to_segment(addr, &s);
     printf("Lookup %p --> ", addr); 
-    proc_self_maps_segment_print(&s);
+    if (proc_self_maps_address_to_segment(addr, &s) && s.start == e->start) {
+      proc_self_maps_segment_print(&s);
+    } else {
+      printf("FAIL: wrong or no segment\n");
+      failures++;
+    }
+  }
+
+  printf("\ntiming random lookups\n");
+  failures += time_lookups(num_lookups, num_uncached);
+
+  printf("\nchecking re-parse after dlopen and dlclose\n");
+  failures += check_generation();
+
+  if (failures) {
+    printf("\n%d checks FAILED\n", failures);
+    return 1;
   }
+  printf("\nall checks passed\n");
 
   return 0;
 }
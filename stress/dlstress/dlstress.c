@@ -35,17 +35,35 @@
  *
  * ----------------------------------------------------------------------
  *
- *  This program runs one or two threads and runs a loop of dlopen(),
+ *  This program runs one or more threads and runs a loop of dlopen(),
  *  dlclose and optionally dlsym in each thread.  This is a stress
  *  test for hpcrun designed to cause trouble with the dlopen reader-
  *  writer lock and dl_iterate_phdr().
  *
- *  Usage:  dlstress [ <program-time> | mult | single | nosym ]*
+ *  Every dlopen, dlsym and dlclose is timed, and at the end, the
+ *  program prints the number of calls, calls per second and the mean,
+ *  median, p99 and max latency for each one, summed over all threads.
+ *  Run with and without a profiler to measure how much it interferes
+ *  with the loader lock.  The percentiles come from the log-linear
+ *  histograms in prof-lean's latency.h and are accurate to about 6%.
+ *
+ *  The libraries come from a file (one path per line, '#' starts a
+ *  comment), from a glob pattern, or by default, from the base[]
+ *  list in LIB_DIR.  Libraries that fail to dlopen are dropped.  Each
+ *  thread loops over its own slice of the list (slices wrap around
+ *  and overlap when there are more threads than libraries / 4).
+ *
+ *  Usage:  dlstress [ <program-time> | mult | single | nosym |
+ *                     threads=<num> | file=<path> | glob=<pattern> ]*
  *
  *   program-time -- program time in seconds
  *   mult   -- run with multiple (2) threads
  *   single -- run with single (1) thread
  *   nosym  -- do not call dlsym()
+ *   threads=<num>  -- run with num threads
+ *   file=<path>    -- read the library list from path
+ *   glob=<pattern> -- use the libraries matching pattern, for example
+ *                     glob='/usr/lib64/lib*.so.*'
  */
 
 #include <sys/types.h>
@@ -57,20 +75,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <dlfcn.h>
 #include <pthread.h>
 
+#include "latency.h"
+
 #define LIB_DIR  "/usr/lib64"
 
-#define MAX_LIBS  100
+#define MAX_BASE  100
 #define NUM_SUM_FUNCS  20
 #define PROGRAM_TIME   30
+#define MIN_SLICE  4
+
+#define OP_DLOPEN   0
+#define OP_DLSYM    1
+#define OP_DLCLOSE  2
+#define NUM_OPS     3
 
 typedef double (sum_func_t) (long);
 
-char *base[MAX_LIBS] = {
+char *base[MAX_BASE] = {
     "libICE",
     "libOpenGL",
     "libabrt",
@@ -99,27 +126,69 @@ char *base[MAX_LIBS] = {
     NULL,
 };
 
-char *name[MAX_LIBS] = {
-    NULL,
-};
+char *op_name[NUM_OPS] = { "dlopen", "dlsym", "dlclose" };
+
+char **name = NULL;
+int name_size = 0;
 
 struct thread_args {
-    char *label;
+    char label[32];
     int  index;
     int  start;
     int  len;
+    pthread_t td;
+    latency_hist_t stats[NUM_OPS];
 };
 
+struct thread_args *thread_list = NULL;
+
 int num_libs = 0;
 
 int program_time;
-int mult_thread;
+int num_threads;
 int do_dlsym;
+char *lib_file;
+char *lib_glob;
 
 struct timeval start;
 
 //----------------------------------------------------------------------
 
+void
+add_time(latency_hist_t *stats, uint64_t t0, uint64_t t1)
+{
+    latency_hist_record(stats, t1 - t0);
+}
+
+//----------------------------------------------------------------------
+
+/*
+ * Test if we can dlopen the library and if so, add it to the name[]
+ * array.
+ */
+void
+add_lib(char *lib)
+{
+    void * handle = dlopen(lib, RTLD_LAZY);
+
+    if (handle == NULL) {
+	printf("failure:  %s\n", lib);
+	return;
+    }
+
+    if (num_libs >= name_size) {
+	name_size = (name_size == 0) ? 64 : 2 * name_size;
+	name = realloc(name, name_size * sizeof(char *));
+	if (name == NULL) {
+	    err(1, "realloc failed");
+	}
+    }
+    name[num_libs] = strdup(lib);
+    num_libs++;
+    dlclose(handle);
+    printf("success:  %s\n", lib);
+}
+
 /*
  * Create name[] array from base names.  Resolve version names by
  * taking the longest file name matching the glob pattern.
@@ -157,19 +226,7 @@ mk_lib_array(void)
 	    }
 	}
 
-	// test if we can dlopen the library
-	void * handle = dlopen(lib, RTLD_LAZY);
-
-	if (handle == NULL) {
-	    printf("failure:  %s\n", lib);
-	    goto next_lib;
-	}
-
-	// success: add it to the name[] array
-	name[num_libs] = strdup(lib);
-	num_libs++;
-	dlclose(handle);
-	printf("success:  %s\n", lib);
+	add_lib(lib);
 
     next_lib:
 	globfree(&globbuf);
@@ -177,41 +234,130 @@ mk_lib_array(void)
     printf("num libs:  %d\n\n", num_libs);
 }
 
-//----------------------------------------------------------------------
+/*
+ * Create name[] array from every file matching the pattern.
+ */
+void
+mk_lib_glob(char *patn)
+{
+    glob_t globbuf;
+    int j;
+
+    printf("searching for libs: %s ...\n", patn);
+
+    num_libs = 0;
+    if (glob(patn, 0, NULL, &globbuf) != 0) {
+	errx(1, "no files match: %s", patn);
+    }
+    for (j = 0; j < globbuf.gl_pathc; j++) {
+	add_lib(globbuf.gl_pathv[j]);
+    }
+    globfree(&globbuf);
+
+    printf("num libs:  %d\n\n", num_libs);
+}
 
 /*
- * Main thread uses name[0, ..., N/2 - 1], side thread uses N/2 ... N - 1,
- * where N = num_libs.
+ * Create name[] array from a file with one library per line.
  */
 void
-mk_thread_args(struct thread_args * main_args, struct thread_args * side_args)
+mk_lib_file(char *file)
 {
-    if (num_libs < 8) {
+    char buf[4096];
+    FILE *fp;
+
+    printf("reading libs from: %s ...\n", file);
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+	err(1, "unable to open: %s", file);
+    }
+
+    num_libs = 0;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+	char *lib = buf;
+	char *end;
+
+	end = strchr(lib, '#');
+	if (end != NULL) {
+	    *end = 0;
+	}
+	while (isspace(*lib)) {
+	    lib++;
+	}
+	end = lib + strlen(lib);
+	while (end > lib && isspace(end[-1])) {
+	    end--;
+	}
+	*end = 0;
+
+	if (*lib != 0) {
+	    add_lib(lib);
+	}
+    }
+    fclose(fp);
+
+    printf("num libs:  %d\n\n", num_libs);
+}
+
+//----------------------------------------------------------------------
+
+/*
+ * Thread i uses name[start, ..., start + len - 1] (mod N), where
+ * start = i * N / T and len = N / T, but at least MIN_SLICE,
+ * for N = num_libs and T = num_threads.
+ */
+struct thread_args *
+mk_thread_args(void)
+{
+    struct thread_args *args;
+    int len, i;
+
+    if (num_libs < 2 * MIN_SLICE) {
 	errx(1, "not enough available libraries");
     }
 
-    main_args->label = "main";
-    main_args->index = 1;
-    main_args->start = 0;
-    main_args->len = num_libs/2;
+    args = calloc(num_threads, sizeof(struct thread_args));
+    if (args == NULL) {
+	err(1, "calloc failed");
+    }
+
+    len = num_libs / num_threads;
+    if (len < MIN_SLICE) {
+	len = MIN_SLICE;
+    }
 
-    side_args->label = "side";
-    side_args->index = 2;
-    side_args->start = num_libs/2;
-    side_args->len = num_libs - main_args->len;
+    for (i = 0; i < num_threads; i++) {
+	if (i == 0) {
+	    strcpy(args[i].label, "main");
+	}
+	else {
+	    sprintf(args[i].label, "side%d", i);
+	}
+	args[i].index = 1 + (i % 2);
+	args[i].start = (int) ((long) i * num_libs / num_threads);
+	args[i].len = len;
+    }
+
+    return args;
 }
 
 //----------------------------------------------------------------------
 
 /*
- * Main loop of dlopen(), dlclose and dlsym run by both threads.
- * Report on the number of calls.
+ * Main loop of dlopen(), dlclose and dlsym run by all threads.
+ * Report on the number of calls.  With more than two threads, only
+ * the main thread prints the per-second lines.
  */
 void
 do_loop(struct thread_args * args)
 {
+    latency_hist_t *open_stats = &args->stats[OP_DLOPEN];
+    latency_hist_t *sym_stats = &args->stats[OP_DLSYM];
+    latency_hist_t *close_stats = &args->stats[OP_DLCLOSE];
     struct timeval now, last;
-    void * handle[MAX_LIBS];
+    void ** handle;
+    uint64_t t0, t1;
     long num;
 
     long cur_open = 0;
@@ -221,6 +367,13 @@ do_loop(struct thread_args * args)
     long total_err = 0;
     long num_open = 0;
 
+    int verbose = (num_threads <= 2 || args == thread_list);
+
+    handle = malloc(args->len * sizeof(void *));
+    if (handle == NULL) {
+	err(1, "malloc failed");
+    }
+
     last = start;
 
     for (num = 1;; num++)
@@ -232,7 +385,10 @@ do_loop(struct thread_args * args)
 	 * always go to the same address.
 	 */
 	for (k = 0; k < num_open; k++) {
-	    handle[k] = dlopen(name[args->start + k], RTLD_LAZY);
+	    t0 = latency_now();
+	    handle[k] = dlopen(name[(args->start + k) % num_libs], RTLD_LAZY);
+	    t1 = latency_now();
+	    add_time(open_stats, t0, t1);
 	    if (handle[k] == NULL) {
 		total_err++;
 	    }
@@ -246,14 +402,28 @@ do_loop(struct thread_args * args)
 	     */
 	    char buf[500];
 	    sprintf(buf, "./libsum%d.so", args->index);
+
+	    t0 = latency_now();
 	    void *sum_handle = dlopen(buf, RTLD_LAZY);
+	    t1 = latency_now();
+	    add_time(open_stats, t0, t1);
+	    if (sum_handle == NULL) {
+		errx(1, "dlopen failed: %s", dlerror());
+	    }
 
 	    for (k = 0; k < NUM_SUM_FUNCS; k++) {
 		sprintf(buf, "sum_%d_%d", args->index, k);
+		t0 = latency_now();
 		sum_func_t * sum_func = dlsym(sum_handle, buf);
+		t1 = latency_now();
+		add_time(sym_stats, t0, t1);
 		sum += (* sum_func) (5000);
 	    }
+
+	    t0 = latency_now();
 	    dlclose(sum_handle);
+	    t1 = latency_now();
+	    add_time(close_stats, t0, t1);
 
 	    cur_open += 1;
 	    total_open += 1;
@@ -274,7 +444,10 @@ do_loop(struct thread_args * args)
 	 */
 	for (k = num_open - 1; k >= 0; k--) {
 	    if (handle[k] != NULL) {
+		t0 = latency_now();
 		dlclose(handle[k]);
+		t1 = latency_now();
+		add_time(close_stats, t0, t1);
 	    }
 	}
 
@@ -282,7 +455,7 @@ do_loop(struct thread_args * args)
 
         gettimeofday(&now, NULL);
 
-        if (now.tv_sec > last.tv_sec) {
+        if (verbose && now.tv_sec > last.tv_sec) {
             printf("%s:  time: %3ld   dlopen: %6ld  (%ld)   dlsym: %6ld  (%ld)"
 		   "   err: %ld   sum = %g\n",
                    args->label, now.tv_sec - start.tv_sec, cur_open, total_open,
@@ -293,10 +466,14 @@ do_loop(struct thread_args * args)
         }
 
         if (now.tv_sec >= start.tv_sec + program_time) {
-	    printf("%s:  done\n", args->label);
+	    if (verbose) {
+		printf("%s:  done\n", args->label);
+	    }
             break;
         }
     }
+
+    free(handle);
 }
 
 //----------------------------------------------------------------------
@@ -310,27 +487,78 @@ side_thread(void *data)
 
 //----------------------------------------------------------------------
 
+/*
+ * Sum the stats over all threads and print calls per second and
+ * latency for each operation.
+ */
+void
+print_report(struct thread_args *args, double secs)
+{
+    latency_hist_t total;
+    int op, i;
+
+    printf("\n%d threads, %.2f sec\n", num_threads, secs);
+    printf("%-8s  %10s  %12s  %10s  %10s  %10s  %10s\n", "op", "calls",
+	   "calls/sec", "mean (us)", "p50 (us)", "p99 (us)", "max (us)");
+
+    for (op = 0; op < NUM_OPS; op++) {
+	latency_hist_init(&total);
+
+	for (i = 0; i < num_threads; i++) {
+	    latency_hist_merge(&total, &args[i].stats[op]);
+	}
+
+	if (total.count == 0) {
+	    printf("%-8s  %10d\n", op_name[op], 0);
+	    continue;
+	}
+
+	printf("%-8s  %10ld  %12.1f  %10.2f  %10.2f  %10.2f  %10.2f\n",
+	       op_name[op], (long) total.count, total.count / secs,
+	       total.sum / 1000.0 / total.count,
+	       latency_hist_percentile(&total, 0.50) / 1000.0,
+	       latency_hist_percentile(&total, 0.99) / 1000.0,
+	       total.max / 1000.0);
+    }
+}
+
+//----------------------------------------------------------------------
+
 /*
  * Args:
  *  program-time  (in seconds),
- *  'mult', 'single', 'nosym'.
+ *  'mult', 'single', 'nosym', 'threads=', 'file=', 'glob='.
  */
 void
 parse_args(int argc, char **argv)
 {
     program_time = PROGRAM_TIME;
-    mult_thread = 1;
+    num_threads = 2;
     do_dlsym = 1;
+    lib_file = NULL;
+    lib_glob = NULL;
 
     for (int k = 1; k < argc; k++) {
 	if (isdigit(argv[k][0])) {
 	    program_time = atoi(argv[k]);
 	}
+	else if (strncmp(argv[k], "threads=", 8) == 0) {
+	    num_threads = atoi(&argv[k][8]);
+	    if (num_threads < 1) {
+		errx(1, "bad number of threads: %s", argv[k]);
+	    }
+	}
+	else if (strncmp(argv[k], "file=", 5) == 0) {
+	    lib_file = &argv[k][5];
+	}
+	else if (strncmp(argv[k], "glob=", 5) == 0) {
+	    lib_glob = &argv[k][5];
+	}
 	else if (strncmp(argv[k], "multiple", 4) == 0) {
-	    mult_thread = 1;
+	    num_threads = 2;
 	}
 	else if (strncmp(argv[k], "single", 4) == 0) {
-	    mult_thread = 0;
+	    num_threads = 1;
 	}
 	else if (strncmp(argv[k], "nosym", 4) == 0) {
 	    do_dlsym = 0;
@@ -346,36 +574,53 @@ parse_args(int argc, char **argv)
 int
 main(int argc, char **argv)
 {
-    struct thread_args main_args, side_args;
-    pthread_t td;
+    struct thread_args *args;
+    struct timeval end;
+    int i;
 
     parse_args(argc, argv);
 
     printf("dlstress: loop of dlopen, dlclose and dlsym\n"
-	   "program time: %d  %s thread,  %s\n\n",
-	   program_time,
-	   (mult_thread) ? "mult" : "single",
+	   "program time: %d  %d thread%s,  %s\n\n",
+	   program_time, num_threads,
+	   (num_threads == 1) ? "" : "s",
 	   (do_dlsym) ? "with dlsym" : "no dlsym");
 
-    mk_lib_array();
+    if (lib_file != NULL) {
+	mk_lib_file(lib_file);
+    }
+    else if (lib_glob != NULL) {
+	mk_lib_glob(lib_glob);
+    }
+    else {
+	mk_lib_array();
+    }
 
-    mk_thread_args(&main_args, &side_args);
+    args = mk_thread_args();
+    thread_list = args;
 
     gettimeofday(&start, NULL);
 
-    if (mult_thread) {
-	if (pthread_create(&td, NULL, side_thread, &side_args) != 0) {
+    for (i = 1; i < num_threads; i++) {
+	if (pthread_create(&args[i].td, NULL, side_thread, &args[i]) != 0) {
 	    err(1, "pthread_create failed");
 	}
     }
 
-    do_loop(&main_args);
+    do_loop(&args[0]);
 
-    if (mult_thread) {
+    if (num_threads > 1) {
 	printf("\nwaiting on pthread_join ...\n");
-	pthread_join(td, NULL);
+	for (i = 1; i < num_threads; i++) {
+	    pthread_join(args[i].td, NULL);
+	}
     }
 
+    gettimeofday(&end, NULL);
+
+    print_report(args, (end.tv_sec - start.tv_sec)
+		 + (end.tv_usec - start.tv_usec) / 1000000.0);
+
     printf("done\n");
 
     return 0;
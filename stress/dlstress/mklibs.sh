@@ -0,0 +1,165 @@
+#!/bin/sh
+#
+#  Copyright (c) 2019-2020, Rice University.
+#  See the file LICENSE for details.
+#
+#  Generate a corpus of synthetic shared libraries from the sum.c
+#  template, for benchmarking load module tracking, symbol lookup and
+#  dlopen under sampling with the same libraries on any machine.
+#
+#  Library k (1 to num) is dir/libsum-k.so and defines funcs functions
+#  sum_k_0 ... sum_k_<funcs-1>.  The sources are in dir/src and the
+#  list of library paths is dir/libs.txt, which dlstress reads with
+#  file=dir/libs.txt.
+#
+#  Usage: ./mklibs.sh [options]
+#
+#    -n num      number of libraries (default 100)
+#    -f funcs    sum functions per library (default 20)
+#    -t bytes    extra bytes of .text per library (default 0)
+#    -T bytes    bytes of thread-local data per library (default 0)
+#    -s segs     extra PT_LOAD segments per library (default 0)
+#    -o dir      output directory (default corpus)
+#    -j jobs     parallel compiles (default: number of CPUs)
+#
+#  The extra segments are small read-only sections placed with
+#  --section-start, 64K apart above the rest of the library, on top of
+#  the segments that the linker makes anyway (2 to 4, depending on
+#  -z separate-code).  CC and CFLAGS are taken from the environment.
+#
+
+num=100
+funcs=20
+text=0
+tls=0
+segs=0
+dir=corpus
+jobs=`nproc 2>/dev/null || echo 1`
+
+CC="${CC:-gcc}"
+CFLAGS="${CFLAGS:--g -O -Wall}"
+
+die() {
+    echo "error: $@" 1>&2
+    exit 1
+}
+
+usage() {
+    cat <<EOF2
+usage: ./mklibs.sh [-n num] [-f funcs] [-t bytes] [-T bytes] [-s segs]
+		  [-o dir] [-j jobs]
+EOF2
+    exit 1
+}
+
+while getopts n:f:t:T:s:o:j:h opt
+do
+    case "$opt" in
+	n ) num="$OPTARG" ;;
+	f ) funcs="$OPTARG" ;;
+	t ) text="$OPTARG" ;;
+	T ) tls="$OPTARG" ;;
+	s ) segs="$OPTARG" ;;
+	o ) dir="$OPTARG" ;;
+	j ) jobs="$OPTARG" ;;
+	* ) usage ;;
+    esac
+done
+
+for val in "$num" "$funcs" "$text" "$tls" "$segs" "$jobs"
+do
+    case "$val" in
+	'' | *[!0-9]* ) die "bad number: $val" ;;
+    esac
+done
+test "$num" -ge 1 || die "need at least one library"
+test "$funcs" -ge 1 || die "need at least one function"
+test "$jobs" -ge 1 || jobs=1
+
+srcdir=`cd \`dirname "$0"\` && pwd`
+test -f "$srcdir/sum.c" || die "unable to find sum.c in $srcdir"
+
+mkdir -p "$dir/src" || die "unable to make: $dir/src"
+dir=`cd "$dir" && pwd`
+
+#
+#  Link flags for the extra segments.  Start the first one 1M above
+#  a generous estimate of the size of the rest of the library.
+#
+seg_flags=
+if test "$segs" -gt 0 ; then
+    base=`expr \( $text + 256 \* $funcs + $tls \) / 1048576 + 1`
+    base=`expr $base \* 1048576`
+    k=1
+    while test $k -le "$segs"
+    do
+	addr=`expr $base + \( $k - 1 \) \* 65536`
+	seg_flags="$seg_flags -Wl,--section-start=.libsum_seg$k=`printf '0x%x' $addr`"
+	k=`expr $k + 1`
+    done
+fi
+
+#
+#  Write the source for library $1.
+#
+mk_source() {
+    src="$dir/src/libsum-$1.c"
+    {
+	echo "/* generated by mklibs.sh, do not edit */"
+	echo
+	echo "#define LIBSUM_TEMPLATE"
+	echo "#define LIBSUM_LABEL  $1"
+	echo "#define LIBSUM_TEXT   $text"
+	echo "#define LIBSUM_TLS    $tls"
+	echo
+	echo "#include \"sum.c\""
+	echo
+	k=1
+	while test $k -le "$segs"
+	do
+	    printf '__asm__ (".section .libsum_seg%d, \\"a\\"\\n"\n' $k
+	    printf '\t ".skip 64\\n"\n'
+	    printf '\t ".previous\\n");\n\n'
+	    k=`expr $k + 1`
+	done
+	j=0
+	while test $j -lt "$funcs"
+	do
+	    echo "MAKE_SUM($j)"
+	    j=`expr $j + 1`
+	done
+    } >"$src"
+}
+
+compile() {
+    $CC $CFLAGS -shared -fPIC -I"$srcdir" $seg_flags \
+	-o "$dir/libsum-$1.so" "$dir/src/libsum-$1.c" \
+	|| die "compile failed: $dir/src/libsum-$1.c"
+}
+
+echo "generating $num libraries in $dir  (funcs: $funcs  text: $text" \
+     " tls: $tls  extra segments: $segs)" 1>&2
+
+: >"$dir/libs.txt"
+n=1
+while test $n -le "$num"
+do
+    # start up to jobs compiles, then wait for all of them
+    pids=
+    k=0
+    while test $k -lt "$jobs" -a $n -le "$num"
+    do
+	mk_source $n
+	compile $n &
+	pids="$pids $!"
+	echo "$dir/libsum-$n.so" >>"$dir/libs.txt"
+	n=`expr $n + 1`
+	k=`expr $k + 1`
+    done
+    for pid in $pids
+    do
+	wait $pid || die "compile failed"
+    done
+done
+
+echo "done: $dir/libs.txt" 1>&2
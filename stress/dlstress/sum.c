@@ -44,24 +44,65 @@
  *    double sum_x_y (long);
  *
  *  Compile twice, with/without LIBSUM_TWO defined.
+ *
+ *  Also used as the template for mklibs.sh, which generates a corpus
+ *  of libraries.  The generated source defines LIBSUM_TEMPLATE (no
+ *  sum functions here, the generated file adds its own MAKE_SUM()
+ *  lines) and:
+ *
+ *    LIBSUM_LABEL -- the x in sum_x_y
+ *    LIBSUM_TEXT  -- bytes of extra padding in .text
+ *    LIBSUM_TLS   -- bytes of a thread-local array that every sum
+ *                    function touches (0 for no TLS)
  */
 
+#ifndef LIBSUM_LABEL
 #ifdef LIBSUM_TWO
-#define MAKE_SUM(num)  SUM_HELP(2, num)
+#define LIBSUM_LABEL  2
 #else
-#define MAKE_SUM(num)  SUM_HELP(1, num)
+#define LIBSUM_LABEL  1
+#endif
+#endif
+
+#ifndef LIBSUM_TEXT
+#define LIBSUM_TEXT  0
+#endif
+
+#ifndef LIBSUM_TLS
+#define LIBSUM_TLS  0
+#endif
+
+#define MAKE_SUM(num)  SUM_EXPAND(LIBSUM_LABEL, num)
+#define SUM_EXPAND(label, suffix)  SUM_HELP(label, suffix)
+
+#define STR_HELP(x)  #x
+#define STR(x)  STR_HELP(x)
+
+#if LIBSUM_TLS > 0
+static __thread char libsum_tls[LIBSUM_TLS];
+#define TLS_TOUCH(num)  (libsum_tls[(num) % LIBSUM_TLS]++)
+#else
+#define TLS_TOUCH(num)  ((void) 0)
+#endif
+
+#if LIBSUM_TEXT > 0
+__asm__ (".text\n"
+	 "libsum_text_pad:\n"
+	 "\t.skip " STR(LIBSUM_TEXT) ", 0\n");
 #endif
 
 #define SUM_HELP(label, suffix)		\
 double sum_ ## label ## _ ## suffix (long num) {  \
     double sum = 0.0;			\
     long k;				\
+    TLS_TOUCH(num);			\
     for (k = 1; k <= num; k++) {	\
 	sum += (double) k;		\
     }					\
     return sum;				\
 }
 
+#ifndef LIBSUM_TEMPLATE
 MAKE_SUM(0)
 MAKE_SUM(1)
 MAKE_SUM(2)
@@ -88,3 +129,4 @@ MAKE_SUM(22)
 MAKE_SUM(23)
 MAKE_SUM(24)
 MAKE_SUM(25)
+#endif